@@ -22,25 +22,11 @@ local function thiscall(ctype)
   end
 end
 
+-- `CCommand`, `edict_t` and `CreateInterfaceFn` are already declared by the
+-- plugin.
 ffi.cdef [[
 // These definitions are taken from <tier1/convar.h> in source-sdk-2013.
 
-enum
-{
-  COMMAND_MAX_ARGC = 64,
-  COMMAND_MAX_LENGTH = 512,
-};
-
-typedef struct CCommand
-{
-  int m_nArgc;
-  int m_nArgv0Size;
-  char m_pArgSBuffer[ COMMAND_MAX_LENGTH ];
-  char m_pArgvBuffer[ COMMAND_MAX_LENGTH ];
-  const char* m_ppArgv[ COMMAND_MAX_ARGC ];
-}
-CCommand;
-
 typedef void ( *FnCommandCallback_t )( const CCommand &command );
 
 typedef struct ConCommand
@@ -86,16 +72,44 @@ end
 -- Define the plugin and its functions.
 
 local Plugin = {
-  command = nil
+  commands = {}
 }
 
 
-function Plugin:Load(create_interface)
-  create_interface = ffi.cast(
-    "void * (*)(const char *name, int *returnCode)",
-    create_interface
-  )
+-- Register a console command that calls `fn` with the command arguments.
+local function add_command(self, ICvar__RegisterConCommand, name, help, fn)
+  -- Callback function for our command.
+  local callback = ffi.cast("FnCommandCallback_t", function(args)
+    fn(ffi.cast("CCommand *", args))
+  end)
+
+  local command = ffi.new("ConCommand", {
+    __vfptr = ConCommand__vtptr,
+    m_pNext = nil,
+    m_bRegistered = false,
+    m_pszName = name,
+    m_pszHelpString = help,
+    m_nFlags = 0,
+    m_fnCommandCallback = callback,
+    m_fnCompletionCallback = nil,
+    m_bHasCompletionCallback = false,
+    m_bUsingNewCommandCallback = true,
+    m_bUsingCommandCallbackInterface = false,
+  })
+
+  ICvar__RegisterConCommand(icvar, command)
+
+  -- Keep the strings referenced by the command alive as well.
+  table.insert(self.commands, {
+    name = name,
+    help = help,
+    callback = callback,
+    command = command,
+  })
+end
 
+
+function Plugin:Load(create_interface)
   icvar = create_interface("VEngineCvar004", nil)
   if icvar == nil then
     warn("ICvar interface not found")
@@ -120,10 +134,7 @@ function Plugin:Load(create_interface)
 
   ConCommand__vtptr = ffi.cast("void ***", reference_command)[0]
 
-  -- Callback function for our command.
-  self.callback = ffi.cast("FnCommandCallback_t", function(args)
-    args = ffi.cast("CCommand *", args)
-
+  add_command(self, ICvar__RegisterConCommand, "lua", "Run a Lua chunk and print its results", function(args)
     -- Contains the whole command string (including the command itself).
     local argstring = ffi.string(args.m_pArgSBuffer)
     local chunk = argstring:gsub("^.-lua", "")
@@ -139,21 +150,47 @@ function Plugin:Load(create_interface)
     end
   end)
 
-  self.command = ffi.new("ConCommand", {
-    __vfptr = ConCommand__vtptr,
-    m_pNext = nil,
-    m_bRegistered = false,
-    m_pszName = "lua",
-    m_pszHelpString = "Run a Lua chunk and print its results",
-    m_nFlags = 0,
-    m_fnCommandCallback = self.callback,
-    m_fnCompletionCallback = nil,
-    m_bHasCompletionCallback = false,
-    m_bUsingNewCommandCallback = true,
-    m_bUsingCommandCallbackInterface = false,
-  })
+  add_command(self, ICvar__RegisterConCommand, "lua_plugin_stats", "Print Lua callback latency stats", function(args)
+    print_plugin_stats()
+  end)
 
-  ICvar__RegisterConCommand(icvar, self.command)
+  add_command(self, ICvar__RegisterConCommand, "lua_plugin_profile", "Start or stop the Lua profiler: start [interval ms] | stop", function(args)
+    local action = args.m_nArgc > 1 and ffi.string(args.m_ppArgv[1]) or ""
+
+    if action == "start" then
+      local interval = args.m_nArgc > 2 and tonumber(ffi.string(args.m_ppArgv[2])) or nil
+      local ok, errmsg = profiler.start(interval)
+      print(ok and "Profiler started" or errmsg)
+    elseif action == "stop" then
+      local path, samples = profiler.stop()
+      if path == nil then
+        warn(samples)
+      else
+        print(("Wrote %d samples to %s"):format(samples, path))
+      end
+    else
+      print("Usage: lua_plugin_profile start [interval ms] | stop")
+    end
+  end)
+
+  add_command(self, ICvar__RegisterConCommand, "lua_plugin_record", "Start or stop recording callbacks: start [path] | stop", function(args)
+    local action = args.m_nArgc > 1 and ffi.string(args.m_ppArgv[1]) or ""
+
+    if action == "start" then
+      local path = args.m_nArgc > 2 and ffi.string(args.m_ppArgv[2]) or nil
+      local trace_path, errmsg = recorder.start(path)
+      print(trace_path and ("Recording to " .. trace_path) or errmsg)
+    elseif action == "stop" then
+      local trace_path, records = recorder.stop()
+      if trace_path == nil then
+        warn(records)
+      else
+        print(("Recorded %d callbacks to %s"):format(records, trace_path))
+      end
+    else
+      print("Usage: lua_plugin_record start [path] | stop")
+    end
+  end)
 
   return true
 end
@@ -161,7 +198,7 @@ end
 
 function Plugin:Unload()
   -- `Unload` is called even when `Load` fails, make sure we can handle that.
-  if self.command == nil then
+  if #self.commands == 0 then
     return
   end
 
@@ -170,10 +207,14 @@ function Plugin:Unload()
     vfunc(icvar, 7)
   )
 
-  ICvar__UnregisterConCommand(icvar, self.command)
+  for _, entry in ipairs(self.commands) do
+    ICvar__UnregisterConCommand(icvar, entry.command)
+
+    -- Callbacks have to be freed manually (see LuaJIT FFI docs).
+    entry.callback:free()
+  end
 
-  -- Callbacks have to be freed manually (see LuaJIT FFI docs).
-  self.callback:free()
+  self.commands = {}
 end
 
 
@@ -1,11 +1,16 @@
 #pragma once
 
+#include "allocator.hpp"
+#include "ctypes.hpp"
 #include "engine.hpp"
 #include "platform.hpp"
 
 #include <lua.hpp>
 
+#include <filesystem>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <type_traits>
 
 
@@ -40,34 +45,95 @@ inline void L_StringifyStack(lua_State *L, int count)
 }
 
 
-template<PrintFn_t *&PrintFn>
-inline int L_Print(lua_State *L)
+inline void L_SetGlobalFunction(lua_State *L, const char *name, lua_CFunction fn)
 {
-    auto print = *PrintFn;
+    lua_pushcfunction(L, fn);
+    lua_setglobal(L, name);
+}
 
-    int argc = lua_gettop(L);
+/**
+ * @brief Sets a global C closure with \p upvalue as its only upvalue (see \c L_ToUpvalue).
+ */
+inline void L_SetGlobalFunction(lua_State *L, const char *name, lua_CFunction fn, void *upvalue)
+{
+    lua_pushlightuserdata(L, upvalue);
+    lua_pushcclosure(L, fn, 1);
+    lua_setglobal(L, name);
+}
 
-    L_StringifyStack(L, argc);
+/**
+ * @brief Sets a global table of C closures, each with \p upvalue as its only upvalue.
+ * @param functions Array terminated by an entry with \c nullptr name.
+ */
+inline void L_SetGlobalLibrary(lua_State *L, const char *name, const luaL_Reg *functions, void *upvalue)
+{
+    lua_newtable(L);
 
-    for (int i = 1; i <= argc; i++)
+    for (; functions->name != nullptr; functions++)
     {
-        if (i > 1)
-            print("\t");
-
-        print("%s", lua_tostring(L, i));
+        lua_pushlightuserdata(L, upvalue);
+        lua_pushcclosure(L, functions->func, 1);
+        lua_setfield(L, -2, functions->name);
     }
 
-    print("\n");
+    lua_setglobal(L, name);
+}
 
-    lua_pop(L, argc);
-    return 0;
+template<typename T>
+T *L_ToUpvalue(lua_State *L, int index = 1)
+{
+    return static_cast<T *>(lua_touserdata(L, lua_upvalueindex(index)));
 }
 
 
-inline void L_SetGlobalFunction(lua_State *L, const char *name, lua_CFunction fn)
+// Addresses of these are the registry keys of the cdata caches of each ctype.
+inline char L_CTYPE_KEYS[L_CTYPE_COUNT];
+
+/**
+ * @brief Pushes \p pointer as cdata of type \p ctype, or as light userdata if the ctypes aren't
+ * declared.
+ *
+ * Cdata are cached by pointer for as long as Lua holds on to them, so the same pointer is the same
+ * cdata across calls and is only allocated again after it was collected. Pushes \c nil if the
+ * cdata can't be created.
+ */
+inline void L_PushCData(lua_State *L, L_CType ctype, void *pointer)
 {
-    lua_pushcfunction(L, fn);
-    lua_setglobal(L, name);
+    lua_pushlightuserdata(L, &L_CTYPE_KEYS[static_cast<std::size_t>(ctype)]);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+
+    if (!lua_istable(L, -1))
+    {
+        lua_pop(L, 1);
+        lua_pushlightuserdata(L, pointer);
+        return;
+    }
+
+    lua_pushlightuserdata(L, pointer);
+    lua_rawget(L, -2);
+
+    if (!lua_isnil(L, -1))
+    {
+        lua_remove(L, -2);
+        return;
+    }
+
+    // The function that creates and caches the cdata is kept in the cache's metatable.
+    lua_pop(L, 1);
+    lua_getmetatable(L, -1);
+    lua_pushliteral(L, "create");
+    lua_rawget(L, -2);
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+
+    // Creating the cdata allocates, arguments are pushed outside of protected calls.
+    lua_pushlightuserdata(L, pointer);
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK)
+    {
+        Warn("%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        lua_pushnil(L);
+    }
 }
 
 
@@ -76,7 +142,17 @@ void L_Push(lua_State *L, T &&value)
 {
     using value_type = std::remove_reference_t<T>;
 
-    if constexpr (std::is_null_pointer<value_type>{})
+    if constexpr (L_CTYPE_OF<std::remove_cv_t<value_type>> != L_CType::None)
+    {
+        void *pointer;
+        if constexpr (std::is_function<std::remove_pointer_t<value_type>>{})
+            pointer = reinterpret_cast<void *>(value);
+        else
+            pointer = const_cast<void *>(static_cast<const void *>(value));
+
+        L_PushCData(L, L_CTYPE_OF<std::remove_cv_t<value_type>>, pointer);
+    }
+    else if constexpr (std::is_null_pointer<value_type>{})
     {
         lua_pushstring(L, value);
     }
@@ -154,19 +230,208 @@ inline void L_SetPackagePath(lua_State *L, Paths... paths)
 }
 
 
+/**
+ * @brief Finds the file that the default Lua loader would load for module \p name.
+ * @return \c false if there is no such file on \c package.path.
+ */
+inline bool L_SearchPackagePath(lua_State *L, const char *name, std::string &file_path)
+{
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "path");
+
+    std::string package_path = lua_isstring(L, -1) ? lua_tostring(L, -1) : "";
+    lua_pop(L, 2);
+
+    std::string module_path = name;
+    for (char &c : module_path)
+    {
+        if (c == '.')
+            c = std::filesystem::path::preferred_separator;
+    }
+
+    std::string_view templates = package_path;
+    while (!templates.empty())
+    {
+        auto end = templates.find(';');
+        auto path_template = templates.substr(0, end);
+        templates.remove_prefix(end == std::string_view::npos ? templates.size() : end + 1);
+
+        file_path.clear();
+        for (char c : path_template)
+        {
+            if (c == '?')
+                file_path.append(module_path);
+            else
+                file_path.push_back(c);
+        }
+
+        std::error_code code;
+        if (!file_path.empty() && std::filesystem::is_regular_file(file_path, code))
+            return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief Adds a function to \c package.loaders, with \p upvalue as its first upvalue.
+ *
+ * Loaders added later go first, but all of them after the \c package.preload loader.
+ */
+inline void L_InsertPackageLoader(lua_State *L, lua_CFunction loader, void *upvalue)
+{
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "loaders");
+
+    for (int i = static_cast<int>(lua_objlen(L, -1)); i >= 2; i--)
+    {
+        lua_rawgeti(L, -1, i);
+        lua_rawseti(L, -2, i + 1);
+    }
+
+    lua_pushlightuserdata(L, upvalue);
+    lua_pushcclosure(L, loader, 1);
+    lua_rawseti(L, -2, 2);
+
+    lua_pop(L, 2);
+}
+
+
+/**
+ * @brief Counts allocations made through a Lua state's allocator.
+ */
+struct L_AllocationCounter
+{
+    lua_Alloc alloc = nullptr;
+    void *ud = nullptr;
+    std::size_t count = 0;
+};
+
+inline void *L_CountingAlloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    auto *counter = static_cast<L_AllocationCounter *>(ud);
+
+    if (nsize != 0 && (ptr == nullptr || nsize > osize))
+        counter->count++;
+
+    return counter->alloc(counter->ud, ptr, osize, nsize);
+}
+
+/**
+ * @brief Routes allocations of \p L through \p counter. The counter must outlive the state.
+ */
+inline void L_InstallAllocationCounter(lua_State *L, L_AllocationCounter &counter)
+{
+    counter.alloc = lua_getallocf(L, &counter.ud);
+    lua_setallocf(L, &L_CountingAlloc, &counter);
+}
+
+
+/**
+ * @brief Gets the \c PoolAllocator used by \p L, or \c nullptr if it uses a different allocator.
+ */
+inline PoolAllocator *L_GetPoolAllocator(lua_State *L)
+{
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+
+    // Look through the counter.
+    if (alloc == &L_CountingAlloc)
+    {
+        auto *counter = static_cast<L_AllocationCounter *>(ud);
+        alloc = counter->alloc;
+        ud = counter->ud;
+    }
+
+    return alloc == &PoolAllocator::Alloc ? static_cast<PoolAllocator *>(ud) : nullptr;
+}
+
+
+/**
+ * @brief Enforces the memory limit of the state's \c PoolAllocator while in scope.
+ *
+ * Meant to wrap protected calls only, see \c PoolAllocator::EnforceLimit.
+ */
+struct L_LimitScope
+{
+private:
+    PoolAllocator *_allocator;
+    bool _was_enforced = false;
+
+public:
+    explicit L_LimitScope(lua_State *L)
+        : _allocator{ L_GetPoolAllocator(L) }
+    {
+        if (_allocator != nullptr)
+        {
+            _was_enforced = _allocator->IsLimitEnforced();
+            _allocator->EnforceLimit(true);
+        }
+    }
+
+    ~L_LimitScope()
+    {
+        if (_allocator != nullptr)
+            _allocator->EnforceLimit(_was_enforced);
+    }
+
+    L_LimitScope(const L_LimitScope &) = delete;
+
+    L_LimitScope &operator=(const L_LimitScope &) = delete;
+};
+
+
+/**
+ * @brief Error handler for \c lua_pcall that appends a traceback to the error message.
+ */
+inline int L_ErrorHandler(lua_State *L)
+{
+    L_StringifyStack(L, 1);
+    luaL_traceback(L, L, lua_tostring(L, -1), 1);
+    return 1;
+}
+
+
+/**
+ * @brief Calls a function with \c L_ErrorHandler already on the stack at \p error_handler_index.
+ *
+ * Unlike the overload without the index, this does not allocate or shuffle the stack.
+ */
+inline bool L_TryCall(lua_State *L, int argc, int retc, int error_handler_index)
+{
+    int status;
+    {
+        L_LimitScope limit(L);
+        status = lua_pcall(L, argc, retc, error_handler_index);
+    }
+
+    if (status != LUA_OK)
+    {
+        // Show message returned from error handler.
+        Warn("%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+
+        return false;
+    }
+
+    return true;
+}
+
+
 inline bool L_TryCall(lua_State *L, int argc, int retc)
 {
     // Insert error handler above called function.
     int base = lua_gettop(L) - argc;
-    lua_pushcfunction(L, [](lua_State *L) {
-        L_StringifyStack(L, 1);
-        luaL_traceback(L, L, lua_tostring(L, -1), 1);
-        return 1;
-    });
+    lua_pushcfunction(L, &L_ErrorHandler);
     lua_insert(L, base);
 
     // Call the function.
-    int status = lua_pcall(L, argc, retc, base);
+    int status;
+    {
+        L_LimitScope limit(L);
+        status = lua_pcall(L, argc, retc, base);
+    }
 
     // Remove error handler.
     lua_remove(L, base);
@@ -184,18 +449,69 @@ inline bool L_TryCall(lua_State *L, int argc, int retc)
 }
 
 
-inline bool L_RunFile(lua_State *L, const char *file_path, int argc, const char *argv[], int retc = 0)
+/**
+ * @brief Declares the ctypes in \c L_CTYPE_DECLARATIONS and prepares \c L_PushCData for them.
+ */
+inline bool L_DeclareCTypes(lua_State *L)
 {
-    auto top = lua_gettop(L);
-
-    // Load chunk.
-    if (luaL_loadfile(L, file_path) != LUA_OK)
+    static const char chunk[] = R"(
+        local ffi = require("ffi")
+        ffi.cdef((...))
+
+        local cast, typeof = ffi.cast, ffi.typeof
+        local caches = {}
+
+        for i = 2, select("#", ...) do
+            local ctype = typeof((select(i, ...)))
+            local cache = {}
+
+            -- Weak values, cdata nobody holds on to are collected.
+            setmetatable(cache, {
+                __mode = "v",
+                create = function(pointer)
+                    local cdata = cast(ctype, pointer)
+                    cache[pointer] = cdata
+                    return cdata
+                end,
+            })
+
+            caches[i - 1] = cache
+        end
+
+        return caches
+    )";
+
+    if (luaL_loadbuffer(L, chunk, sizeof(chunk) - 1, "=ctypes") != LUA_OK)
     {
         Warn("%s\n", lua_tostring(L, -1));
-        lua_pop(L, 1);  // pop error message
+        lua_pop(L, 1);
+        return false;
+    }
+
+    lua_pushstring(L, L_CTYPE_DECLARATIONS);
+    for (const char *name : L_CTYPE_NAMES)
+        lua_pushstring(L, name);
+
+    if (!L_TryCall(L, 1 + static_cast<int>(L_CTYPE_COUNT), 1))
         return false;
+
+    for (std::size_t i = 0; i < L_CTYPE_COUNT; i++)
+    {
+        lua_pushlightuserdata(L, &L_CTYPE_KEYS[i]);
+        lua_rawgeti(L, -2, static_cast<int>(i + 1));
+        lua_rawset(L, LUA_REGISTRYINDEX);
     }
 
+    lua_pop(L, 1);
+    return true;
+}
+
+
+/**
+ * @brief Runs a chunk loaded from \p file_path, which is on top of the stack, like \c L_RunFile.
+ */
+inline bool L_RunChunk(lua_State *L, const char *file_path, int argc, const char *argv[], int retc = 0)
+{
     // Set global 'arg' table.
     lua_createtable(L, 1 + argc, 0);
     // Script path goes to arg[0].
@@ -220,6 +536,28 @@ inline bool L_RunFile(lua_State *L, const char *file_path, int argc, const char
 }
 
 
+inline bool L_RunChunk(lua_State *L, const char *file_path, int retc = 0)
+{
+    return L_RunChunk(L, file_path, 0, nullptr, retc);
+}
+
+
+inline bool L_RunFile(lua_State *L, const char *file_path, int argc, const char *argv[], int retc = 0)
+{
+    auto top = lua_gettop(L);
+
+    // Load chunk.
+    if (luaL_loadfile(L, file_path) != LUA_OK)
+    {
+        Warn("%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);  // pop error message
+        return false;
+    }
+
+    return L_RunChunk(L, file_path, argc, argv, retc);
+}
+
+
 inline bool L_RunFile(lua_State *L, const char *file_path, int retc = 0)
 {
     return L_RunFile(L, file_path, 0, nullptr, retc);
@@ -0,0 +1,219 @@
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+
+PoolAllocator::~PoolAllocator()
+{
+    Reset();
+}
+
+void PoolAllocator::Reset()
+{
+    while (_chunks != nullptr)
+    {
+        Chunk *next = _chunks->next;
+        std::free(_chunks);
+        _chunks = next;
+    }
+
+    for (FreeBlock *&free_list : _free_lists)
+        free_list = nullptr;
+
+    // Lua freed them before the state was closed.
+    _oversized.clear();
+
+    _bump = nullptr;
+    _bump_end = nullptr;
+
+    _live = 0;
+    _peak = 0;
+    _allocations = 0;
+    _frame_start_allocations = 0;
+    _last_frame_allocations = 0;
+    _limit_hits = 0;
+}
+
+void *PoolAllocator::AllocateSmall(std::size_t size)
+{
+    auto size_class = SizeClass(size);
+
+    if (FreeBlock *block = _free_lists[size_class])
+    {
+        _free_lists[size_class] = block->next;
+        return block;
+    }
+
+    std::size_t block_size = (size_class + 1) * GRANULARITY;
+
+    if (static_cast<std::size_t>(_bump_end - _bump) < block_size)
+    {
+        // Leftover space at the end of the current chunk is abandoned.
+        auto *chunk = static_cast<Chunk *>(std::malloc(CHUNK_SIZE));
+        if (chunk == nullptr)
+            return nullptr;
+
+        chunk->next = _chunks;
+        _chunks = chunk;
+
+        // Keep blocks aligned to the granularity.
+        _bump = reinterpret_cast<char *>(chunk) + GRANULARITY;
+        _bump_end = reinterpret_cast<char *>(chunk) + CHUNK_SIZE;
+    }
+
+    void *block = _bump;
+    _bump += block_size;
+    return block;
+}
+
+void PoolAllocator::FreeSmall(void *ptr, std::size_t size)
+{
+    auto size_class = SizeClass(size);
+
+    auto *block = static_cast<FreeBlock *>(ptr);
+    block->next = _free_lists[size_class];
+    _free_lists[size_class] = block;
+}
+
+bool PoolAllocator::ForgetOversized(void *ptr)
+{
+    if (_oversized.empty())
+        return false;
+
+    auto it = std::find(_oversized.begin(), _oversized.end(), ptr);
+    if (it == _oversized.end())
+        return false;
+
+    *it = _oversized.back();
+    _oversized.pop_back();
+    return true;
+}
+
+void *PoolAllocator::Reallocate(void *ptr, std::size_t old_size, std::size_t new_size)
+{
+    bool is_small = new_size <= MAX_SMALL_SIZE;
+
+    if (ptr == nullptr)
+        return is_small ? AllocateSmall(new_size) : std::malloc(new_size);
+
+    bool was_small = old_size <= MAX_SMALL_SIZE;
+
+    if (was_small && ForgetOversized(ptr))
+    {
+        // Holds more than any small size.
+        if (is_small)
+        {
+            _oversized.push_back(ptr);
+            return ptr;
+        }
+
+        void *new_ptr = std::realloc(ptr, new_size);
+        if (new_ptr == nullptr)
+            _oversized.push_back(ptr);
+
+        return new_ptr;
+    }
+
+    if (!was_small && !is_small)
+        return std::realloc(ptr, new_size);
+
+    if (was_small && is_small)
+    {
+        auto old_class = SizeClass(old_size);
+        auto new_class = SizeClass(new_size);
+
+        if (new_class == old_class)
+            return ptr;
+
+        // Shrinking splits off the rest of the block, so it never fails.
+        if (new_class < old_class)
+        {
+            FreeSmall(static_cast<char *>(ptr) + (new_class + 1) * GRANULARITY, (old_class - new_class) * GRANULARITY);
+            return ptr;
+        }
+    }
+
+    void *new_ptr = is_small ? AllocateSmall(new_size) : std::malloc(new_size);
+    if (new_ptr == nullptr)
+    {
+        // Lua assumes that shrinking never fails, so the block stays where it is.
+        if (!was_small && is_small)
+        {
+            try
+            {
+                _oversized.push_back(ptr);
+            }
+            catch (const std::bad_alloc &)
+            {
+                // Then it goes to a free list when freed, which wastes it but is still safe.
+            }
+
+            return ptr;
+        }
+
+        return nullptr;
+    }
+
+    std::memcpy(new_ptr, ptr, std::min(old_size, new_size));
+
+    if (was_small)
+        FreeSmall(ptr, old_size);
+    else
+        std::free(ptr);
+
+    return new_ptr;
+}
+
+void *PoolAllocator::Alloc(void *ud, void *ptr, std::size_t osize, std::size_t nsize)
+{
+    auto *self = static_cast<PoolAllocator *>(ud);
+
+    if (ptr == nullptr)
+        osize = 0;
+
+    if (nsize == 0)
+    {
+        if (ptr != nullptr)
+        {
+            if (osize <= MAX_SMALL_SIZE && !self->ForgetOversized(ptr))
+                self->FreeSmall(ptr, osize);
+            else
+                std::free(ptr);
+
+            self->_live -= osize;
+        }
+
+        return nullptr;
+    }
+
+    if (nsize > osize)
+    {
+        if (self->_limit_enforced && self->_limit != 0 && self->_live + (nsize - osize) > self->_limit)
+        {
+            self->_limit_hits++;
+            return nullptr;
+        }
+
+        self->_allocations++;
+    }
+
+    void *result = self->Reallocate(ptr, osize, nsize);
+
+    if (result == nullptr)
+    {
+        // Lua assumes that shrinking never fails, keep the old block in that case.
+        if (nsize <= osize)
+            result = ptr;
+        else
+            return nullptr;
+    }
+
+    self->_live += nsize;
+    self->_live -= osize;
+    self->_peak = std::max(self->_peak, self->_live);
+
+    return result;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+
+/**
+ * @brief \c lua_Alloc implementation that keeps Lua allocations away from the system heap.
+ *
+ * Small blocks are served from per-size-class free lists, which are refilled by bumping through
+ * large chunks of memory. Freed small blocks go back to their free list and are only returned to
+ * the system when the allocator is destroyed. Large blocks go straight to the system allocator.
+ */
+struct PoolAllocator
+{
+private:
+    static constexpr std::size_t GRANULARITY = 16;
+    static constexpr std::size_t MAX_SMALL_SIZE = 512;
+    static constexpr std::size_t SIZE_CLASS_COUNT = MAX_SMALL_SIZE / GRANULARITY;
+    static constexpr std::size_t CHUNK_SIZE = 256 * 1024;
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    struct Chunk
+    {
+        Chunk *next;
+    };
+
+    FreeBlock *_free_lists[SIZE_CLASS_COUNT] = {};
+
+    Chunk *_chunks = nullptr;
+    char *_bump = nullptr;
+    char *_bump_end = nullptr;
+
+    // Large blocks that Lua shrank to a small size while no small block could be allocated. They
+    // stay where they are and are freed as large blocks.
+    std::vector<void *> _oversized;
+
+    std::size_t _limit = 0;
+    bool _limit_enforced = false;
+
+    std::size_t _live = 0;
+    std::size_t _peak = 0;
+    std::size_t _allocations = 0;
+    std::size_t _frame_start_allocations = 0;
+    std::size_t _last_frame_allocations = 0;
+    std::size_t _limit_hits = 0;
+
+    static std::size_t SizeClass(std::size_t size)
+    {
+        return (size - 1) / GRANULARITY;
+    }
+
+    void *AllocateSmall(std::size_t size);
+
+    void FreeSmall(void *ptr, std::size_t size);
+
+    /**
+     * @brief Stops tracking \p ptr as an oversized block.
+     * @return Whether \p ptr was an oversized block.
+     */
+    bool ForgetOversized(void *ptr);
+
+    void *Reallocate(void *ptr, std::size_t old_size, std::size_t new_size);
+
+public:
+    PoolAllocator() = default;
+
+    PoolAllocator(const PoolAllocator &) = delete;
+
+    PoolAllocator &operator=(const PoolAllocator &) = delete;
+
+    ~PoolAllocator();
+
+    /**
+     * @brief The \c lua_Alloc function, with an instance of this struct as user data.
+     */
+    static void *Alloc(void *ud, void *ptr, std::size_t osize, std::size_t nsize);
+
+    /**
+     * @brief Releases all memory. Only valid after the Lua state using this allocator is closed.
+     */
+    void Reset();
+
+    /**
+     * @brief Sets the maximum number of live bytes, 0 means unlimited.
+     */
+    void SetLimit(std::size_t limit)
+    {
+        _limit = limit;
+    }
+
+    std::size_t GetLimit() const
+    {
+        return _limit;
+    }
+
+    /**
+     * @brief Controls whether the limit is enforced.
+     *
+     * Failing an allocation outside of a protected call makes Lua panic and abort the process,
+     * so the limit should only be enforced while Lua code runs in a protected call.
+     */
+    void EnforceLimit(bool enforce)
+    {
+        _limit_enforced = enforce;
+    }
+
+    bool IsLimitEnforced() const
+    {
+        return _limit_enforced;
+    }
+
+    /**
+     * @brief Starts counting allocations for a new frame.
+     */
+    void BeginFrame()
+    {
+        _last_frame_allocations = _allocations - _frame_start_allocations;
+        _frame_start_allocations = _allocations;
+    }
+
+    std::size_t GetLiveBytes() const
+    {
+        return _live;
+    }
+
+    std::size_t GetPeakBytes() const
+    {
+        return _peak;
+    }
+
+    std::size_t GetAllocations() const
+    {
+        return _allocations;
+    }
+
+    /**
+     * @brief Allocations made during the last complete frame.
+     */
+    std::size_t GetFrameAllocations() const
+    {
+        return _last_frame_allocations;
+    }
+
+    /**
+     * @brief Number of allocations refused because of the limit.
+     */
+    std::size_t GetLimitHits() const
+    {
+        return _limit_hits;
+    }
+};
@@ -0,0 +1,154 @@
+#include "bundle.hpp"
+
+#include "L.hpp"
+#include "platform.hpp"
+
+#include <lua.hpp>
+
+#include <cstring>
+
+
+ModuleBundle::~ModuleBundle()
+{
+    Close();
+}
+
+bool ModuleBundle::Open(const std::string &path, std::string &error)
+{
+    Close();
+
+    std::size_t size;
+    const void *data = MapFile(path.c_str(), size);
+    if (data == nullptr)
+    {
+        error = path + ": could not map file";
+        return false;
+    }
+
+    _data = static_cast<const char *>(data);
+    _size = size;
+    _path = path;
+
+    auto fail = [&](const char *reason) {
+        error = path + ": " + reason;
+        Close();
+        return false;
+    };
+
+    if (_size < sizeof(BundleHeader))
+        return fail("file is too small");
+
+    const auto *header = reinterpret_cast<const BundleHeader *>(_data);
+
+    if (std::memcmp(header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0)
+        return fail("not a bundle");
+
+    if (header->version != BUNDLE_VERSION)
+        return fail("unsupported bundle version");
+
+    if (header->entry_count > (_size - sizeof(BundleHeader)) / sizeof(BundleEntry))
+        return fail("index is truncated");
+
+    _entries = reinterpret_cast<const BundleEntry *>(_data + sizeof(BundleHeader));
+    _entry_count = header->entry_count;
+
+    // Check everything once, so lookups don't have to.
+    for (std::uint32_t i = 0; i < _entry_count; i++)
+    {
+        const auto &entry = _entries[i];
+
+        if (entry.name_offset > _size || entry.name_length > _size - entry.name_offset
+            || entry.chunk_offset > _size || entry.chunk_length > _size - entry.chunk_offset)
+            return fail("entry is out of bounds");
+
+        if (i > 0 && GetName(_entries[i - 1]) >= GetName(entry))
+            return fail("index is not sorted");
+    }
+
+    return true;
+}
+
+void ModuleBundle::Close()
+{
+    if (_data != nullptr)
+        UnmapFile(_data, _size);
+
+    _data = nullptr;
+    _size = 0;
+    _path.clear();
+    _entries = nullptr;
+    _entry_count = 0;
+}
+
+int ModuleBundle::Load(lua_State *L, std::string_view name) const
+{
+    std::uint32_t low = 0;
+    std::uint32_t high = _entry_count;
+
+    while (low < high)
+    {
+        std::uint32_t middle = low + (high - low) / 2;
+        auto middle_name = GetName(_entries[middle]);
+
+        if (middle_name < name)
+        {
+            low = middle + 1;
+        }
+        else if (middle_name > name)
+        {
+            high = middle;
+        }
+        else
+        {
+            const auto &entry = _entries[middle];
+
+            // Only used for chunks compiled without debug info.
+            std::string chunk_name = "=";
+            chunk_name.append(name);
+
+            return luaL_loadbuffer(L, _data + entry.chunk_offset, entry.chunk_length, chunk_name.c_str());
+        }
+    }
+
+    // No temporary string, LuaJIT doesn't run destructors on all platforms when this runs out of memory.
+    lua_pushlstring(L, name.data(), name.size());
+    lua_pushfstring(L, "module '%s' not found in bundle '%s'", lua_tostring(L, -1), _path.c_str());
+    lua_remove(L, -2);
+    return LUA_ERRFILE;
+}
+
+void ModuleBundle::Install(lua_State *L) const
+{
+    if (!IsOpen())
+        return;
+
+    L_InsertPackageLoader(L, &L_Loader, const_cast<ModuleBundle *>(this));
+}
+
+int ModuleBundle::L_Loader(lua_State *L)
+{
+    const auto *self = L_ToUpvalue<ModuleBundle>(L);
+
+    size_t name_length;
+    const char *name = luaL_checklstring(L, 1, &name_length);
+
+    // Nothing that needs destroying is alive when the error is raised, LuaJIT doesn't run destructors
+    // on all platforms.
+    int status = self->Load(L, { name, name_length });
+
+    if (status == LUA_ERRFILE)
+    {
+        lua_pop(L, 1);
+        lua_pushfstring(L, "\n\tno module '%s' in '%s'", name, self->_path.c_str());
+        return 1;
+    }
+
+    if (status != LUA_OK)
+    {
+        return luaL_error(
+            L, "error loading module '%s' from bundle '%s':\n\t%s", name, self->_path.c_str(), lua_tostring(L, -1)
+        );
+    }
+
+    return 1;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+// A bundle file starts with a header, followed by an index of modules sorted by name. Names and
+// chunks are stored after the index. All integers are little-endian.
+
+constexpr char BUNDLE_MAGIC[4] = { 'L', 'U', 'A', 'B' };
+constexpr std::uint32_t BUNDLE_VERSION = 1;
+
+struct BundleHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t entry_count;
+    std::uint32_t reserved;
+};
+
+struct BundleEntry
+{
+    // Offsets are from the start of the file.
+    std::uint32_t name_offset;
+    std::uint32_t name_length;
+    std::uint32_t chunk_offset;
+    std::uint32_t chunk_length;
+};
+
+
+/**
+ * @brief Serves modules from a memory-mapped bundle of compiled chunks, see the \c luab tool.
+ */
+struct ModuleBundle
+{
+private:
+    const char *_data = nullptr;
+    std::size_t _size = 0;
+    std::string _path;
+
+    const BundleEntry *_entries = nullptr;
+    std::uint32_t _entry_count = 0;
+
+    std::string_view GetName(const BundleEntry &entry) const
+    {
+        return { _data + entry.name_offset, entry.name_length };
+    }
+
+    static int L_Loader(lua_State *L);
+
+public:
+    ModuleBundle() = default;
+
+    ModuleBundle(const ModuleBundle &) = delete;
+
+    ModuleBundle &operator=(const ModuleBundle &) = delete;
+
+    ~ModuleBundle();
+
+    /**
+     * @param error Set to the reason of failure.
+     */
+    bool Open(const std::string &path, std::string &error);
+
+    void Close();
+
+    bool IsOpen() const
+    {
+        return _data != nullptr;
+    }
+
+    const std::string &GetPath() const
+    {
+        return _path;
+    }
+
+    /**
+     * @brief Loads a module as a function, like \c luaL_loadbuffer.
+     * @return \c LUA_ERRFILE if there is no such module.
+     */
+    int Load(lua_State *L, std::string_view name) const;
+
+    /**
+     * @brief Makes \c require look for modules in the bundle before searching for files.
+     */
+    void Install(lua_State *L) const;
+};
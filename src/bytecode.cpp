@@ -0,0 +1,145 @@
+#include "bytecode.hpp"
+
+#include "engine.hpp"
+#include "fileio.hpp"
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+
+static std::string BuildKey(const char *path, const FileInfo &info)
+{
+    // Bytecode differs between LuaJIT versions and between 32 and 64-bit builds.
+    std::string key = LUAJIT_VERSION;
+    key.append("\n").append(std::to_string(sizeof(void *)));
+    key.append("\n").append(path);
+    key.append("\n").append(std::to_string(info.size));
+    key.append("\n").append(std::to_string(info.write_time));
+    key.push_back('\0');
+
+    return key;
+}
+
+static int Writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), sz);
+    return 0;
+}
+
+
+void BytecodeCache::SetDirectory(const std::string &directory)
+{
+    _directory = directory;
+    _enabled = !_directory.empty();
+
+    if (_enabled && _directory.back() != '/' && _directory.back() != '\\')
+        _directory.push_back('/');
+}
+
+std::string BytecodeCache::GetEntryPath(const std::string &source_path) const
+{
+    // FNV-1a
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : source_path)
+        hash = (hash ^ c) * 0x100000001b3;
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.luac", static_cast<unsigned long long>(hash));
+
+    return _directory + name;
+}
+
+void BytecodeCache::Store(lua_State *L, const std::string &entry_path, const std::string &key)
+{
+    std::string entry = key;
+    if (lua_dump(L, &Writer, &entry) != 0)
+        return;
+
+    std::error_code code;
+    std::filesystem::create_directories(_directory, code);
+
+    std::string error;
+    if (!WriteFileAtomic(entry_path, entry, error))
+    {
+        // Don't keep trying to write into a directory that can't be written to.
+        Warn("Disabling bytecode cache: %s\n", error.c_str());
+        _enabled = false;
+    }
+}
+
+int BytecodeCache::LoadFile(lua_State *L, const char *path)
+{
+    if (!_enabled)
+        return luaL_loadfile(L, path);
+
+    FileInfo info;
+    std::string error;
+    if (!GetFileInfo(path, info, error) || info.directory)
+        return luaL_loadfile(L, path);
+
+    std::string key = BuildKey(path, info);
+    std::string entry_path = GetEntryPath(path);
+
+    std::string entry;
+    if (ReadFile(entry_path, entry, error) && entry.size() > key.size() && entry.compare(0, key.size(), key) == 0)
+    {
+        // Same chunk name as `luaL_loadfile`, so error messages point to the source.
+        std::string chunk_name = "@";
+        chunk_name.append(path);
+
+        if (luaL_loadbuffer(L, entry.data() + key.size(), entry.size() - key.size(), chunk_name.c_str()) == LUA_OK)
+            return LUA_OK;
+
+        // Corrupted entry, compile it again.
+        lua_pop(L, 1);
+    }
+
+    int status = luaL_loadfile(L, path);
+    if (status == LUA_OK)
+        Store(L, entry_path, key);
+
+    return status;
+}
+
+void BytecodeCache::Open(lua_State *L)
+{
+    if (!_enabled)
+        return;
+
+    L_InsertPackageLoader(L, &L_Loader, this);
+}
+
+int BytecodeCache::L_Loader(lua_State *L)
+{
+    auto *self = L_ToUpvalue<BytecodeCache>(L);
+    const char *name = luaL_checkstring(L, 1);
+
+    bool loaded;
+
+    // Errors are raised after the path is gone, LuaJIT doesn't run destructors on all platforms.
+    {
+        std::string file_path;
+
+        // Let the default loader report where it looked.
+        if (!L_SearchPackagePath(L, name, file_path))
+            return 0;
+
+        loaded = self->LoadFile(L, file_path.c_str()) == LUA_OK;
+        if (!loaded)
+            lua_pushstring(L, file_path.c_str());
+    }
+
+    if (!loaded)
+    {
+        return luaL_error(
+            L, "error loading module '%s' from file '%s':\n\t%s", name, lua_tostring(L, -1), lua_tostring(L, -2)
+        );
+    }
+
+    return 1;
+}
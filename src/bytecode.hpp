@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Loads Lua source files through an on-disk cache of compiled bytecode.
+ *
+ * Cache entries are keyed by the source path, size and modification time and the LuaJIT version, so
+ * a changed source or a LuaJIT upgrade recompiles the file. Any problem with the cache falls back
+ * to loading the source.
+ */
+struct BytecodeCache
+{
+private:
+    std::string _directory;
+    bool _enabled = false;
+
+    std::string GetEntryPath(const std::string &source_path) const;
+
+    void Store(lua_State *L, const std::string &entry_path, const std::string &key);
+
+    static int L_Loader(lua_State *L);
+
+public:
+    /**
+     * @param directory Where compiled chunks are stored, empty disables the cache.
+     */
+    void SetDirectory(const std::string &directory);
+
+    bool IsEnabled() const
+    {
+        return _enabled;
+    }
+
+    /**
+     * @brief Same as \c luaL_loadfile, but uses cached bytecode if it is up to date.
+     */
+    int LoadFile(lua_State *L, const char *path);
+
+    /**
+     * @brief Makes \c require load modules found on \c package.path through the cache.
+     */
+    void Open(lua_State *L);
+};
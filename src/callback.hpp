@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+
+/**
+ * @brief Plugin callbacks that are delegated to Lua functions of the same name.
+ *
+ * Callbacks after the engine ones are only called by the plugin itself.
+ */
+enum class Callback
+{
+    Load = 0,
+    Unload,
+    Pause,
+    UnPause,
+    GetPluginDescription,
+    LevelInit,
+    ServerActivate,
+    GameFrame,
+    LevelShutdown,
+    ClientActive,
+    ClientFullyConnect,
+    ClientDisconnect,
+    ClientPutInServer,
+    SetCommandClient,
+    ClientSettingsChanged,
+    ClientConnect,
+    ClientCommand,
+    NetworkIDValidated,
+    OnQueryCvarValueFinished,
+    OnEdictAllocated,
+    OnEdictFreed,
+
+    // Edict events collected during a frame, see `EdictBatch`.
+    OnEdictBatch,
+
+    COUNT
+};
+
+inline constexpr std::size_t CALLBACK_COUNT = static_cast<std::size_t>(Callback::COUNT);
+
+inline constexpr const char *CALLBACK_NAMES[CALLBACK_COUNT] = {
+    "Load",
+    "Unload",
+    "Pause",
+    "UnPause",
+    "GetPluginDescription",
+    "LevelInit",
+    "ServerActivate",
+    "GameFrame",
+    "LevelShutdown",
+    "ClientActive",
+    "ClientFullyConnect",
+    "ClientDisconnect",
+    "ClientPutInServer",
+    "SetCommandClient",
+    "ClientSettingsChanged",
+    "ClientConnect",
+    "ClientCommand",
+    "NetworkIDValidated",
+    "OnQueryCvarValueFinished",
+    "OnEdictAllocated",
+    "OnEdictFreed",
+    "OnEdictBatch",
+};
+
+static_assert(CALLBACK_COUNT <= 32, "Callback bitmasks are 32 bits wide.");
+
+
+inline constexpr std::size_t CallbackIndex(Callback callback)
+{
+    return static_cast<std::size_t>(callback);
+}
+
+inline constexpr std::uint32_t CallbackBit(Callback callback)
+{
+    return std::uint32_t{ 1 } << CallbackIndex(callback);
+}
+
+inline constexpr const char *GetCallbackName(Callback callback)
+{
+    return CALLBACK_NAMES[CallbackIndex(callback)];
+}
+
+/**
+ * @brief Finds the callback with given name.
+ * @return \c true if found, \c false otherwise.
+ */
+inline bool FindCallback(std::string_view name, Callback &callback)
+{
+    for (std::size_t i = 0; i < CALLBACK_COUNT; i++)
+    {
+        if (name == CALLBACK_NAMES[i])
+        {
+            callback = static_cast<Callback>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
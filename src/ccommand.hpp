@@ -0,0 +1,37 @@
+#pragma once
+
+#include "interface.hpp"
+
+
+/**
+ * @brief Console command arguments, laid out like \c CCommand from <tier1/convar.h> in source-sdk-2013.
+ *
+ * Must stay in sync with the \c CCommand declaration in \c L_CTYPE_DECLARATIONS.
+ */
+class CCommand
+{
+public:
+    static constexpr int COMMAND_MAX_ARGC = 64;
+    static constexpr int COMMAND_MAX_LENGTH = 512;
+
+    int m_nArgc;
+    int m_nArgv0Size;
+    char m_pArgSBuffer[COMMAND_MAX_LENGTH];
+    char m_pArgvBuffer[COMMAND_MAX_LENGTH];
+    const char *m_ppArgv[COMMAND_MAX_ARGC];
+
+    int ArgC() const
+    {
+        return m_nArgc;
+    }
+
+    const char *Arg(int index) const
+    {
+        return index >= 0 && index < m_nArgc ? m_ppArgv[index] : "";
+    }
+};
+
+static_assert(
+    sizeof(CCommand) == 2 * sizeof(int) + 2 * CCommand::COMMAND_MAX_LENGTH + CCommand::COMMAND_MAX_ARGC * sizeof(void *),
+    "CCommand must not have padding."
+);
@@ -0,0 +1,76 @@
+#include "commands.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <cctype>
+
+
+const std::string &CommandRouter::MakeKey(const char *name)
+{
+    _key.clear();
+
+    for (const char *c = name; *c != '\0'; c++)
+        _key.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(*c))));
+
+    return _key;
+}
+
+int CommandRouter::Find(const char *name)
+{
+    auto route = _routes.find(MakeKey(name));
+    return route != _routes.end() ? route->second : LUA_NOREF;
+}
+
+void CommandRouter::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "register", &L_Register },
+        { "unregister", &L_Unregister },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "commands", functions, this);
+}
+
+int CommandRouter::L_Register(lua_State *L)
+{
+    auto *self = L_ToUpvalue<CommandRouter>(L);
+
+    const char *name = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    if (*name == '\0')
+        return luaL_argerror(L, 1, "command name is empty");
+
+    lua_settop(L, 2);
+    int handler = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    auto [route, inserted] = self->_routes.try_emplace(self->MakeKey(name), handler);
+    if (!inserted)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, route->second);
+        route->second = handler;
+    }
+
+    return 0;
+}
+
+int CommandRouter::L_Unregister(lua_State *L)
+{
+    auto *self = L_ToUpvalue<CommandRouter>(L);
+
+    auto route = self->_routes.find(self->MakeKey(luaL_checkstring(L, 1)));
+    if (route == self->_routes.end())
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, route->second);
+    self->_routes.erase(route);
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
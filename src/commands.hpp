@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Lua handlers of client commands, looked up by command name without entering Lua.
+ *
+ * Names are case-insensitive, like client commands in the engine.
+ */
+struct CommandRouter
+{
+private:
+    // Registry references to handlers by lowercase command name.
+    std::unordered_map<std::string, int> _routes;
+
+    // Reused for lookups, so they don't allocate.
+    std::string _key;
+
+    const std::string &MakeKey(const char *name);
+
+    static int L_Register(lua_State *L);
+
+    static int L_Unregister(lua_State *L);
+
+public:
+    bool IsEmpty() const
+    {
+        return _routes.empty();
+    }
+
+    /**
+     * @return Registry reference to the handler of \p name, or \c LUA_NOREF.
+     */
+    int Find(const char *name);
+
+    /**
+     * @brief Forgets all handlers. Only valid after the Lua state is closed.
+     */
+    void Clear()
+    {
+        _routes.clear();
+    }
+
+    /**
+     * @brief Registers the \c commands library.
+     */
+    void Open(lua_State *L);
+};
@@ -0,0 +1,131 @@
+#include "config.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+
+static std::string_view Trim(std::string_view text)
+{
+    constexpr std::string_view WHITESPACE = " \t\r\n";
+
+    auto start = text.find_first_not_of(WHITESPACE);
+    if (start == text.npos)
+        return {};
+
+    auto end = text.find_last_not_of(WHITESPACE);
+    return text.substr(start, end - start + 1);
+}
+
+
+bool Config::LoadFile(const std::string &file_path)
+{
+    _values.clear();
+
+    std::ifstream file(file_path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::string_view text = line;
+
+        // Strip comment. Does not handle `//` inside quotes, but neither does the engine.
+        auto comment = text.find("//");
+        if (comment != text.npos)
+            text.remove_suffix(text.size() - comment);
+
+        text = Trim(text);
+        if (text.empty())
+            continue;
+
+        auto key_end = text.find_first_of(" \t");
+        auto key = text.substr(0, key_end);
+        auto value = key_end == text.npos ? std::string_view{} : Trim(text.substr(key_end));
+
+        // Remove quotes.
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            value = value.substr(1, value.size() - 2);
+
+        _values[std::string(key)] = value;
+    }
+
+    return true;
+}
+
+const char *Config::GetString(const std::string &key, const char *default_value) const
+{
+    auto it = _values.find(key);
+    if (it == _values.end())
+        return default_value;
+
+    return it->second.c_str();
+}
+
+long long Config::GetInteger(const std::string &key, long long default_value) const
+{
+    const char *value = GetString(key);
+    if (value == nullptr)
+        return default_value;
+
+    char *end;
+    long long result = std::strtoll(value, &end, 0);
+    return *end == '\0' && end != value ? result : default_value;
+}
+
+double Config::GetNumber(const std::string &key, double default_value) const
+{
+    const char *value = GetString(key);
+    if (value == nullptr)
+        return default_value;
+
+    char *end;
+    double result = std::strtod(value, &end);
+    return *end == '\0' && end != value ? result : default_value;
+}
+
+bool Config::GetBool(const std::string &key, bool default_value) const
+{
+    const char *value = GetString(key);
+    if (value == nullptr)
+        return default_value;
+
+    std::string_view text = value;
+
+    if (text == "1" || text == "true" || text == "on" || text == "yes")
+        return true;
+
+    if (text == "0" || text == "false" || text == "off" || text == "no")
+        return false;
+
+    return default_value;
+}
+
+std::size_t Config::GetSize(const std::string &key, std::size_t default_value) const
+{
+    const char *value = GetString(key);
+    if (value == nullptr)
+        return default_value;
+
+    char *end;
+    unsigned long long result = std::strtoull(value, &end, 10);
+    if (end == value)
+        return default_value;
+
+    switch (*end)
+    {
+    case 'G': case 'g':
+        result *= 1024;
+        [[fallthrough]];
+    case 'M': case 'm':
+        result *= 1024;
+        [[fallthrough]];
+    case 'K': case 'k':
+        result *= 1024;
+        end++;
+        break;
+    }
+
+    return *end == '\0' ? static_cast<std::size_t>(result) : default_value;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+/**
+ * @brief Plugin settings, read from \c <plugin name>.cfg next to the plugin binary.
+ *
+ * Each line holds a key followed by its value, like console variables in a Source \c .cfg file.
+ * Values containing whitespace can be quoted. Everything after \c // is a comment.
+ */
+struct Config
+{
+private:
+    std::unordered_map<std::string, std::string> _values;
+
+public:
+    /**
+     * @brief Replaces current settings with those from \p file_path.
+     * @return \c false if the file could not be read. Settings are cleared either way.
+     */
+    bool LoadFile(const std::string &file_path);
+
+    const char *GetString(const std::string &key, const char *default_value = nullptr) const;
+
+    long long GetInteger(const std::string &key, long long default_value) const;
+
+    double GetNumber(const std::string &key, double default_value) const;
+
+    bool GetBool(const std::string &key, bool default_value) const;
+
+    /**
+     * @brief Gets a byte count, optionally suffixed with \c K, \c M or \c G.
+     */
+    std::size_t GetSize(const std::string &key, std::size_t default_value) const;
+};
@@ -0,0 +1,641 @@
+#include "connectionfilter.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <utility>
+
+
+//============================== Addresses ====================================#
+
+static bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool ParseIpv4(std::string_view text, std::uint32_t &value)
+{
+    value = 0;
+
+    std::size_t i = 0;
+    for (int part = 0; part < 4; part++)
+    {
+        if (part > 0)
+        {
+            if (i >= text.size() || text[i] != '.')
+                return false;
+            i++;
+        }
+
+        unsigned number = 0;
+        std::size_t digits = 0;
+        for (; i < text.size() && IsDigit(text[i]); i++)
+        {
+            number = number * 10 + (text[i] - '0');
+            if (++digits > 3)
+                return false;
+        }
+
+        if (digits == 0 || number > 255)
+            return false;
+
+        value = value << 8 | number;
+    }
+
+    return i == text.size();
+}
+
+static bool ParseIpv6(std::string_view text, IpAddress &address)
+{
+    // Groups before and after "::".
+    std::uint16_t head[8];
+    std::uint16_t tail[8];
+    int head_count = 0;
+    int tail_count = 0;
+    bool compressed = false;
+
+    std::size_t i = 0;
+    if (text.substr(0, 2) == "::")
+    {
+        compressed = true;
+        i = 2;
+    }
+
+    while (i < text.size())
+    {
+        std::uint16_t *groups = compressed ? tail : head;
+        int &count = compressed ? tail_count : head_count;
+
+        if (head_count + tail_count >= 8)
+            return false;
+
+        // Trailing IPv4 address, like ::ffff:1.2.3.4.
+        auto rest = text.substr(i);
+        if (rest.find(':') == std::string_view::npos && rest.find('.') != std::string_view::npos)
+        {
+            std::uint32_t ipv4;
+            if (head_count + tail_count > 6 || !ParseIpv4(rest, ipv4))
+                return false;
+
+            groups[count++] = static_cast<std::uint16_t>(ipv4 >> 16);
+            groups[count++] = static_cast<std::uint16_t>(ipv4);
+            break;
+        }
+
+        unsigned group = 0;
+        std::size_t digits = 0;
+        for (int digit; i < text.size() && (digit = HexValue(text[i])) >= 0; i++)
+        {
+            group = group << 4 | digit;
+            if (++digits > 4)
+                return false;
+        }
+
+        if (digits == 0)
+            return false;
+
+        groups[count++] = static_cast<std::uint16_t>(group);
+
+        if (i == text.size())
+            break;
+
+        if (text[i++] != ':' || i == text.size())
+            return false;
+
+        if (text[i] == ':')
+        {
+            if (compressed)
+                return false;
+
+            compressed = true;
+            i++;
+        }
+    }
+
+    int count = head_count + tail_count;
+    if (compressed ? count > 7 : count != 8)
+        return false;
+
+    std::uint16_t groups[8] = {};
+    std::copy(head, head + head_count, groups);
+    std::copy(tail, tail + tail_count, groups + 8 - tail_count);
+
+    address = {};
+    for (int group = 0; group < 4; group++)
+    {
+        address.high = address.high << 16 | groups[group];
+        address.low = address.low << 16 | groups[group + 4];
+    }
+
+    return true;
+}
+
+bool ParseIpAddress(std::string_view text, IpAddress &address, int &max_prefix_length)
+{
+    if (text.find(':') != std::string_view::npos)
+    {
+        max_prefix_length = 128;
+        return ParseIpv6(text, address);
+    }
+
+    std::uint32_t ipv4;
+    if (!ParseIpv4(text, ipv4))
+        return false;
+
+    address.high = 0;
+    address.low = 0xffff00000000 | ipv4;
+    max_prefix_length = 32;
+
+    return true;
+}
+
+bool ParseIpRange(std::string_view text, IpAddress &address, int &prefix_length)
+{
+    auto slash = text.find('/');
+
+    int max_prefix_length;
+    if (!ParseIpAddress(text.substr(0, slash), address, max_prefix_length))
+        return false;
+
+    prefix_length = max_prefix_length;
+
+    if (slash != std::string_view::npos)
+    {
+        auto length = text.substr(slash + 1);
+        if (length.empty() || length.size() > 3)
+            return false;
+
+        prefix_length = 0;
+        for (char c : length)
+        {
+            if (!IsDigit(c))
+                return false;
+
+            prefix_length = prefix_length * 10 + (c - '0');
+        }
+
+        if (prefix_length > max_prefix_length)
+            return false;
+    }
+
+    // IPv4 ranges live below ::ffff:0:0/96.
+    if (max_prefix_length == 32)
+        prefix_length += 96;
+
+    return true;
+}
+
+bool ParseEndpoint(std::string_view text, IpAddress &address)
+{
+    if (!text.empty() && text.front() == '[')
+    {
+        auto end = text.find(']');
+        if (end == std::string_view::npos)
+            return false;
+
+        text = text.substr(1, end - 1);
+    }
+    else if (auto colon = text.find(':'); colon != std::string_view::npos && text.find(':', colon + 1) == std::string_view::npos)
+    {
+        // IPv4 with port, bare IPv6 has more than one colon.
+        text = text.substr(0, colon);
+    }
+
+    int max_prefix_length;
+    return ParseIpAddress(text, address, max_prefix_length);
+}
+
+
+//============================== Prefix Trie ==================================#
+
+static int CountLeadingZeros(std::uint64_t x)
+{
+    int count = 0;
+    for (int shift = 32; shift > 0; shift /= 2)
+    {
+        if ((x >> (64 - shift)) == 0)
+        {
+            count += shift;
+            x <<= shift;
+        }
+    }
+    return count;
+}
+
+static int GetBit(const IpAddress &address, int index)
+{
+    return index < 64
+        ? static_cast<int>(address.high >> (63 - index) & 1)
+        : static_cast<int>(address.low >> (127 - index) & 1);
+}
+
+static IpAddress Mask(const IpAddress &address, int length)
+{
+    IpAddress masked;
+
+    if (length >= 64)
+        masked.high = address.high;
+    else if (length > 0)
+        masked.high = address.high & ~0ull << (64 - length);
+
+    if (length >= 128)
+        masked.low = address.low;
+    else if (length > 64)
+        masked.low = address.low & ~0ull << (128 - length);
+
+    return masked;
+}
+
+static int CommonPrefixLength(const IpAddress &a, const IpAddress &b, int limit)
+{
+    int length = 128;
+
+    if (auto x = a.high ^ b.high; x != 0)
+        length = CountLeadingZeros(x);
+    else if (auto y = a.low ^ b.low; y != 0)
+        length = 64 + CountLeadingZeros(y);
+
+    return std::min(length, limit);
+}
+
+PrefixTrie::PrefixTrie()
+{
+    Clear();
+}
+
+std::int32_t PrefixTrie::AddNode(const IpAddress &key, int length, int value)
+{
+    _nodes.push_back({ Mask(key, length), length, value, { NONE, NONE } });
+    return static_cast<std::int32_t>(_nodes.size() - 1);
+}
+
+void PrefixTrie::Insert(const IpAddress &address, int prefix_length, int value)
+{
+    // Nodes are addressed by index, adding nodes moves them.
+    std::int32_t node = 0;
+
+    while (true)
+    {
+        if (_nodes[node].length == prefix_length)
+        {
+            _range_count += (_nodes[node].value == 0) - (value == 0);
+            _nodes[node].value = value;
+            return;
+        }
+
+        int bit = GetBit(address, _nodes[node].length);
+        std::int32_t child = _nodes[node].children[bit];
+
+        if (child == NONE)
+        {
+            if (value != 0)
+            {
+                child = AddNode(address, prefix_length, value);
+                _nodes[node].children[bit] = child;
+                _range_count++;
+            }
+            return;
+        }
+
+        const auto &key = _nodes[child].key;
+        int child_length = _nodes[child].length;
+        int common = CommonPrefixLength(address, key, std::min(prefix_length, child_length));
+
+        if (common == child_length)
+        {
+            node = child;
+            continue;
+        }
+
+        if (value == 0)
+            return;
+
+        // Split the edge to the child at the first differing bit.
+        int child_bit = GetBit(key, common);
+        std::int32_t middle = AddNode(address, common, 0);
+        _nodes[middle].children[child_bit] = child;
+        _nodes[node].children[bit] = middle;
+
+        if (common == prefix_length)
+            _nodes[middle].value = value;
+        else
+            _nodes[middle].children[child_bit ^ 1] = AddNode(address, prefix_length, value);
+
+        _range_count++;
+        return;
+    }
+}
+
+int PrefixTrie::Find(const IpAddress &address) const
+{
+    const Node *node = &_nodes[0];
+    int value = node->value;
+
+    while (node->length < 128)
+    {
+        std::int32_t child = node->children[GetBit(address, node->length)];
+        if (child == NONE)
+            break;
+
+        node = &_nodes[child];
+        if (CommonPrefixLength(address, node->key, node->length) != node->length)
+            break;
+
+        if (node->value != 0)
+            value = node->value;
+    }
+
+    return value;
+}
+
+void PrefixTrie::Clear()
+{
+    _nodes.clear();
+    _range_count = 0;
+
+    AddNode({}, 0, 0);
+}
+
+
+//============================== Connection Filter ============================#
+
+void ConnectionFilter::SetRate(double rate, double burst)
+{
+    _rate = std::max(rate, 0.0);
+    _burst = std::max(burst, 1.0);
+    _buckets.clear();
+}
+
+void ConnectionFilter::SetMessages(std::string ban_message, std::string rate_limit_message)
+{
+    _ban_message = std::move(ban_message);
+    _rate_limit_message = std::move(rate_limit_message);
+}
+
+bool ConnectionFilter::TakeToken(const IpAddress &address, Clock::time_point now)
+{
+    if (_buckets.size() >= _prune_size)
+        PruneBuckets(now);
+
+    auto [bucket, inserted] = _buckets.try_emplace(address, Bucket{ _burst, now });
+    auto &state = bucket->second;
+
+    if (!inserted)
+    {
+        double elapsed = std::chrono::duration<double>(now - state.updated).count();
+        state.tokens = std::min(_burst, state.tokens + elapsed * _rate);
+        state.updated = now;
+    }
+
+    if (state.tokens < 1.0)
+        return false;
+
+    state.tokens -= 1.0;
+    return true;
+}
+
+void ConnectionFilter::PruneBuckets(Clock::time_point now)
+{
+    // Full buckets are the same as no bucket.
+    for (auto bucket = _buckets.begin(); bucket != _buckets.end();)
+    {
+        double elapsed = std::chrono::duration<double>(now - bucket->second.updated).count();
+        if (bucket->second.tokens + elapsed * _rate >= _burst)
+            bucket = _buckets.erase(bucket);
+        else
+            ++bucket;
+    }
+
+    // Keeps pruning amortized O(1) when many addresses connect at once.
+    _prune_size = std::max(BUCKET_PRUNE_THRESHOLD, _buckets.size() * 2);
+}
+
+ConnectionFilter::Verdict ConnectionFilter::Check(const char *endpoint, Clock::time_point now)
+{
+    IpAddress address;
+    if (endpoint == nullptr || !ParseEndpoint(endpoint, address))
+        return Verdict::Pass;
+
+    switch (_rules.Find(address))
+    {
+    case ACTION_ALLOW:
+        return Verdict::Allowed;
+
+    case ACTION_BAN:
+        _banned++;
+        return Verdict::Banned;
+    }
+
+    if (_rate > 0.0 && !TakeToken(address, now))
+    {
+        _rate_limited++;
+        return Verdict::RateLimited;
+    }
+
+    return Verdict::Pass;
+}
+
+const std::string &ConnectionFilter::GetRejectMessage(Verdict verdict) const
+{
+    return verdict == Verdict::RateLimited ? _rate_limit_message : _ban_message;
+}
+
+void ConnectionFilter::Clear()
+{
+    _rules.Clear();
+    _staging.Clear();
+    _buckets.clear();
+    _prune_size = BUCKET_PRUNE_THRESHOLD;
+    _banned = 0;
+    _rate_limited = 0;
+}
+
+void ConnectionFilter::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "load", &L_Load },
+        { "ban", &L_Ban },
+        { "allow", &L_Allow },
+        { "clear", &L_Clear },
+        { "check", &L_Check },
+        { "set_rate", &L_SetRate },
+        { "stats", &L_Stats },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "connection_filter", functions, this);
+}
+
+void ConnectionFilter::LoadRules(lua_State *L, PrefixTrie &rules, int table_index, const char *field, int action)
+{
+    lua_getfield(L, table_index, field);
+
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        return;
+    }
+
+    if (!lua_istable(L, -1))
+        luaL_error(L, "'%s' must be a table of ranges", field);
+
+    int count = static_cast<int>(lua_objlen(L, -1));
+    for (int i = 1; i <= count; i++)
+    {
+        lua_rawgeti(L, -1, i);
+
+        std::size_t length;
+        const char *text = lua_tolstring(L, -1, &length);
+
+        IpAddress address;
+        int prefix_length;
+        if (text == nullptr || !ParseIpRange({ text, length }, address, prefix_length))
+            luaL_error(L, "invalid range %s[%d]: %s", field, i, text != nullptr ? text : luaL_typename(L, -1));
+
+        rules.Insert(address, prefix_length, action);
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+}
+
+int ConnectionFilter::L_Load(lua_State *L)
+{
+    auto *self = L_ToUpvalue<ConnectionFilter>(L);
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    self->_staging.Clear();
+
+    // Allow ranges win over the exact same ban ranges.
+    LoadRules(L, self->_staging, 1, "ban", ACTION_BAN);
+    LoadRules(L, self->_staging, 1, "allow", ACTION_ALLOW);
+
+    std::swap(self->_rules, self->_staging);
+    self->_staging.Clear();
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_rules.GetRangeCount()));
+    return 1;
+}
+
+int ConnectionFilter::AddRule(lua_State *L, int action)
+{
+    auto *self = L_ToUpvalue<ConnectionFilter>(L);
+
+    std::size_t length;
+    const char *text = luaL_checklstring(L, 1, &length);
+
+    IpAddress address;
+    int prefix_length;
+    if (!ParseIpRange({ text, length }, address, prefix_length))
+        return luaL_argerror(L, 1, "invalid range");
+
+    self->_rules.Insert(address, prefix_length, action);
+    return 0;
+}
+
+int ConnectionFilter::L_Ban(lua_State *L)
+{
+    return AddRule(L, ACTION_BAN);
+}
+
+int ConnectionFilter::L_Allow(lua_State *L)
+{
+    return AddRule(L, ACTION_ALLOW);
+}
+
+int ConnectionFilter::L_Clear(lua_State *L)
+{
+    auto *self = L_ToUpvalue<ConnectionFilter>(L);
+
+    if (lua_isnoneornil(L, 1))
+    {
+        self->_rules.Clear();
+        return 0;
+    }
+
+    std::size_t length;
+    const char *text = luaL_checklstring(L, 1, &length);
+
+    IpAddress address;
+    int prefix_length;
+    if (!ParseIpRange({ text, length }, address, prefix_length))
+        return luaL_argerror(L, 1, "invalid range");
+
+    self->_rules.Insert(address, prefix_length, ACTION_NONE);
+    return 0;
+}
+
+int ConnectionFilter::L_Check(lua_State *L)
+{
+    auto *self = L_ToUpvalue<ConnectionFilter>(L);
+
+    std::size_t length;
+    const char *text = luaL_checklstring(L, 1, &length);
+
+    IpAddress address;
+    if (!ParseEndpoint({ text, length }, address))
+        return luaL_argerror(L, 1, "invalid address");
+
+    switch (self->_rules.Find(address))
+    {
+    case ACTION_BAN:
+        lua_pushliteral(L, "ban");
+        break;
+
+    case ACTION_ALLOW:
+        lua_pushliteral(L, "allow");
+        break;
+
+    default:
+        lua_pushnil(L);
+        break;
+    }
+
+    return 1;
+}
+
+int ConnectionFilter::L_SetRate(lua_State *L)
+{
+    auto *self = L_ToUpvalue<ConnectionFilter>(L);
+
+    double rate = luaL_checknumber(L, 1);
+    double burst = luaL_optnumber(L, 2, self->_burst);
+
+    self->SetRate(rate, burst);
+    return 0;
+}
+
+int ConnectionFilter::L_Stats(lua_State *L)
+{
+    auto *self = L_ToUpvalue<ConnectionFilter>(L);
+
+    lua_createtable(L, 0, 4);
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_rules.GetRangeCount()));
+    lua_setfield(L, -2, "ranges");
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_buckets.size()));
+    lua_setfield(L, -2, "buckets");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_banned));
+    lua_setfield(L, -2, "banned");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_rate_limited));
+    lua_setfield(L, -2, "rate_limited");
+
+    return 1;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief IPv6 address, or IPv4 address mapped into IPv6 (`::ffff:a.b.c.d`). Bit 0 is the most significant bit of \c high.
+ */
+struct IpAddress
+{
+    std::uint64_t high = 0;
+    std::uint64_t low = 0;
+
+    bool operator==(const IpAddress &other) const
+    {
+        return high == other.high && low == other.low;
+    }
+
+    struct Hash
+    {
+        std::size_t operator()(const IpAddress &address) const
+        {
+            return std::hash<std::uint64_t>{}(address.high * 0x9e3779b97f4a7c15 ^ address.low);
+        }
+    };
+};
+
+/**
+ * @brief Parses an IPv4 or IPv6 address, without port.
+ * @param max_prefix_length Set to 32 for IPv4 and 128 for IPv6.
+ */
+bool ParseIpAddress(std::string_view text, IpAddress &address, int &max_prefix_length);
+
+/**
+ * @brief Parses `address/length` in CIDR notation, or a single address. IPv4 prefixes are mapped into IPv6.
+ */
+bool ParseIpRange(std::string_view text, IpAddress &address, int &prefix_length);
+
+/**
+ * @brief Parses the address of a connecting client, like `1.2.3.4:27005` or `[::1]:27005`.
+ */
+bool ParseEndpoint(std::string_view text, IpAddress &address);
+
+
+/**
+ * @brief Path-compressed binary trie of address ranges, looked up by longest matching prefix.
+ *
+ * Lookups visit at most one node per bit of the longest stored prefix. Value 0 means no value.
+ */
+struct PrefixTrie
+{
+private:
+    static constexpr std::int32_t NONE = -1;
+
+    struct Node
+    {
+        IpAddress key;
+        int length;
+        int value;
+        std::int32_t children[2];
+    };
+
+    std::vector<Node> _nodes;
+    std::size_t _range_count = 0;
+
+    std::int32_t AddNode(const IpAddress &key, int length, int value);
+
+public:
+    PrefixTrie();
+
+    /**
+     * @brief Associates \p value with the range, replacing the value of the exact same range.
+     */
+    void Insert(const IpAddress &address, int prefix_length, int value);
+
+    /**
+     * @return Value of the most specific range containing \p address, or 0.
+     */
+    int Find(const IpAddress &address) const;
+
+    void Clear();
+
+    std::size_t GetRangeCount() const
+    {
+        return _range_count;
+    }
+};
+
+
+/**
+ * @brief Decides whether a connecting client gets to \c ClientConnect, without entering Lua.
+ *
+ * Addresses in ban ranges are rejected. Addresses in allow ranges are let through, even when they
+ * are also in a (less specific) ban range, and are not rate limited. Other addresses are rate
+ * limited with a token bucket per address.
+ */
+struct ConnectionFilter
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Verdict
+    {
+        // No rule matched and the rate limit was not hit.
+        Pass,
+        Allowed,
+        Banned,
+        RateLimited,
+    };
+
+private:
+    enum Action
+    {
+        ACTION_NONE = 0,
+        ACTION_BAN,
+        ACTION_ALLOW,
+    };
+
+    struct Bucket
+    {
+        double tokens;
+        Clock::time_point updated;
+    };
+
+    static constexpr std::size_t BUCKET_PRUNE_THRESHOLD = 4096;
+
+    PrefixTrie _rules;
+
+    // Filled by connection_filter.load, then swapped with _rules, so errors leave the rules intact.
+    PrefixTrie _staging;
+
+    double _rate = 0.0;
+    double _burst = 0.0;
+    std::unordered_map<IpAddress, Bucket, IpAddress::Hash> _buckets;
+    std::size_t _prune_size = BUCKET_PRUNE_THRESHOLD;
+
+    std::string _ban_message;
+    std::string _rate_limit_message;
+
+    std::uint64_t _banned = 0;
+    std::uint64_t _rate_limited = 0;
+
+    bool TakeToken(const IpAddress &address, Clock::time_point now);
+
+    void PruneBuckets(Clock::time_point now);
+
+    static void LoadRules(lua_State *L, PrefixTrie &rules, int table_index, const char *field, int action);
+
+    static int L_Load(lua_State *L);
+
+    static int AddRule(lua_State *L, int action);
+
+    static int L_Ban(lua_State *L);
+
+    static int L_Allow(lua_State *L);
+
+    static int L_Clear(lua_State *L);
+
+    static int L_Check(lua_State *L);
+
+    static int L_SetRate(lua_State *L);
+
+    static int L_Stats(lua_State *L);
+
+public:
+    /**
+     * @param rate Connection attempts per second per address, 0 disables rate limiting.
+     * @param burst Connection attempts allowed in a row.
+     */
+    void SetRate(double rate, double burst);
+
+    void SetMessages(std::string ban_message, std::string rate_limit_message);
+
+    bool IsActive() const
+    {
+        return _rate > 0.0 || _rules.GetRangeCount() != 0;
+    }
+
+    /**
+     * @brief Matches \p endpoint against the rules and takes a token from its bucket.
+     *
+     * Endpoints that are not IP addresses, like \c loopback, always pass.
+     */
+    Verdict Check(const char *endpoint, Clock::time_point now);
+
+    /**
+     * @brief Message shown to clients rejected with \p verdict.
+     */
+    const std::string &GetRejectMessage(Verdict verdict) const;
+
+    /**
+     * @brief Forgets all rules and rate limit state, keeps the settings.
+     */
+    void Clear();
+
+    /**
+     * @brief Registers the \c connection_filter library.
+     */
+    void Open(lua_State *L);
+};
@@ -0,0 +1,199 @@
+#include "console.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <cstdio>
+
+
+void Console::SetRateLimit(double rate, double burst)
+{
+    _rate = std::max(rate, 0.0);
+    _burst = std::max(burst, 1.0);
+    _sites.clear();
+    _suppressed = 0;
+}
+
+bool Console::Admit(lua_State *L, PrintFn_t *print)
+{
+    if (_rate <= 0.0)
+        return true;
+
+    // Level 0 is print itself.
+    lua_Debug ar;
+    SiteKey key{ nullptr, 0 };
+    bool has_caller = lua_getstack(L, 1, &ar) && lua_getinfo(L, "Sl", &ar);
+    if (has_caller)
+        key = { ar.source, ar.currentline };
+
+    auto now = Clock::now();
+
+    auto [entry, inserted] = _sites.try_emplace(key);
+    auto &site = entry->second;
+
+    if (inserted)
+    {
+        site.tokens = _burst;
+        site.updated = now;
+        site.suppressed = 0;
+        site.print = print;
+        site.location = has_caller ? std::string(ar.short_src) + ":" + std::to_string(ar.currentline) : "?";
+    }
+    else
+    {
+        double elapsed = std::chrono::duration<double>(now - site.updated).count();
+        site.tokens = std::min(_burst, site.tokens + elapsed * _rate);
+        site.updated = now;
+    }
+
+    if (site.tokens < 1.0)
+    {
+        site.suppressed++;
+        _suppressed++;
+        return false;
+    }
+
+    site.tokens -= 1.0;
+
+    if (site.suppressed != 0)
+        ReportSuppressed(site);
+
+    return true;
+}
+
+void Console::Format(lua_State *L, int argc)
+{
+    _buffer.clear();
+
+    for (int i = 1; i <= argc; i++)
+    {
+        if (i > 1)
+            _buffer.push_back('\t');
+
+        switch (lua_type(L, i))
+        {
+        case LUA_TNUMBER:
+        {
+            // Same format as tostring, without creating a string.
+            char number[32];
+            lua_Number value = lua_tonumber(L, i);
+            int length = value != value
+                ? std::snprintf(number, sizeof(number), "nan")
+                : std::snprintf(number, sizeof(number), LUA_NUMBER_FMT, value);
+            _buffer.append(number, static_cast<std::size_t>(length));
+            break;
+        }
+
+        case LUA_TNIL:
+            _buffer.append("nil");
+            break;
+
+        case LUA_TBOOLEAN:
+            _buffer.append(lua_toboolean(L, i) ? "true" : "false");
+            break;
+
+        default:
+        {
+            // Strings, and values converted by Write.
+            std::size_t length;
+            const char *text = lua_tolstring(L, i, &length);
+            _buffer.append(text, length);
+            break;
+        }
+        }
+    }
+
+    _buffer.push_back('\n');
+}
+
+void Console::Emit(PrintFn_t *print)
+{
+    for (std::size_t offset = 0; offset < _buffer.size(); offset += CHUNK_SIZE)
+    {
+        auto length = std::min(CHUNK_SIZE, _buffer.size() - offset);
+        print("%.*s", static_cast<int>(length), _buffer.data() + offset);
+    }
+}
+
+void Console::ReportSuppressed(Site &site)
+{
+    site.print("%llu messages suppressed (%s)\n", static_cast<unsigned long long>(site.suppressed), site.location.c_str());
+
+    _suppressed -= site.suppressed;
+    site.suppressed = 0;
+}
+
+void Console::Flush(Clock::time_point now)
+{
+    if (_suppressed == 0 || now < _next_flush)
+        return;
+
+    _next_flush = now + std::chrono::seconds(1);
+
+    for (auto &[key, site] : _sites)
+    {
+        if (site.suppressed != 0)
+            ReportSuppressed(site);
+    }
+}
+
+void Console::Clear()
+{
+    _sites.clear();
+    _suppressed = 0;
+}
+
+void Console::Open(lua_State *L)
+{
+    L_SetGlobalFunction(L, "print", &L_Print, this);
+    L_SetGlobalFunction(L, "warn", &L_Warn, this);
+}
+
+int Console::Write(lua_State *L, PrintFn_t *print)
+{
+    auto *self = L_ToUpvalue<Console>(L);
+
+    if (!self->Admit(L, print))
+        return 0;
+
+    int argc = lua_gettop(L);
+
+    // Convert other values first, `__tostring` may print too.
+    for (int i = 1; i <= argc; i++)
+    {
+        switch (lua_type(L, i))
+        {
+        case LUA_TSTRING:
+        case LUA_TNUMBER:
+        case LUA_TNIL:
+        case LUA_TBOOLEAN:
+            continue;
+        }
+
+        lua_getglobal(L, "tostring");
+        lua_pushvalue(L, i);
+        lua_call(L, 1, 1);
+
+        if (!lua_isstring(L, -1))
+            return luaL_error(L, LUA_QL("tostring") " must return a string");
+
+        lua_replace(L, i);
+    }
+
+    self->Format(L, argc);
+    self->Emit(print);
+
+    return 0;
+}
+
+int Console::L_Print(lua_State *L)
+{
+    return Write(L, Print);
+}
+
+int Console::L_Warn(lua_State *L)
+{
+    return Write(L, Warn);
+}
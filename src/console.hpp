@@ -0,0 +1,105 @@
+#pragma once
+
+#include "engine.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Lua \c print and \c warn that send each line to the engine in one call.
+ *
+ * Lines are formatted into a reused buffer. Each call site (source and line) may be rate limited
+ * with a token bucket, suppressed lines are reported as a count.
+ */
+struct Console
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    // tier0 formats messages into a fixed-size buffer, longer lines are sent in parts.
+    static constexpr std::size_t CHUNK_SIZE = 4000;
+
+    struct SiteKey
+    {
+        // Interned chunk name, stays the same for all calls from the same chunk.
+        const char *source;
+        int line;
+
+        bool operator==(const SiteKey &other) const
+        {
+            return source == other.source && line == other.line;
+        }
+    };
+
+    struct SiteKeyHash
+    {
+        std::size_t operator()(const SiteKey &key) const
+        {
+            return std::hash<const void *>{}(key.source) ^ static_cast<std::size_t>(key.line) * 0x9e3779b9;
+        }
+    };
+
+    struct Site
+    {
+        double tokens;
+        Clock::time_point updated;
+        std::uint64_t suppressed;
+        PrintFn_t *print;
+        std::string location;
+    };
+
+    std::string _buffer;
+
+    double _rate = 0.0;
+    double _burst = 0.0;
+    std::unordered_map<SiteKey, Site, SiteKeyHash> _sites;
+    std::uint64_t _suppressed = 0;
+    Clock::time_point _next_flush;
+
+    /**
+     * @return Whether the line may be printed.
+     */
+    bool Admit(lua_State *L, PrintFn_t *print);
+
+    void Format(lua_State *L, int argc);
+
+    void Emit(PrintFn_t *print);
+
+    void ReportSuppressed(Site &site);
+
+    static int Write(lua_State *L, PrintFn_t *print);
+
+    static int L_Print(lua_State *L);
+
+    static int L_Warn(lua_State *L);
+
+public:
+    /**
+     * @param rate Lines per second per call site, 0 disables rate limiting.
+     * @param burst Lines per call site allowed in a row.
+     */
+    void SetRateLimit(double rate, double burst);
+
+    /**
+     * @brief Reports lines suppressed since the last report, at most once per second.
+     */
+    void Flush(Clock::time_point now);
+
+    /**
+     * @brief Forgets all call sites. Only valid after the Lua state is closed.
+     */
+    void Clear();
+
+    /**
+     * @brief Sets the \c print and \c warn globals.
+     */
+    void Open(lua_State *L);
+};
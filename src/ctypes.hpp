@@ -0,0 +1,99 @@
+#pragma once
+
+#include "edictbatch.hpp"
+#include "interface.hpp"
+
+#include <cstddef>
+
+
+/**
+ * @brief FFI ctypes that pointer arguments of callbacks are pushed as.
+ */
+enum class L_CType
+{
+    // Not mapped, pushed as light userdata.
+    None = -1,
+
+    Edict = 0,
+    ConstCommand,
+    BoolPointer,
+    CreateInterfaceFn,
+    ConstEdictEvent,
+
+    COUNT
+};
+
+inline constexpr std::size_t L_CTYPE_COUNT = static_cast<std::size_t>(L_CType::COUNT);
+
+inline constexpr const char *L_CTYPE_NAMES[L_CTYPE_COUNT] = {
+    "edict_t *",
+    "const CCommand *",
+    "bool *",
+    "CreateInterfaceFn",
+    "const PluginEdictEvent *",
+};
+
+/**
+ * @brief Declarations of the ctypes in \c L_CTYPE_NAMES, passed to \c ffi.cdef once per state.
+ */
+inline constexpr const char L_CTYPE_DECLARATIONS[] = R"(
+typedef struct edict_t edict_t;
+
+// From <tier1/convar.h> in source-sdk-2013.
+enum
+{
+  COMMAND_MAX_ARGC = 64,
+  COMMAND_MAX_LENGTH = 512,
+};
+
+typedef struct CCommand
+{
+  int m_nArgc;
+  int m_nArgv0Size;
+  char m_pArgSBuffer[ COMMAND_MAX_LENGTH ];
+  char m_pArgvBuffer[ COMMAND_MAX_LENGTH ];
+  const char* m_ppArgv[ COMMAND_MAX_ARGC ];
+}
+CCommand;
+
+typedef void *(*CreateInterfaceFn)(const char *name, int *return_code);
+
+typedef struct PluginEdictEvent
+{
+  int32_t type;
+  int32_t reserved;
+  const edict_t *edict;
+}
+PluginEdictEvent;
+)";
+
+static_assert(
+    offsetof(EdictEvent, type) == 0 && offsetof(EdictEvent, edict) == 8 && sizeof(EdictEvent) == 8 + sizeof(void *),
+    "EdictEvent must match PluginEdictEvent in L_CTYPE_DECLARATIONS."
+);
+
+
+/**
+ * @brief Compile-time mapping from C++ pointer types to the ctypes they are pushed as.
+ */
+template<typename T>
+inline constexpr L_CType L_CTYPE_OF = L_CType::None;
+
+template<>
+inline constexpr L_CType L_CTYPE_OF<edict_t *> = L_CType::Edict;
+
+// Same ctype as mutable edicts, so an edict is the same cdata in every callback.
+template<>
+inline constexpr L_CType L_CTYPE_OF<const edict_t *> = L_CType::Edict;
+
+template<>
+inline constexpr L_CType L_CTYPE_OF<const CCommand *> = L_CType::ConstCommand;
+
+template<>
+inline constexpr L_CType L_CTYPE_OF<bool *> = L_CType::BoolPointer;
+
+template<>
+inline constexpr L_CType L_CTYPE_OF<CreateInterfaceFn *> = L_CType::CreateInterfaceFn;
+
+template<>
+inline constexpr L_CType L_CTYPE_OF<const EdictEvent *> = L_CType::ConstEdictEvent;
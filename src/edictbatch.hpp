@@ -0,0 +1,77 @@
+#pragma once
+
+#include "interface.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+enum class EdictEventType : std::int32_t
+{
+    Allocated = 0,
+    Freed = 1,
+    SettingsChanged = 2,
+};
+
+/**
+ * @brief Entry of the array passed to \c OnEdictBatch. The layout is part of the Lua API.
+ */
+struct EdictEvent
+{
+    EdictEventType type;
+    std::int32_t reserved;
+    const edict_t *edict;
+};
+
+
+/**
+ * @brief Fixed-capacity buffer of edict events, collected between two deliveries to Lua.
+ */
+struct EdictBatch
+{
+private:
+    std::vector<EdictEvent> _events;
+    std::size_t _capacity = 0;
+
+public:
+    /**
+     * @brief Allocates room for \p capacity events up front, so adding events never allocates.
+     */
+    void Reserve(std::size_t capacity)
+    {
+        _capacity = capacity > 0 ? capacity : 1;
+        _events.clear();
+        _events.reserve(_capacity);
+    }
+
+    bool IsFull() const
+    {
+        return _events.size() >= _capacity;
+    }
+
+    bool IsEmpty() const
+    {
+        return _events.empty();
+    }
+
+    void Add(EdictEventType type, const edict_t *edict)
+    {
+        _events.push_back({ type, 0, edict });
+    }
+
+    const EdictEvent *GetData() const
+    {
+        return _events.data();
+    }
+
+    std::size_t GetCount() const
+    {
+        return _events.size();
+    }
+
+    void Clear()
+    {
+        _events.clear();
+    }
+};
@@ -0,0 +1,170 @@
+#include "events.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+
+
+void EventBus::Insert(std::size_t index, const Subscriber &subscriber)
+{
+    auto &subscribers = _subscribers[index];
+
+    // After all subscribers of the same priority.
+    auto position = std::upper_bound(subscribers.begin(), subscribers.end(), subscriber, [](const Subscriber &a, const Subscriber &b) {
+        return a.priority > b.priority;
+    });
+
+    subscribers.insert(position, subscriber);
+}
+
+void EventBus::Update()
+{
+    if (_has_removed)
+    {
+        for (auto &subscribers : _subscribers)
+        {
+            subscribers.erase(
+                std::remove_if(subscribers.begin(), subscribers.end(), [](const Subscriber &subscriber) {
+                    return subscriber.function == LUA_NOREF;
+                }),
+                subscribers.end()
+            );
+        }
+
+        _has_removed = false;
+    }
+
+    for (const auto &[index, subscriber] : _pending)
+    {
+        if (subscriber.function != LUA_NOREF)
+            Insert(index, subscriber);
+    }
+
+    _pending.clear();
+
+    _mask = 0;
+    for (std::size_t i = 0; i < CALLBACK_COUNT; i++)
+    {
+        if (!_subscribers[i].empty())
+            _mask |= CallbackBit(static_cast<Callback>(i));
+    }
+}
+
+void EventBus::Clear()
+{
+    for (auto &subscribers : _subscribers)
+        subscribers.clear();
+
+    _pending.clear();
+    _mask = 0;
+    _has_removed = false;
+}
+
+void EventBus::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "subscribe", &L_Subscribe },
+        { "unsubscribe", &L_Unsubscribe },
+        { "count", &L_Count },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "events", functions, this);
+}
+
+static Callback CheckCallback(lua_State *L, int index)
+{
+    Callback callback;
+    if (!FindCallback(luaL_checkstring(L, index), callback))
+        luaL_argerror(L, index, "unknown callback");
+
+    return callback;
+}
+
+int EventBus::L_Subscribe(lua_State *L)
+{
+    auto *self = L_ToUpvalue<EventBus>(L);
+
+    auto callback = CheckCallback(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    auto priority = static_cast<int>(luaL_optinteger(L, 3, 0));
+
+    // Subscribers can't exist before the plugin is loaded.
+    if (callback == Callback::Load)
+        return luaL_argerror(L, 1, "can't subscribe to Load");
+
+    lua_pushvalue(L, 2);
+    Subscriber subscriber{ luaL_ref(L, LUA_REGISTRYINDEX), priority, self->_next_id++ };
+
+    if (self->_dispatch_depth > 0)
+    {
+        self->_pending.emplace_back(CallbackIndex(callback), subscriber);
+    }
+    else
+    {
+        self->Insert(CallbackIndex(callback), subscriber);
+        self->_mask |= CallbackBit(callback);
+    }
+
+    lua_pushinteger(L, static_cast<lua_Integer>(subscriber.id));
+    return 1;
+}
+
+int EventBus::L_Unsubscribe(lua_State *L)
+{
+    auto *self = L_ToUpvalue<EventBus>(L);
+    auto id = static_cast<std::uint32_t>(luaL_checkinteger(L, 1));
+
+    auto matches = [&](const Subscriber &subscriber) {
+        return subscriber.id == id && subscriber.function != LUA_NOREF;
+    };
+
+    for (auto &[index, subscriber] : self->_pending)
+    {
+        if (matches(subscriber))
+        {
+            luaL_unref(L, LUA_REGISTRYINDEX, subscriber.function);
+            subscriber.function = LUA_NOREF;
+
+            lua_pushboolean(L, 1);
+            return 1;
+        }
+    }
+
+    for (auto &subscribers : self->_subscribers)
+    {
+        auto subscriber = std::find_if(subscribers.begin(), subscribers.end(), matches);
+        if (subscriber == subscribers.end())
+            continue;
+
+        luaL_unref(L, LUA_REGISTRYINDEX, subscriber->function);
+        subscriber->function = LUA_NOREF;
+
+        // Running dispatches skip the entry, it is removed once they are done.
+        self->_has_removed = true;
+        if (self->_dispatch_depth == 0)
+            self->Update();
+
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+
+    lua_pushboolean(L, 0);
+    return 1;
+}
+
+int EventBus::L_Count(lua_State *L)
+{
+    auto *self = L_ToUpvalue<EventBus>(L);
+    auto callback = CheckCallback(L, 1);
+
+    const auto &subscribers = self->_subscribers[CallbackIndex(callback)];
+    auto count = std::count_if(subscribers.begin(), subscribers.end(), [](const Subscriber &subscriber) {
+        return subscriber.function != LUA_NOREF;
+    });
+
+    lua_pushinteger(L, static_cast<lua_Integer>(count));
+    return 1;
+}
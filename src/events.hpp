@@ -0,0 +1,105 @@
+#pragma once
+
+#include "callback.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Lua functions subscribed to plugin callbacks, called after the plugin table's handlers.
+ *
+ * Subscribers are kept per callback, ordered by descending priority and then by subscription
+ * order. While subscribers are being called, new subscriptions are held back until the outermost
+ * dispatch ends and unsubscribed entries are only marked, so the arrays never move under a
+ * running dispatch.
+ */
+struct EventBus
+{
+public:
+    struct Subscriber
+    {
+        // Registry reference to the function, `LUA_NOREF` once unsubscribed.
+        int function;
+        int priority;
+        std::uint32_t id;
+    };
+
+private:
+    std::vector<Subscriber> _subscribers[CALLBACK_COUNT];
+
+    // Subscriptions made during a dispatch, by callback index.
+    std::vector<std::pair<std::size_t, Subscriber>> _pending;
+
+    // Bit set for each callback that has at least one subscriber.
+    std::uint32_t _mask = 0;
+
+    std::uint32_t _next_id = 1;
+    int _dispatch_depth = 0;
+    bool _has_removed = false;
+
+    void Insert(std::size_t index, const Subscriber &subscriber);
+
+    void Update();
+
+    static int L_Subscribe(lua_State *L);
+
+    static int L_Unsubscribe(lua_State *L);
+
+    static int L_Count(lua_State *L);
+
+public:
+    /**
+     * @brief Marks the subscriber arrays as in use for the lifetime of the scope.
+     */
+    struct DispatchScope
+    {
+    private:
+        EventBus &_bus;
+
+    public:
+        DispatchScope(EventBus &bus) : _bus{ bus }
+        {
+            _bus._dispatch_depth++;
+        }
+
+        ~DispatchScope()
+        {
+            if (--_bus._dispatch_depth == 0 && (_bus._has_removed || !_bus._pending.empty()))
+                _bus.Update();
+        }
+    };
+
+    bool HasSubscribers(Callback callback) const
+    {
+        return (_mask & CallbackBit(callback)) != 0;
+    }
+
+    std::uint32_t GetMask() const
+    {
+        return _mask;
+    }
+
+    /**
+     * @brief Subscribers of \p callback. Entries may be unsubscribed while iterating, but the array stays.
+     */
+    const std::vector<Subscriber> &Get(Callback callback) const
+    {
+        return _subscribers[CallbackIndex(callback)];
+    }
+
+    /**
+     * @brief Forgets all subscribers. Only valid after the Lua state is closed.
+     */
+    void Clear();
+
+    /**
+     * @brief Registers the \c events library.
+     */
+    void Open(lua_State *L);
+};
@@ -0,0 +1,382 @@
+#include "fileio.hpp"
+
+#include "engine.hpp"
+#include "L.hpp"
+#include "platform.hpp"
+
+#include <lua.hpp>
+
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+
+static std::string FormatError(const std::string &path, const std::string &message)
+{
+    return path + ": " + message;
+}
+
+bool GetFileInfo(const std::string &path, FileInfo &info, std::string &error)
+{
+    namespace fs = std::filesystem;
+    using namespace std::chrono;
+
+    std::error_code code;
+
+    auto status = fs::status(path, code);
+    if (code)
+    {
+        error = FormatError(path, code.message());
+        return false;
+    }
+
+    info.directory = fs::is_directory(status);
+    info.size = info.directory ? 0 : fs::file_size(path, code);
+    if (code)
+    {
+        error = FormatError(path, code.message());
+        return false;
+    }
+
+    auto write_time = fs::last_write_time(path, code);
+    if (code)
+    {
+        error = FormatError(path, code.message());
+        return false;
+    }
+
+    info.write_time = static_cast<std::int64_t>(write_time.time_since_epoch().count());
+
+    // C++17 has no conversion between the file clock and the system clock.
+    auto system_time = system_clock::now()
+        + duration_cast<system_clock::duration>(write_time - fs::file_time_type::clock::now());
+    info.mtime = duration<double>(system_time.time_since_epoch()).count();
+
+    return true;
+}
+
+bool ReadFile(const std::string &path, std::string &data, std::string &error)
+{
+    // Directories open fine on some platforms, but have no size to read.
+    std::error_code code;
+    if (std::filesystem::is_directory(path, code))
+    {
+        error = FormatError(path, "is a directory");
+        return false;
+    }
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        error = FormatError(path, "could not open file");
+        return false;
+    }
+
+    auto size = file.tellg();
+    if (size < 0 || !file.seekg(0))
+    {
+        error = FormatError(path, "could not get file size");
+        return false;
+    }
+
+    data.resize(static_cast<std::size_t>(size));
+    if (!file.read(data.data(), size))
+    {
+        error = FormatError(path, "could not read file");
+        return false;
+    }
+
+    return true;
+}
+
+static bool WriteFile(const std::string &path, const std::string &data, std::ios::openmode mode, std::string &error)
+{
+    std::ofstream file(path, std::ios::binary | mode);
+    if (!file)
+    {
+        error = FormatError(path, "could not open file");
+        return false;
+    }
+
+    if (!file.write(data.data(), data.size()) || !file.flush())
+    {
+        error = FormatError(path, "could not write file");
+        return false;
+    }
+
+    return true;
+}
+
+bool WriteFileAtomic(const std::string &path, const std::string &data, std::string &error)
+{
+    std::string temporary_path = path + ".tmp";
+
+    if (!WriteFile(temporary_path, data, std::ios::trunc, error))
+        return false;
+
+    std::error_code code;
+
+    // Without this, a crash can leave the renamed file empty on some file systems.
+    if (!SyncFile(temporary_path.c_str()))
+    {
+        error = FormatError(temporary_path, "could not flush file");
+        std::filesystem::remove(temporary_path, code);
+        return false;
+    }
+
+    std::filesystem::rename(temporary_path, path, code);
+
+    if (code)
+    {
+        error = FormatError(path, code.message());
+        std::filesystem::remove(temporary_path, code);
+        return false;
+    }
+
+    // Makes the rename itself durable.
+    auto directory = std::filesystem::path(path).parent_path();
+    SyncFile(directory.empty() ? "." : directory.string().c_str());
+
+    return true;
+}
+
+
+FileIO::~FileIO()
+{
+    Stop();
+}
+
+void FileIO::Stop()
+{
+    if (_thread.joinable())
+    {
+        _stopping = true;
+
+        {
+            std::lock_guard lock(_mutex);
+        }
+        _wakeup.notify_one();
+
+        _thread.join();
+    }
+
+    std::unique_ptr<Completion> completion;
+    while (_completions.Pop(completion))
+        ;
+
+    // References died with the state.
+    _callbacks.clear();
+
+    _stopping = false;
+}
+
+void FileIO::Run()
+{
+    while (true)
+    {
+        std::unique_ptr<Request> request;
+
+        if (!_requests.Pop(request))
+        {
+            // Writes queued before stopping still have to reach the disk.
+            if (_stopping)
+                break;
+
+            std::unique_lock lock(_mutex);
+            _wakeup.wait(lock, [&]() { return _stopping || !_requests.IsEmpty(); });
+            continue;
+        }
+
+        auto completion = std::make_unique<Completion>();
+        completion->id = request->id;
+        completion->operation = request->operation;
+
+        // An exception would terminate the server, so it fails the request instead.
+        try
+        {
+            Execute(*request, *completion);
+        }
+        catch (const std::exception &exception)
+        {
+            completion->success = false;
+            completion->data.clear();
+            completion->error = FormatError(request->path, exception.what());
+        }
+
+        // Wait for the main thread to make room, unless nobody is going to.
+        while (!_completions.Push(completion) && !_stopping)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void FileIO::Execute(const Request &request, Completion &completion)
+{
+    switch (request.operation)
+    {
+    case Operation::Read:
+        completion.success = ReadFile(request.path, completion.data, completion.error);
+        break;
+
+    case Operation::Append:
+        completion.success = WriteFile(request.path, request.data, std::ios::app, completion.error);
+        break;
+
+    case Operation::Write:
+        completion.success = WriteFileAtomic(request.path, request.data, completion.error);
+        break;
+
+    case Operation::Stat:
+        completion.success = GetFileInfo(request.path, completion.info, completion.error);
+        break;
+    }
+}
+
+void FileIO::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "read", &L_Read },
+        { "append", &L_Append },
+        { "write", &L_Write },
+        { "stat", &L_Stat },
+        { "pending", &L_Pending },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "fs", functions, this);
+}
+
+void FileIO::Pump(lua_State *L, int error_handler_index, const Watchdog &watchdog)
+{
+    std::unique_ptr<Completion> completion;
+
+    while (!watchdog.IsTripped() && _completions.Pop(completion))
+    {
+        auto callback = _callbacks.find(completion->id);
+        if (callback == _callbacks.end())
+            continue;
+
+        int callback_ref = callback->second;
+        _callbacks.erase(callback);
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, callback_ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, callback_ref);
+
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+
+            // Nobody else is going to report it.
+            if (!completion->success)
+                Warn("%s\n", completion->error.c_str());
+
+            continue;
+        }
+
+        if (!completion->success)
+        {
+            lua_pushnil(L);
+            lua_pushlstring(L, completion->error.data(), completion->error.size());
+
+            L_TryCall(L, 2, 0, error_handler_index);
+            continue;
+        }
+
+        switch (completion->operation)
+        {
+        case Operation::Read:
+            lua_pushlstring(L, completion->data.data(), completion->data.size());
+            break;
+
+        case Operation::Append:
+        case Operation::Write:
+            lua_pushboolean(L, 1);
+            break;
+
+        case Operation::Stat:
+            lua_createtable(L, 0, 3);
+            lua_pushnumber(L, static_cast<lua_Number>(completion->info.size));
+            lua_setfield(L, -2, "size");
+            lua_pushnumber(L, completion->info.mtime);
+            lua_setfield(L, -2, "mtime");
+            lua_pushboolean(L, completion->info.directory);
+            lua_setfield(L, -2, "directory");
+            break;
+        }
+
+        L_TryCall(L, 1, 0, error_handler_index);
+    }
+}
+
+int FileIO::Submit(lua_State *L, Operation operation)
+{
+    auto *self = L_ToUpvalue<FileIO>(L);
+
+    bool has_data = operation == Operation::Append || operation == Operation::Write;
+    int callback_index = has_data ? 3 : 2;
+
+    size_t path_length;
+    const char *path = luaL_checklstring(L, 1, &path_length);
+
+    size_t data_length = 0;
+    const char *data = has_data ? luaL_checklstring(L, 2, &data_length) : nullptr;
+
+    // Results of reads are useless without a callback.
+    if (!has_data || !lua_isnoneornil(L, callback_index))
+        luaL_checktype(L, callback_index, LUA_TFUNCTION);
+
+    lua_settop(L, callback_index);
+
+    auto request = std::make_unique<Request>();
+    request->id = self->_next_id;
+    request->operation = operation;
+    request->path.assign(path, path_length);
+    if (has_data)
+        request->data.assign(data, data_length);
+
+    if (!self->_thread.joinable())
+        self->_thread = std::thread(&FileIO::Run, self);
+
+    if (!self->_requests.Push(request))
+        return luaL_error(L, "too many pending file operations");
+
+    {
+        std::lock_guard lock(self->_mutex);
+    }
+    self->_wakeup.notify_one();
+
+    std::uint32_t id = self->_next_id++;
+
+    lua_pushvalue(L, callback_index);
+    self->_callbacks[id] = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    return 0;
+}
+
+int FileIO::L_Read(lua_State *L)
+{
+    return Submit(L, Operation::Read);
+}
+
+int FileIO::L_Append(lua_State *L)
+{
+    return Submit(L, Operation::Append);
+}
+
+int FileIO::L_Write(lua_State *L)
+{
+    return Submit(L, Operation::Write);
+}
+
+int FileIO::L_Stat(lua_State *L)
+{
+    return Submit(L, Operation::Stat);
+}
+
+int FileIO::L_Pending(lua_State *L)
+{
+    auto *self = L_ToUpvalue<FileIO>(L);
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_callbacks.size()));
+    return 1;
+}
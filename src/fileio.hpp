@@ -0,0 +1,144 @@
+#pragma once
+
+#include "queue.hpp"
+#include "watchdog.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+struct FileInfo
+{
+    std::uint64_t size;
+    // Last modification time in seconds since the Unix epoch.
+    double mtime;
+    // Last modification time in ticks of the file clock. Unlike `mtime` it is exact, so it can
+    // be compared to tell whether the file changed.
+    std::int64_t write_time;
+    bool directory;
+};
+
+/**
+ * @brief Reads the size and modification time of a file.
+ * @param error Set to the reason of failure.
+ */
+bool GetFileInfo(const std::string &path, FileInfo &info, std::string &error);
+
+/**
+ * @brief Reads a whole file into \p data.
+ * @param error Set to the reason of failure.
+ */
+bool ReadFile(const std::string &path, std::string &data, std::string &error);
+
+/**
+ * @brief Replaces a file by writing a temporary file next to it and renaming it over the old one.
+ *
+ * The temporary file is flushed to the disk before the rename, and the directory after it.
+ * @param error Set to the reason of failure.
+ */
+bool WriteFileAtomic(const std::string &path, const std::string &data, std::string &error);
+
+
+/**
+ * @brief Runs file operations on a background thread and delivers their results on the main thread.
+ *
+ * Requests and completions are passed through lock-free queues. The thread is started by the first
+ * request, so plugins that never use the \c fs library don't pay for it.
+ */
+struct FileIO
+{
+private:
+    static constexpr std::size_t QUEUE_CAPACITY = 1024;
+
+    enum class Operation
+    {
+        Read,
+        Append,
+        Write,
+        Stat,
+    };
+
+    struct Request
+    {
+        std::uint32_t id;
+        Operation operation;
+        std::string path;
+        std::string data;
+    };
+
+    struct Completion
+    {
+        std::uint32_t id;
+        Operation operation;
+        bool success;
+        // File contents for reads.
+        std::string data;
+        FileInfo info;
+        // Reason of failure.
+        std::string error;
+    };
+
+    std::thread _thread;
+    SpscQueue<std::unique_ptr<Request>> _requests{ QUEUE_CAPACITY };
+    SpscQueue<std::unique_ptr<Completion>> _completions{ QUEUE_CAPACITY };
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::atomic<bool> _stopping{ false };
+
+    std::uint32_t _next_id = 1;
+
+    // Registry references to callbacks of pending requests.
+    std::unordered_map<std::uint32_t, int> _callbacks;
+
+    void Run();
+
+    static void Execute(const Request &request, Completion &completion);
+
+    static int Submit(lua_State *L, Operation operation);
+
+    static int L_Read(lua_State *L);
+
+    static int L_Append(lua_State *L);
+
+    static int L_Write(lua_State *L);
+
+    static int L_Stat(lua_State *L);
+
+    static int L_Pending(lua_State *L);
+
+public:
+    FileIO() = default;
+
+    FileIO(const FileIO &) = delete;
+
+    FileIO &operator=(const FileIO &) = delete;
+
+    ~FileIO();
+
+    /**
+     * @brief Finishes queued operations and stops the background thread. Results are dropped.
+     */
+    void Stop();
+
+    /**
+     * @brief Registers the \c fs library.
+     */
+    void Open(lua_State *L);
+
+    /**
+     * @brief Calls callbacks of finished operations.
+     *
+     * Once \p watchdog has aborted a callback, the remaining ones are left for the next call.
+     */
+    void Pump(lua_State *L, int error_handler_index, const Watchdog &watchdog);
+};
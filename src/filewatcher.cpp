@@ -0,0 +1,166 @@
+#include "filewatcher.hpp"
+
+//============================== All Platforms ================================#
+
+#include <algorithm>
+#include <filesystem>
+
+
+std::string FileWatcher::Normalize(const std::string &path)
+{
+    return std::filesystem::path(path).lexically_normal().string();
+}
+
+static void AddOnce(std::vector<std::string> &changed, const std::string &path)
+{
+    if (std::find(changed.begin(), changed.end(), path) == changed.end())
+        changed.push_back(path);
+}
+
+#if defined(__linux__) //============ Linux ==================================#
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+
+FileWatcher::~FileWatcher()
+{
+    Clear();
+}
+
+bool FileWatcher::Watch(const std::string &path)
+{
+    auto file = Normalize(path);
+    if (_files.count(file) != 0)
+        return true;
+
+    if (_fd < 0)
+    {
+        _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (_fd < 0)
+            return false;
+    }
+
+    auto directory = std::filesystem::path(file).parent_path().string();
+
+    // Watching a directory again returns the existing descriptor.
+    int wd = inotify_add_watch(_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
+        return false;
+
+    _directories[wd] = directory;
+    _files.insert(file);
+
+    return true;
+}
+
+void FileWatcher::Clear()
+{
+    if (_fd >= 0)
+        close(_fd);
+
+    _fd = -1;
+    _directories.clear();
+    _files.clear();
+}
+
+void FileWatcher::Poll(std::vector<std::string> &changed)
+{
+    if (_fd < 0)
+        return;
+
+    alignas(inotify_event) char buffer[4096];
+
+    while (true)
+    {
+        auto length = read(_fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+
+        for (char *p = buffer; p < buffer + length;)
+        {
+            const auto *event = reinterpret_cast<const inotify_event *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            // Events were lost, so anything could have changed.
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                for (const auto &file : _files)
+                    AddOnce(changed, file);
+
+                continue;
+            }
+
+            if (event->mask & IN_IGNORED)
+            {
+                _directories.erase(event->wd);
+                continue;
+            }
+
+            auto directory = _directories.find(event->wd);
+            if (directory == _directories.end() || event->len == 0)
+                continue;
+
+            auto file = Normalize(directory->second + "/" + event->name);
+            if (_files.count(file) != 0)
+                AddOnce(changed, file);
+        }
+    }
+}
+
+#else //============================ Other ====================================#
+
+#include "fileio.hpp"
+
+
+FileWatcher::~FileWatcher() = default;
+
+static std::int64_t GetModificationTime(const std::string &path)
+{
+    FileInfo info;
+    std::string error;
+
+    // The floating-point `mtime` is not stable enough to compare.
+    return GetFileInfo(path, info, error) ? info.write_time : 0;
+}
+
+bool FileWatcher::Watch(const std::string &path)
+{
+    auto file = Normalize(path);
+    if (_files.count(file) != 0)
+        return true;
+
+    _files.insert(file);
+    _mtimes[file] = GetModificationTime(file);
+
+    return true;
+}
+
+void FileWatcher::Clear()
+{
+    _files.clear();
+    _mtimes.clear();
+}
+
+void FileWatcher::Poll(std::vector<std::string> &changed)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now < _next_check)
+        return;
+
+    _next_check = now + std::chrono::seconds(1);
+
+    for (auto &[file, mtime] : _mtimes)
+    {
+        auto current = GetModificationTime(file);
+        if (current != mtime)
+        {
+            mtime = current;
+            AddOnce(changed, file);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+/**
+ * @brief Reports changes to a set of files without blocking.
+ *
+ * Uses inotify on Linux, watching the directories of the files so that editors which save by
+ * replacing the file are handled too. Other platforms compare modification times once a second.
+ */
+struct FileWatcher
+{
+private:
+    // Normalized paths of watched files.
+    std::unordered_set<std::string> _files;
+
+#if defined(__linux__)
+    int _fd = -1;
+    // Watched directories by watch descriptor.
+    std::unordered_map<int, std::string> _directories;
+#else
+    // Last write times of watched files in ticks of the file clock, 0 if unknown.
+    std::unordered_map<std::string, std::int64_t> _mtimes;
+    std::chrono::steady_clock::time_point _next_check{};
+#endif
+
+public:
+    FileWatcher() = default;
+
+    FileWatcher(const FileWatcher &) = delete;
+
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    ~FileWatcher();
+
+    /**
+     * @brief Starts watching \p path, does nothing if it is already watched.
+     * @return \c false if the file can't be watched.
+     */
+    bool Watch(const std::string &path);
+
+    /**
+     * @brief Stops watching all files.
+     */
+    void Clear();
+
+    /**
+     * @brief Appends files that changed since the last call to \p changed, each one once.
+     *
+     * Paths are the ones passed to \c Watch, after normalization.
+     */
+    void Poll(std::vector<std::string> &changed);
+
+    /**
+     * @brief Turns \p path into the form used by \c Poll.
+     */
+    static std::string Normalize(const std::string &path);
+};
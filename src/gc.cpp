@@ -0,0 +1,269 @@
+#include "gc.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+
+
+// Pause of the collector relative to `_pause` while frames start the cycles. Allocations only
+// start a cycle when frames fell far behind.
+static constexpr int BACKSTOP_PAUSE_FACTOR = 2;
+
+
+static std::uint64_t ToNanoseconds(GcPolicy::Clock::duration duration)
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+std::size_t GcPolicy::GetLiveBytes(lua_State *L)
+{
+    return static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+}
+
+void GcPolicy::Configure(Clock::duration budget, int pause, int stepmul, bool level_collect, bool stop_between_frames)
+{
+    _budget = std::max(budget, Clock::duration::zero());
+    _pause = std::max(pause, 100);
+    _stepmul = std::max(stepmul, 100);
+    _level_collect = level_collect;
+    _stop_between_frames = stop_between_frames;
+}
+
+void GcPolicy::Open(lua_State *L)
+{
+    bool backstop = _budget != Clock::duration::zero() && !_stop_between_frames;
+    lua_gc(L, LUA_GCSETPAUSE, backstop ? _pause * BACKSTOP_PAUSE_FACTOR : _pause);
+    lua_gc(L, LUA_GCSETSTEPMUL, _stepmul);
+
+    _threshold = GetLiveBytes(L) / 100 * _pause;
+    _in_cycle = false;
+    _cycle = {};
+
+    // Created once, so running it doesn't allocate.
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, &L_Run, 1);
+    _function = luaL_ref(L, LUA_REGISTRYINDEX);
+    _open = true;
+
+    L_SetGlobalFunction(L, "plugin_gc", &L_PluginGc, this);
+}
+
+void GcPolicy::Clear()
+{
+    _open = false;
+    _threshold = 0;
+    _in_cycle = false;
+    _cycle = {};
+
+    ResetStats();
+}
+
+void GcPolicy::ResetStats()
+{
+    _steps.Reset();
+    _cycles.Reset();
+    _last_cycle = {};
+    _full_collections = 0;
+    _last_full_collection = 0;
+    _fallback_frames = 0;
+}
+
+void GcPolicy::FinishCycle(lua_State *L)
+{
+    _cycle.live = GetLiveBytes(L);
+    _threshold = _cycle.live / 100 * _pause;
+
+    _cycles.Record(_cycle.pause);
+    _last_cycle = _cycle;
+
+    _in_cycle = false;
+    _cycle = {};
+}
+
+void GcPolicy::Step(lua_State *L, int error_handler_index)
+{
+    if (_budget == Clock::duration::zero() || !_open)
+        return;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, _function);
+    lua_pushboolean(L, 0);
+    L_TryCall(L, 1, 0, error_handler_index);
+}
+
+void GcPolicy::Collect(lua_State *L, int error_handler_index)
+{
+    if (!_level_collect || !_open)
+        return;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, _function);
+    lua_pushboolean(L, 1);
+    L_TryCall(L, 1, 0, error_handler_index);
+}
+
+int GcPolicy::L_Run(lua_State *L)
+{
+    auto *self = L_ToUpvalue<GcPolicy>(L);
+
+    if (lua_toboolean(L, 1))
+        self->RunCollect(L);
+    else
+        self->RunStep(L);
+
+    return 0;
+}
+
+void GcPolicy::RunStep(lua_State *L)
+{
+    std::size_t live = GetLiveBytes(L);
+
+    if (!_in_cycle && live < _threshold)
+    {
+        Idle(L);
+        return;
+    }
+
+    _in_cycle = true;
+
+    auto start = Clock::now();
+    auto deadline = start + _budget;
+    bool finished = false;
+
+    // Each call does one incremental step.
+    do
+    {
+        if (lua_gc(L, LUA_GCSTEP, 0) != 0)
+        {
+            finished = true;
+            break;
+        }
+    } while (Clock::now() < deadline);
+
+    auto elapsed = ToNanoseconds(Clock::now() - start);
+
+    _steps.Record(elapsed);
+    _cycle.pause += elapsed;
+    _cycle.max_step = std::max(_cycle.max_step, elapsed);
+    _cycle.frames++;
+
+    if (finished)
+    {
+        FinishCycle(L);
+        Idle(L);
+        return;
+    }
+
+    // Falling behind, let allocations drive the collector until this cycle is done.
+    if (live / 2 >= _threshold)
+    {
+        _fallback_frames++;
+
+        if (_stop_between_frames)
+            lua_gc(L, LUA_GCRESTART, 0);
+    }
+    else
+    {
+        Idle(L);
+    }
+}
+
+void GcPolicy::Idle(lua_State *L)
+{
+    if (_stop_between_frames)
+        lua_gc(L, LUA_GCSTOP, 0);
+}
+
+void GcPolicy::RunCollect(lua_State *L)
+{
+    auto start = Clock::now();
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    _last_full_collection = ToNanoseconds(Clock::now() - start);
+    _full_collections++;
+
+    // Whatever the running cycle did is moot now.
+    _in_cycle = false;
+    _cycle = {};
+    _threshold = GetLiveBytes(L) / 100 * _pause;
+
+    if (_budget != Clock::duration::zero())
+        Idle(L);
+}
+
+static void PushHistogram(lua_State *L, const LatencyHistogram &histogram)
+{
+    lua_createtable(L, 0, 5);
+
+    lua_pushnumber(L, static_cast<lua_Number>(histogram.GetCount()));
+    lua_setfield(L, -2, "count");
+
+    // Durations are in microseconds.
+
+    lua_pushnumber(L, histogram.GetMean() / 1000.0);
+    lua_setfield(L, -2, "mean");
+
+    lua_pushnumber(L, histogram.GetPercentile(0.5) / 1000.0);
+    lua_setfield(L, -2, "p50");
+
+    lua_pushnumber(L, histogram.GetPercentile(0.99) / 1000.0);
+    lua_setfield(L, -2, "p99");
+
+    lua_pushnumber(L, histogram.GetMax() / 1000.0);
+    lua_setfield(L, -2, "max");
+}
+
+int GcPolicy::L_PluginGc(lua_State *L)
+{
+    auto *self = L_ToUpvalue<GcPolicy>(L);
+    bool reset = lua_toboolean(L, 1);
+
+    lua_createtable(L, 0, 10);
+
+    lua_pushinteger(L, self->_pause);
+    lua_setfield(L, -2, "pause");
+
+    lua_pushinteger(L, self->_stepmul);
+    lua_setfield(L, -2, "stepmul");
+
+    lua_pushnumber(L, ToNanoseconds(self->_budget) / 1000.0);
+    lua_setfield(L, -2, "budget");
+
+    lua_pushboolean(L, self->_in_cycle);
+    lua_setfield(L, -2, "in_cycle");
+
+    PushHistogram(L, self->_steps);
+    lua_setfield(L, -2, "steps");
+
+    PushHistogram(L, self->_cycles);
+    lua_setfield(L, -2, "cycles");
+
+    lua_createtable(L, 0, 4);
+    {
+        lua_pushnumber(L, self->_last_cycle.pause / 1000.0);
+        lua_setfield(L, -2, "pause");
+
+        lua_pushnumber(L, self->_last_cycle.max_step / 1000.0);
+        lua_setfield(L, -2, "max_step");
+
+        lua_pushnumber(L, self->_last_cycle.frames);
+        lua_setfield(L, -2, "frames");
+
+        lua_pushnumber(L, static_cast<lua_Number>(self->_last_cycle.live));
+        lua_setfield(L, -2, "live");
+    }
+    lua_setfield(L, -2, "last_cycle");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_full_collections));
+    lua_setfield(L, -2, "full_collections");
+
+    lua_pushnumber(L, self->_last_full_collection / 1000.0);
+    lua_setfield(L, -2, "last_full_collection");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_fallback_frames));
+    lua_setfield(L, -2, "fallback_frames");
+
+    if (reset)
+        self->ResetStats();
+
+    return 1;
+}
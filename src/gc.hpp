@@ -0,0 +1,113 @@
+#pragma once
+
+#include "stats.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Moves Lua garbage collection out of callbacks and into the end of each frame.
+ *
+ * With a step budget, a cycle is started at the end of a frame once the heap grew by the pause
+ * factor since the last one, and an unfinished cycle is stepped until the budget is used up. The
+ * collector itself keeps running with a larger pause as a backstop, so allocations still collect
+ * garbage when frames can't keep up. Optionally the collector is stopped between frames instead,
+ * and only left running while allocations outpace the budget. Full collections are done between
+ * levels, where a hitch goes unnoticed.
+ */
+struct GcPolicy
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct Cycle
+    {
+        // Total and longest frame step in nanoseconds.
+        std::uint64_t pause;
+        std::uint64_t max_step;
+        std::uint32_t frames;
+        // Live bytes after the cycle finished.
+        std::size_t live;
+    };
+
+    Clock::duration _budget{};
+    int _pause = 200;
+    int _stepmul = 200;
+    bool _level_collect = true;
+    bool _stop_between_frames = false;
+
+    // Registry reference to the closure running steps and collections in protected mode, only
+    // valid while `_open` is set.
+    int _function = 0;
+    bool _open = false;
+
+    // Live bytes at which the next cycle is started.
+    std::size_t _threshold = 0;
+    bool _in_cycle = false;
+    Cycle _cycle{};
+
+    // Telemetry.
+    LatencyHistogram _steps;
+    LatencyHistogram _cycles;
+    Cycle _last_cycle{};
+    std::uint64_t _full_collections = 0;
+    std::uint64_t _last_full_collection = 0;
+    std::uint64_t _fallback_frames = 0;
+
+    static std::size_t GetLiveBytes(lua_State *L);
+
+    void FinishCycle(lua_State *L);
+
+    void RunStep(lua_State *L);
+
+    void RunCollect(lua_State *L);
+
+    /**
+     * @brief Leaves the collector to allocations until the next frame, or stops it if configured.
+     */
+    void Idle(lua_State *L);
+
+    void ResetStats();
+
+    static int L_Run(lua_State *L);
+
+    static int L_PluginGc(lua_State *L);
+
+public:
+    /**
+     * @param budget Time spent stepping the collector on each frame, 0 leaves collection to allocations.
+     * @param pause Heap growth in percent before the next cycle starts.
+     * @param stepmul Collector speed relative to allocation in percent.
+     * @param level_collect Whether to run a full collection on level changes.
+     * @param stop_between_frames Whether to stop the collector outside of frame steps.
+     */
+    void Configure(Clock::duration budget, int pause, int stepmul, bool level_collect, bool stop_between_frames);
+
+    /**
+     * @brief Applies the settings and registers \c plugin_gc.
+     */
+    void Open(lua_State *L);
+
+    /**
+     * @brief Forgets the current cycle and telemetry. Call when closing the Lua state.
+     */
+    void Clear();
+
+    /**
+     * @brief Steps the collector within the budget. Call at the end of each frame.
+     *
+     * Finalizers may run, so the collector is run in a protected call.
+     */
+    void Step(lua_State *L, int error_handler_index);
+
+    /**
+     * @brief Runs a full collection if enabled. Call on level changes.
+     */
+    void Collect(lua_State *L, int error_handler_index);
+};
@@ -0,0 +1,279 @@
+#include "jitdiagnostics.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+
+static const char JIT_SETUP_SOURCE[] = R"(
+local report, level, enabled, options = ...
+local jit = require("jit")
+
+if level > 0 then
+  local util = require("jit.util")
+  local has_vmdef, vmdef = pcall(require, "jit.vmdef")
+  local funcinfo, traceinfo = util.funcinfo, util.traceinfo
+  local format, type, tostring, pcall = string.format, type, tostring, pcall
+
+  local function location(func, pc)
+    local info = funcinfo(func, pc)
+    if info.loc then
+      return info.loc
+    elseif info.ffid then
+      return has_vmdef and vmdef.ffnames[info.ffid] or "builtin#" .. info.ffid
+    end
+    return "?"
+  end
+
+  local function describe(code, extra)
+    if type(code) ~= "number" then
+      return tostring(code)
+    end
+
+    local text = has_vmdef and vmdef.traceerr[code]
+    if not text then
+      return "error " .. code
+    end
+
+    if type(extra) == "function" then
+      extra = location(extra)
+    end
+
+    local ok, message = pcall(format, text, extra)
+    return ok and message or text
+  end
+
+  -- Start location by trace number.
+  local starts = {}
+
+  jit.attach(function(what, tr, func, pc, otr, oex)
+    if what == "start" then
+      local start = location(func, pc)
+      if otr then
+        start = format("%d/%d %s", otr, oex, start)
+      end
+
+      starts[tr] = start
+      report("start", format("[TRACE %3d %s]", tr, start))
+    elseif what == "stop" then
+      local info = traceinfo(tr)
+      local link, linktype = info.link, info.linktype
+
+      local target
+      if link == tr or link == 0 then
+        target = linktype
+      elseif linktype == "root" then
+        target = "-> " .. link
+      else
+        target = "-> " .. link .. " " .. linktype
+      end
+
+      report("stop", format("[TRACE %3d %s %s]", tr, starts[tr] or "?", target))
+    elseif what == "abort" then
+      local at = location(func, pc)
+      local reason = describe(otr, oex)
+
+      report("abort", format("[TRACE --- %s -- %s at %s]", starts[tr] or "?", reason, at), at, reason)
+    elseif what == "flush" then
+      starts = {}
+      report("flush", "[TRACE flush]")
+    end
+  end, "trace")
+end
+
+if not enabled then
+  jit.off()
+end
+
+if options ~= "" then
+  local args = {}
+  for option in options:gmatch("[^%s,]+") do
+    args[#args + 1] = option
+  end
+
+  jit.opt.start(unpack(args))
+end
+)";
+
+
+void JitDiagnostics::Configure(bool enabled, const std::string &options, int level, const std::string &log_path, const std::string &prefix)
+{
+    _enabled = enabled;
+    _options = options;
+    _level = std::clamp(level, LEVEL_OFF, LEVEL_STARTS);
+    _log_path = log_path;
+    _prefix = prefix;
+}
+
+bool JitDiagnostics::Open(lua_State *L, std::string &error)
+{
+    if (_level > LEVEL_OFF && !_log_path.empty())
+    {
+        _log.open(_log_path, std::ios::app);
+
+        if (!_log)
+            Warn("%sCould not open \"%s\", reporting trace events to the console.\n", _prefix.c_str(), _log_path.c_str());
+    }
+
+    L_SetGlobalFunction(L, "plugin_jit", &L_PluginJit, this);
+
+    if (luaL_loadbuffer(L, JIT_SETUP_SOURCE, sizeof(JIT_SETUP_SOURCE) - 1, "=jit setup") != LUA_OK)
+    {
+        error = lua_tostring(L, -1);
+        lua_pop(L, 1);
+        return false;
+    }
+
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, &L_Report, 1);
+    lua_pushinteger(L, _level);
+    lua_pushboolean(L, _enabled);
+    lua_pushlstring(L, _options.data(), _options.size());
+
+    if (lua_pcall(L, 4, 0, 0) != LUA_OK)
+    {
+        error = lua_tostring(L, -1);
+        lua_pop(L, 1);
+        return false;
+    }
+
+    return true;
+}
+
+void JitDiagnostics::Clear()
+{
+    if (_log.is_open())
+        _log.close();
+
+    _log.clear();
+
+    ResetCounters();
+}
+
+void JitDiagnostics::ResetCounters()
+{
+    _started = 0;
+    _stopped = 0;
+    _aborted = 0;
+    _flushes = 0;
+    _aborts.clear();
+}
+
+void JitDiagnostics::Write(bool warning, const char *text)
+{
+    if (_log.is_open() && _log)
+    {
+        // Flushed right away, so the log is complete when the server crashes.
+        _log << text << std::endl;
+        return;
+    }
+
+    if (warning)
+        Warn("%s%s\n", _prefix.c_str(), text);
+    else
+        Print("%s%s\n", _prefix.c_str(), text);
+}
+
+int JitDiagnostics::L_Report(lua_State *L)
+{
+    auto *self = L_ToUpvalue<JitDiagnostics>(L);
+    const char *kind = luaL_checkstring(L, 1);
+    const char *text = luaL_checkstring(L, 2);
+
+    if (std::strcmp(kind, "abort") == 0)
+    {
+        self->_aborted++;
+        self->_aborts[{ luaL_optstring(L, 3, "?"), luaL_optstring(L, 4, "?") }]++;
+
+        self->Write(true, text);
+    }
+    else if (std::strcmp(kind, "stop") == 0)
+    {
+        self->_stopped++;
+
+        if (self->_level >= LEVEL_TRACES)
+            self->Write(false, text);
+    }
+    else if (std::strcmp(kind, "flush") == 0)
+    {
+        self->_flushes++;
+
+        if (self->_level >= LEVEL_TRACES)
+            self->Write(false, text);
+    }
+    else
+    {
+        self->_started++;
+
+        if (self->_level >= LEVEL_STARTS)
+            self->Write(false, text);
+    }
+
+    return 0;
+}
+
+int JitDiagnostics::L_PluginJit(lua_State *L)
+{
+    auto *self = L_ToUpvalue<JitDiagnostics>(L);
+    bool reset = lua_toboolean(L, 1);
+
+    lua_createtable(L, 0, 7);
+
+    lua_pushboolean(L, self->_enabled);
+    lua_setfield(L, -2, "enabled");
+
+    lua_pushinteger(L, self->_level);
+    lua_setfield(L, -2, "level");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_started));
+    lua_setfield(L, -2, "started");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_stopped));
+    lua_setfield(L, -2, "stopped");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_aborted));
+    lua_setfield(L, -2, "aborted");
+
+    lua_pushnumber(L, static_cast<lua_Number>(self->_flushes));
+    lua_setfield(L, -2, "flushes");
+
+    // Most frequent first.
+    std::vector<std::pair<const std::pair<std::string, std::string> *, std::uint64_t>> aborts;
+    aborts.reserve(self->_aborts.size());
+
+    for (const auto &[key, count] : self->_aborts)
+        aborts.emplace_back(&key, count);
+
+    std::stable_sort(aborts.begin(), aborts.end(), [](const auto &a, const auto &b) {
+        return a.second > b.second;
+    });
+
+    lua_createtable(L, static_cast<int>(aborts.size()), 0);
+
+    for (std::size_t i = 0; i < aborts.size(); i++)
+    {
+        lua_createtable(L, 0, 3);
+
+        lua_pushlstring(L, aborts[i].first->first.data(), aborts[i].first->first.size());
+        lua_setfield(L, -2, "location");
+
+        lua_pushlstring(L, aborts[i].first->second.data(), aborts[i].first->second.size());
+        lua_setfield(L, -2, "reason");
+
+        lua_pushnumber(L, static_cast<lua_Number>(aborts[i].second));
+        lua_setfield(L, -2, "count");
+
+        lua_rawseti(L, -2, static_cast<int>(i + 1));
+    }
+
+    lua_setfield(L, -2, "aborts");
+
+    if (reset)
+        self->ResetCounters();
+
+    return 1;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Applies JIT settings and reports trace events to the console or a log file.
+ *
+ * Trace events are formatted like \c jit.v does. Aborts are counted by the location and reason
+ * they happened with, so the traces that keep failing stand out.
+ */
+struct JitDiagnostics
+{
+public:
+    // What is reported, each level includes the ones below.
+    static constexpr int LEVEL_OFF = 0;
+    static constexpr int LEVEL_ABORTS = 1;
+    static constexpr int LEVEL_TRACES = 2;
+    static constexpr int LEVEL_STARTS = 3;
+
+private:
+    bool _enabled = true;
+    std::string _options;
+    int _level = LEVEL_OFF;
+    std::string _log_path;
+    std::string _prefix;
+
+    std::ofstream _log;
+
+    std::uint64_t _started = 0;
+    std::uint64_t _stopped = 0;
+    std::uint64_t _aborted = 0;
+    std::uint64_t _flushes = 0;
+
+    // Abort count by location and reason.
+    std::map<std::pair<std::string, std::string>, std::uint64_t> _aborts;
+
+    void Write(bool warning, const char *text);
+
+    void ResetCounters();
+
+    static int L_Report(lua_State *L);
+
+    static int L_PluginJit(lua_State *L);
+
+public:
+    /**
+     * @param enabled Whether the JIT compiler is on.
+     * @param options Arguments for \c jit.opt.start, separated by spaces or commas.
+     * @param level What to report, one of the \c LEVEL_ constants.
+     * @param log_path File trace events are appended to, empty for the console.
+     * @param prefix Put in front of console lines.
+     */
+    void Configure(bool enabled, const std::string &options, int level, const std::string &log_path, const std::string &prefix);
+
+    /**
+     * @brief Applies the settings, attaches the trace handler and registers \c plugin_jit.
+     *
+     * Diagnostics keep working when the settings are invalid.
+     *
+     * @return \c false with \p error set if the settings could not be applied.
+     */
+    bool Open(lua_State *L, std::string &error);
+
+    /**
+     * @brief Closes the log and resets counters. Call when closing the Lua state.
+     */
+    void Clear();
+};
@@ -0,0 +1,152 @@
+#include "manifest.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string_view>
+
+
+static std::string_view Trim(std::string_view text)
+{
+    constexpr std::string_view WHITESPACE = " \t\r\n";
+
+    auto start = text.find_first_not_of(WHITESPACE);
+    if (start == text.npos)
+        return {};
+
+    auto end = text.find_last_not_of(WHITESPACE);
+    return text.substr(start, end - start + 1);
+}
+
+
+bool LoadManifest(const std::string &file_path, std::vector<ManifestEntry> &entries, std::string &error)
+{
+    entries.clear();
+
+    std::ifstream file(file_path);
+    if (!file)
+    {
+        error = "Could not read \"" + file_path + "\".";
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); line_number++)
+    {
+        std::string_view text = line;
+
+        auto comment = text.find("//");
+        if (comment != text.npos)
+            text.remove_suffix(text.size() - comment);
+
+        text = Trim(text);
+        if (text.empty())
+            continue;
+
+        auto name_end = text.find_first_of(" \t");
+        auto name = text.substr(0, name_end);
+        auto priority = name_end == text.npos ? std::string_view{} : Trim(text.substr(name_end));
+
+        ManifestEntry entry{ std::string(name), 0 };
+
+        if (!priority.empty())
+        {
+            std::string value(priority);
+
+            char *end;
+            entry.priority = std::strtoll(value.c_str(), &end, 10);
+
+            if (*end != '\0')
+            {
+                error = file_path + ":" + std::to_string(line_number) + ": invalid priority \"" + value + "\".";
+                return false;
+            }
+        }
+
+        auto duplicate = std::find_if(entries.begin(), entries.end(), [&](const ManifestEntry &other) {
+            return other.module == entry.module;
+        });
+
+        if (duplicate != entries.end())
+        {
+            error = file_path + ":" + std::to_string(line_number) + ": module '" + entry.module + "' is listed twice.";
+            return false;
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const ManifestEntry &a, const ManifestEntry &b) {
+        return a.priority > b.priority;
+    });
+
+    return true;
+}
+
+
+static const char MODULE_ENVIRONMENT_SOURCE[] = R"(
+local name = ...
+local _G, package = _G, package
+local setmetatable, setfenv, ipairs, type, tostring, error = setmetatable, setfenv, ipairs, type, tostring, error
+local concat = table.concat
+
+local env = setmetatable({}, { __index = _G })
+local loaded = {}
+
+local function require(modname)
+  local module = loaded[modname]
+  if module ~= nil then
+    return module
+  end
+
+  module = package.loaded[modname]
+  if module ~= nil then
+    return module
+  end
+
+  local messages = {}
+
+  for i, loader in ipairs(package.loaders) do
+    local chunk = loader(modname)
+
+    if type(chunk) == "function" then
+      -- `package.preload` functions keep their own globals.
+      if i > 1 then
+        setfenv(chunk, env)
+      end
+
+      local result = chunk(modname)
+      if result ~= nil then
+        loaded[modname] = result
+      elseif loaded[modname] == nil then
+        loaded[modname] = true
+      end
+
+      return loaded[modname]
+    elseif type(chunk) == "string" then
+      messages[#messages + 1] = chunk
+    end
+  end
+
+  error("module '" .. tostring(modname) .. "' not found:" .. concat(messages), 2)
+end
+
+env._G = env
+env._MODULE = name
+env.package = setmetatable({ loaded = loaded }, { __index = package })
+env.require = require
+
+return env
+)";
+
+bool L_PushModuleEnvironment(lua_State *L, const char *name)
+{
+    if (luaL_loadbuffer(L, MODULE_ENVIRONMENT_SOURCE, sizeof(MODULE_ENVIRONMENT_SOURCE) - 1, "=module environment") != LUA_OK)
+        return false;
+
+    lua_pushstring(L, name);
+
+    return lua_pcall(L, 1, 1, 0) == LUA_OK;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+struct ManifestEntry
+{
+    std::string module;
+    long long priority;
+};
+
+/**
+ * @brief Reads the list of modules hosted by one plugin, from \c <plugin name>.manifest.
+ *
+ * Each line holds a module name, optionally followed by its priority. Everything after \c // is a
+ * comment. Entries are sorted by descending priority, entries of equal priority keep their order.
+ *
+ * @return \c false with \p error set if the file could not be read or has an invalid line.
+ */
+bool LoadManifest(const std::string &file_path, std::vector<ManifestEntry> &entries, std::string &error);
+
+/**
+ * @brief Pushes a new globals table for the module \p name.
+ *
+ * Reads fall back to the shared globals, writes stay in the module. The module gets its own
+ * \c package.loaded and a \c require that loads modules into it, with the module's globals.
+ * Modules already in the shared \c package.loaded, like the standard libraries, are shared.
+ *
+ * @return \c false with the error message pushed instead.
+ */
+bool L_PushModuleEnvironment(lua_State *L, const char *name);
@@ -0,0 +1,426 @@
+#include "memory.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+
+
+// Rough sizes of LuaJIT objects on 64-bit platforms.
+static constexpr std::size_t STRING_SIZE = 24;
+static constexpr std::size_t TABLE_SIZE = 64;
+static constexpr std::size_t ARRAY_SLOT_SIZE = 8;
+static constexpr std::size_t HASH_NODE_SIZE = 24;
+static constexpr std::size_t FUNCTION_SIZE = 40;
+static constexpr std::size_t UPVALUE_SIZE = 48;
+static constexpr std::size_t USERDATA_SIZE = 40;
+static constexpr std::size_t THREAD_SIZE = 112;
+static constexpr std::size_t CDATA_SIZE = 16;
+
+// Deeper values are not followed, the C stack is not endless.
+static constexpr int MAX_DEPTH = 200;
+
+
+/**
+ * @brief Adds up the approximate size of everything reachable from values.
+ */
+struct MemoryWalk
+{
+    lua_State *L;
+    std::unordered_set<const void *> visited;
+    std::size_t bytes = 0;
+
+    /**
+     * @return \c false if the value at \p index was already counted.
+     */
+    bool Mark(int index)
+    {
+        // Older LuaJIT versions have no pointer for strings, they are counted every time.
+        const void *pointer = lua_topointer(L, index);
+        return pointer == nullptr || visited.insert(pointer).second;
+    }
+
+    void VisitTop(int depth)
+    {
+        Visit(lua_gettop(L), depth);
+        lua_pop(L, 1);
+    }
+
+    void Visit(int index, int depth)
+    {
+        if (depth > MAX_DEPTH || !lua_checkstack(L, 4))
+            return;
+
+        switch (lua_type(L, index))
+        {
+        case LUA_TSTRING:
+            if (Mark(index))
+                bytes += STRING_SIZE + lua_objlen(L, index) + 1;
+            break;
+
+        case LUA_TTABLE:
+        {
+            if (!Mark(index))
+                break;
+
+            std::size_t array = lua_objlen(L, index);
+            std::size_t count = 0;
+
+            lua_pushnil(L);
+            while (lua_next(L, index) != 0)
+            {
+                count++;
+
+                Visit(lua_gettop(L) - 1, depth + 1);
+                VisitTop(depth + 1);
+            }
+
+            bytes += TABLE_SIZE + array * ARRAY_SLOT_SIZE + (count > array ? count - array : 0) * HASH_NODE_SIZE;
+
+            if (lua_getmetatable(L, index))
+                VisitTop(depth + 1);
+
+            break;
+        }
+
+        case LUA_TFUNCTION:
+            if (!Mark(index))
+                break;
+
+            bytes += FUNCTION_SIZE;
+
+            for (int i = 1; lua_getupvalue(L, index, i) != nullptr; i++)
+            {
+                bytes += UPVALUE_SIZE;
+                VisitTop(depth + 1);
+            }
+
+            lua_getfenv(L, index);
+            VisitTop(depth + 1);
+            break;
+
+        case LUA_TUSERDATA:
+            if (!Mark(index))
+                break;
+
+            bytes += USERDATA_SIZE + lua_objlen(L, index);
+
+            if (lua_getmetatable(L, index))
+                VisitTop(depth + 1);
+
+            lua_getfenv(L, index);
+            VisitTop(depth + 1);
+            break;
+
+        case LUA_TTHREAD:
+            // Stacks are not walked.
+            if (Mark(index))
+                bytes += THREAD_SIZE;
+            break;
+
+        case LUA_TNIL:
+        case LUA_TBOOLEAN:
+        case LUA_TNUMBER:
+        case LUA_TLIGHTUSERDATA:
+            break;
+
+        default:
+            // LuaJIT cdata.
+            if (Mark(index))
+                bytes += CDATA_SIZE;
+            break;
+        }
+    }
+};
+
+
+void MemoryTracker::Configure(std::size_t limit, const std::string &directory, const std::string &report_file)
+{
+    _limit = std::max<std::size_t>(limit, 2);
+    _directory = directory;
+    _report_file = report_file;
+}
+
+void MemoryTracker::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "snapshot", &L_Snapshot },
+        { "snapshots", &L_Snapshots },
+        { "report", &L_Report },
+        { "dump", &L_Dump },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "memory", functions, this);
+}
+
+void MemoryTracker::Clear()
+{
+    _roots.clear();
+    _snapshots.clear();
+    _map.clear();
+}
+
+void MemoryTracker::AddModule(const std::string &name, int table, int env)
+{
+    _roots.push_back({ name, table, env });
+}
+
+void MemoryTracker::RemoveModule(const std::string &name)
+{
+    _roots.erase(
+        std::remove_if(_roots.begin(), _roots.end(), [&](const Root &root) {
+            return root.name == name;
+        }),
+        _roots.end()
+    );
+}
+
+const MemorySnapshot &MemoryTracker::Take(lua_State *L, const std::string &kind, const std::string &label)
+{
+    MemorySnapshot snapshot;
+    snapshot.kind = kind;
+    snapshot.label = label;
+    snapshot.time = static_cast<std::int64_t>(std::time(nullptr));
+    snapshot.live = static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+
+    int top = lua_gettop(L);
+    lua_checkstack(L, 8);
+
+    // Not charged to any module.
+    std::unordered_set<const void *> shared;
+    shared.insert(lua_topointer(L, LUA_REGISTRYINDEX));
+
+    bool has_environments = std::any_of(_roots.begin(), _roots.end(), [](const Root &root) {
+        return root.env != LUA_NOREF;
+    });
+
+    if (has_environments)
+    {
+        shared.insert(lua_topointer(L, LUA_GLOBALSINDEX));
+
+        lua_pushliteral(L, "package");
+        lua_rawget(L, LUA_GLOBALSINDEX);
+
+        if (lua_istable(L, -1))
+        {
+            shared.insert(lua_topointer(L, -1));
+
+            lua_pushliteral(L, "loaded");
+            lua_rawget(L, -2);
+
+            if (lua_istable(L, -1))
+                shared.insert(lua_topointer(L, -1));
+        }
+
+        lua_settop(L, top);
+    }
+
+    for (const auto &root : _roots)
+    {
+        MemoryWalk walk{ L, shared };
+
+        if (root.env != LUA_NOREF)
+            lua_rawgeti(L, LUA_REGISTRYINDEX, root.env);
+        else
+            lua_pushvalue(L, LUA_GLOBALSINDEX);
+
+        walk.VisitTop(0);
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, root.table);
+        walk.VisitTop(0);
+
+        snapshot.modules.emplace_back(root.name, walk.bytes);
+    }
+
+    lua_settop(L, top);
+
+    if (_snapshots.size() >= _limit)
+        _snapshots.erase(_snapshots.begin());
+
+    _snapshots.push_back(std::move(snapshot));
+    return _snapshots.back();
+}
+
+bool MemoryTracker::TakeLevelSnapshot(lua_State *L, const char *kind, const char *map_name, std::string &error)
+{
+    if (map_name != nullptr)
+        _map = map_name;
+
+    Take(L, kind, _map);
+
+    return _report_file.empty() || Dump(_report_file, error);
+}
+
+const MemorySnapshot *MemoryTracker::FindPrevious(std::size_t index) const
+{
+    for (std::size_t i = index; i-- > 0;)
+    {
+        if (_snapshots[i].kind == _snapshots[index].kind)
+            return &_snapshots[i];
+    }
+
+    return nullptr;
+}
+
+static void AppendLine(std::string &out, const char *name, std::size_t bytes, const std::size_t *previous)
+{
+    char line[128];
+
+    if (previous != nullptr)
+    {
+        auto change = static_cast<long long>(bytes) - static_cast<long long>(*previous);
+        std::snprintf(line, sizeof(line), "  %-24s %14zu %+14lld\n", name, bytes, change);
+    }
+    else
+    {
+        std::snprintf(line, sizeof(line), "  %-24s %14zu\n", name, bytes);
+    }
+
+    out.append(line);
+}
+
+std::string MemoryTracker::Report() const
+{
+    std::string out = "Lua memory snapshots, changes are since the previous snapshot of the same kind and module sizes are approximate.\n";
+
+    for (std::size_t i = 0; i < _snapshots.size(); i++)
+    {
+        const auto &snapshot = _snapshots[i];
+        const auto *previous = FindPrevious(i);
+
+        char time[32] = "";
+        std::time_t seconds = static_cast<std::time_t>(snapshot.time);
+        if (const std::tm *local = std::localtime(&seconds))
+            std::strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", local);
+
+        out.append("\n").append(snapshot.kind);
+        if (!snapshot.label.empty())
+            out.append(" (").append(snapshot.label).append(")");
+        out.append(" at ").append(time).append("\n");
+
+        AppendLine(out, "total", snapshot.live, previous != nullptr ? &previous->live : nullptr);
+
+        for (const auto &[name, bytes] : snapshot.modules)
+        {
+            const std::size_t *previous_bytes = nullptr;
+
+            if (previous != nullptr)
+            {
+                auto module = std::find_if(previous->modules.begin(), previous->modules.end(), [&](const auto &entry) {
+                    return entry.first == name;
+                });
+
+                if (module != previous->modules.end())
+                    previous_bytes = &module->second;
+            }
+
+            AppendLine(out, name.c_str(), bytes, previous_bytes);
+        }
+    }
+
+    return out;
+}
+
+bool MemoryTracker::Dump(const std::string &file_path, std::string &error) const
+{
+    std::string path = file_path;
+    if (!std::filesystem::path(path).is_absolute())
+        path.insert(0, _directory);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (file)
+        file << Report();
+
+    if (!file)
+    {
+        error = "Could not write \"" + path + "\".";
+        return false;
+    }
+
+    return true;
+}
+
+void MemoryTracker::PushSnapshot(lua_State *L, const MemorySnapshot &snapshot)
+{
+    lua_createtable(L, 0, 5);
+
+    lua_pushlstring(L, snapshot.kind.data(), snapshot.kind.size());
+    lua_setfield(L, -2, "kind");
+
+    lua_pushlstring(L, snapshot.label.data(), snapshot.label.size());
+    lua_setfield(L, -2, "label");
+
+    lua_pushnumber(L, static_cast<lua_Number>(snapshot.time));
+    lua_setfield(L, -2, "time");
+
+    lua_pushnumber(L, static_cast<lua_Number>(snapshot.live));
+    lua_setfield(L, -2, "live");
+
+    lua_createtable(L, 0, static_cast<int>(snapshot.modules.size()));
+    for (const auto &[name, bytes] : snapshot.modules)
+    {
+        lua_pushnumber(L, static_cast<lua_Number>(bytes));
+        lua_setfield(L, -2, name.c_str());
+    }
+    lua_setfield(L, -2, "modules");
+}
+
+int MemoryTracker::L_Snapshot(lua_State *L)
+{
+    auto *self = L_ToUpvalue<MemoryTracker>(L);
+    const char *label = luaL_optstring(L, 1, "");
+
+    PushSnapshot(L, self->Take(L, "snapshot", label));
+    return 1;
+}
+
+int MemoryTracker::L_Snapshots(lua_State *L)
+{
+    auto *self = L_ToUpvalue<MemoryTracker>(L);
+
+    lua_createtable(L, static_cast<int>(self->_snapshots.size()), 0);
+
+    for (std::size_t i = 0; i < self->_snapshots.size(); i++)
+    {
+        PushSnapshot(L, self->_snapshots[i]);
+        lua_rawseti(L, -2, static_cast<int>(i + 1));
+    }
+
+    return 1;
+}
+
+int MemoryTracker::L_Report(lua_State *L)
+{
+    auto *self = L_ToUpvalue<MemoryTracker>(L);
+
+    std::string report = self->Report();
+    lua_pushlstring(L, report.data(), report.size());
+    return 1;
+}
+
+int MemoryTracker::L_Dump(lua_State *L)
+{
+    auto *self = L_ToUpvalue<MemoryTracker>(L);
+    const char *path = luaL_optstring(L, 1, self->_report_file.c_str());
+
+    if (*path == '\0')
+        return luaL_argerror(L, 1, "no path given and no memory_report_file set");
+
+    std::string error;
+    if (!self->Dump(path, error))
+    {
+        lua_pushnil(L);
+        lua_pushlstring(L, error.data(), error.size());
+        return 2;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Lua memory at one point in time.
+ */
+struct MemorySnapshot
+{
+    // What took the snapshot, `LevelInit`, `LevelShutdown` or `snapshot` when taken from Lua.
+    std::string kind;
+    // Map name for level snapshots, anything passed from Lua otherwise.
+    std::string label;
+    // Seconds since the epoch.
+    std::int64_t time;
+    // Bytes in use by the Lua state.
+    std::size_t live;
+    // Approximate bytes reachable from each module, in call order.
+    std::vector<std::pair<std::string, std::size_t>> modules;
+};
+
+
+/**
+ * @brief Takes snapshots of Lua memory per module and reports growth between them.
+ *
+ * The bytes of a module are estimated by walking everything reachable from its plugin table and
+ * globals, without following the shared globals, the registry or the shared \c package table.
+ * Objects reachable from several modules count for each of them. Walking is slow, so snapshots
+ * are taken on level changes, where a hitch goes unnoticed.
+ */
+struct MemoryTracker
+{
+private:
+    struct Root
+    {
+        std::string name;
+        // Registry references to the plugin table and the module's globals, `LUA_NOREF` for the
+        // shared globals.
+        int table;
+        int env;
+    };
+
+    std::vector<Root> _roots;
+    std::vector<MemorySnapshot> _snapshots;
+
+    std::size_t _limit = 16;
+    std::string _directory;
+    std::string _report_file;
+
+    // Map of the current level, for `LevelShutdown` snapshots.
+    std::string _map;
+
+    const MemorySnapshot *FindPrevious(std::size_t index) const;
+
+    static void PushSnapshot(lua_State *L, const MemorySnapshot &snapshot);
+
+    static int L_Snapshot(lua_State *L);
+
+    static int L_Snapshots(lua_State *L);
+
+    static int L_Report(lua_State *L);
+
+    static int L_Dump(lua_State *L);
+
+public:
+    /**
+     * @param limit Number of snapshots kept, older ones are dropped.
+     * @param directory Directory relative report paths are resolved against.
+     * @param report_file Report written after each level snapshot, empty for none.
+     */
+    void Configure(std::size_t limit, const std::string &directory, const std::string &report_file);
+
+    /**
+     * @brief Registers the \c memory library.
+     */
+    void Open(lua_State *L);
+
+    /**
+     * @brief Forgets all modules and snapshots. Call when closing the Lua state.
+     */
+    void Clear();
+
+    void AddModule(const std::string &name, int table, int env);
+
+    void RemoveModule(const std::string &name);
+
+    /**
+     * @brief Walks all modules and stores a snapshot.
+     */
+    const MemorySnapshot &Take(lua_State *L, const std::string &kind, const std::string &label);
+
+    /**
+     * @brief Takes a snapshot for a level change and writes the report file if there is one.
+     * @param map_name Map that starts, or \c nullptr when the current one ends.
+     * @return \c false if the report file could not be written.
+     */
+    bool TakeLevelSnapshot(lua_State *L, const char *kind, const char *map_name, std::string &error);
+
+    /**
+     * @brief Formats all snapshots with the growth since the previous snapshot of the same kind.
+     */
+    std::string Report() const;
+
+    /**
+     * @brief Writes the report to \p file_path, relative to the plugin directory.
+     */
+    bool Dump(const std::string &file_path, std::string &error) const;
+};
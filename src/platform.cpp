@@ -75,9 +75,67 @@ std::string GetExecutableName()
     return name;
 }
 
+const void *MapFile(const char *path, std::size_t &size)
+{
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+
+    if (mapping == nullptr)
+        return nullptr;
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    // The view keeps the mapping alive.
+    CloseHandle(mapping);
+
+    if (data == nullptr)
+        return nullptr;
+
+    size = static_cast<std::size_t>(file_size.QuadPart);
+    return data;
+}
+
+void UnmapFile(const void *data, std::size_t size)
+{
+    UnmapViewOfFile(data);
+}
+
+bool SyncFile(const char *path)
+{
+    DWORD attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES)
+        return false;
+
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY)
+        return true;
+
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool result = FlushFileBuffers(file);
+    CloseHandle(file);
+
+    return result;
+}
+
 #elif defined(__linux__) //========= Linux ====================================#
 
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 void *GetModuleHandle(const char *module_name)
@@ -105,6 +163,47 @@ std::string GetExecutableName()
     return program_invocation_short_name;
 }
 
+const void *MapFile(const char *path, std::size_t &size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive.
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    size = static_cast<std::size_t>(info.st_size);
+    return data;
+}
+
+void UnmapFile(const void *data, std::size_t size)
+{
+    munmap(const_cast<void *>(data), size);
+}
+
+bool SyncFile(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool result = fsync(fd) == 0;
+    close(fd);
+
+    return result;
+}
+
 #else //=======================================================================#
 
 #error "Platform not supported"
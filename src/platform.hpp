@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 
 #if defined(_WIN32)
@@ -27,3 +28,17 @@ T *GetSymbolAddress(void *module_handle, const char *symbol_name)
 std::string GetExecutableName();
 
 const char *GetModulePath();
+
+/**
+ * @brief Maps a whole file into memory for reading.
+ * @return \c nullptr on failure. Empty files can't be mapped.
+ */
+const void *MapFile(const char *path, std::size_t &size);
+
+void UnmapFile(const void *data, std::size_t size);
+
+/**
+ * @brief Flushes a file or directory to the disk.
+ * @return \c false on failure. Directories always succeed on Windows, where renames are journaled.
+ */
+bool SyncFile(const char *path);
@@ -1,11 +1,16 @@
 #include "plugin.hpp"
 
+#include "ccommand.hpp"
 #include "engine.hpp"
 #include "interface.hpp"
 #include "L.hpp"
+#include "manifest.hpp"
 
 #include <lua.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <ctime>
 #include <filesystem>
 #include <string>
 #include <utility>
@@ -34,25 +39,1033 @@ public:
 };
 
 
+/**
+ * @brief Finds `<name>.lua` or `<name>/init.lua` inside \p directory.
+ */
+static bool FindScript(const std::string &directory, const std::string &name, std::string &script_path)
+{
+    std::error_code error;
+
+    script_path = directory;
+    script_path.append(name).append(".lua");
+
+    if (std::filesystem::is_regular_file(script_path, error))
+        return true;
+
+    script_path = directory;
+    script_path.append(name).append("/init.lua");
+
+    return std::filesystem::is_regular_file(script_path, error);
+}
+
+
+template<typename... Args>
+bool Plugin::TryCallLuaMethod(std::size_t module, Callback callback, int retc, Args&&... args)
+{
+    const auto &entry = _modules[module];
+
+    // Callbacks without a handler never touch the Lua stack.
+    if (!HasHandler(callback) || (entry.handler_mask & CallbackBit(callback)) == 0)
+        return false;
+
+    return TryCallLua(callback, retc, [&]() {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, entry.handlers[CallbackIndex(callback)]);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, entry.table);  // the `self` argument
+        L_Push(L, std::forward<Args>(args)...);
+
+        return 1 + static_cast<int>(sizeof...(args));
+    });
+}
+
+template<typename... Args>
+void Plugin::CallLuaMethods(Callback callback, Args&&... args)
+{
+    if (!HasHandler(callback))
+        return;
+
+    for (std::size_t i = 0; i < _modules.size(); i++)
+        TryCallLuaMethod(i, callback, 0, args...);
+
+    if (_events.HasSubscribers(callback))
+        CallSubscribers(callback, 0, args...);
+}
+
+template<typename F>
+PluginResult PopPluginResult(lua_State *L, F &&error_handler)
+{
+    auto result = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    if (IsValidPluginResult(result))
+        return static_cast<PluginResult>(result);
+
+    error_handler(result);
+    return PluginResult::CONTINUE;
+}
+
+template<typename... Args>
+PluginResult Plugin::CallLuaMethodsForResult(Callback callback, Args&&... args)
+{
+    auto result = PluginResult::CONTINUE;
+
+    if (!HasHandler(callback))
+        return result;
+
+    for (std::size_t i = 0; i < _modules.size(); i++)
+    {
+        if (!TryCallLuaMethod(i, callback, 1, args...))
+            continue;
+
+        auto module_result = PopPluginResult(L, [&](int value) {
+            PluginWarn("Invalid %s result of '%s': %i\n", GetCallbackName(callback), _modules[i].name.c_str(), value);
+        });
+
+        // Later modules don't get to see the call.
+        if (module_result == PluginResult::STOP)
+            return module_result;
+
+        result = std::max(result, module_result);
+    }
+
+    if (_events.HasSubscribers(callback))
+        result = std::max(result, CallSubscribers(callback, 1, args...));
+
+    return result;
+}
+
 template<typename... Args>
-bool TryCallLuaMethod(lua_State *L, const char *method, int retc, Args&&... args)
+PluginResult Plugin::CallSubscribers(Callback callback, int retc, Args&&... args)
+{
+    auto result = PluginResult::CONTINUE;
+
+    // Subscribing during the loop does not move the array.
+    EventBus::DispatchScope scope(_events);
+    const auto &subscribers = _events.Get(callback);
+
+    for (std::size_t i = 0; i < subscribers.size(); i++)
+    {
+        // The watchdog may disable the callback during the loop.
+        if (!HasHandler(callback))
+            break;
+
+        int function = subscribers[i].function;
+        if (function == LUA_NOREF)
+            continue;
+
+        bool success = TryCallLua(callback, retc, [&]() {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, function);
+            L_Push(L, args...);
+
+            return static_cast<int>(sizeof...(args));
+        });
+
+        if (!success || retc == 0)
+            continue;
+
+        auto subscriber_result = PopPluginResult(L, [&](int value) {
+            PluginWarn("Invalid %s result of subscriber %u: %i\n", GetCallbackName(callback), subscribers[i].id, value);
+        });
+
+        if (subscriber_result == PluginResult::STOP)
+            return subscriber_result;
+
+        result = std::max(result, subscriber_result);
+    }
+
+    return result;
+}
+
+template<typename PushFn>
+bool Plugin::TryCallLua(Callback callback, int retc, PushFn &&push)
+{
+    CallbackStats::Clock::time_point start;
+    if (_stats_enabled)
+        start = CallbackStats::Clock::now();
+
+#ifdef LUA_PLUGIN_COUNT_ALLOCATIONS
+    // Only the native part of the dispatch is counted, allocations made by the handler itself
+    // are not our concern.
+    auto allocations = _allocation_counter.count;
+#endif
+
+    int argc = push();
+
+    auto limit_hits = _allocator.GetLimitHits();
+
+    const char *previous_callback = _profiler.SetCallback(GetCallbackName(callback));
+
+    auto watch = _watchdog.Start(callback);
+
+#ifdef LUA_PLUGIN_COUNT_ALLOCATIONS
+    allocations = _allocation_counter.count - allocations;
+#endif
+
+    bool success = L_TryCall(L, argc, retc, ERROR_HANDLER_INDEX);
+
+#ifdef LUA_PLUGIN_COUNT_ALLOCATIONS
+    auto allocations_after_call = _allocation_counter.count;
+#endif
+
+    auto overruns = _watchdog.Stop(watch);
+
+    _profiler.SetCallback(previous_callback);
+
+    if (_stats_enabled)
+        _stats.Record(callback, CallbackStats::Clock::now() - start);
+
+#ifdef LUA_PLUGIN_COUNT_ALLOCATIONS
+    allocations += _allocation_counter.count - allocations_after_call;
+
+    if (success && callback == Callback::GameFrame && allocations != 0)
+    {
+        PluginWarn("GameFrame dispatch made %zu allocations, expected none.\n", allocations);
+        assert(allocations == 0);
+    }
+#endif
+
+    if (overruns != 0)
+        HandleOverrun(callback, overruns);
+
+    if (!success && _allocator.GetLimitHits() != limit_hits)
+    {
+        PluginWarn("%s exceeded the Lua memory limit of %zu bytes.\n", GetCallbackName(callback), _allocator.GetLimit());
+
+        // Give the next call a chance to succeed.
+        lua_gc(L, LUA_GCCOLLECT, 0);
+    }
+
+    return success;
+}
+
+
+void Plugin::BindHandler(lua_State *L, int table_index, std::size_t module, Callback callback)
+{
+    auto &entry = _modules[module];
+    auto index = CallbackIndex(callback);
+
+    // Modules that failed to load stay without handlers.
+    if (entry.table == LUA_NOREF)
+        return;
+
+    luaL_unref(L, LUA_REGISTRYINDEX, entry.handlers[index]);
+
+    lua_pushstring(L, CALLBACK_NAMES[index]);
+    lua_rawget(L, table_index);
+
+    if (lua_isfunction(L, -1))
+    {
+        entry.handlers[index] = luaL_ref(L, LUA_REGISTRYINDEX);
+        entry.handler_mask |= CallbackBit(callback);
+    }
+    else
+    {
+        lua_pop(L, 1);
+        entry.handlers[index] = LUA_NOREF;
+        entry.handler_mask &= ~CallbackBit(callback);
+    }
+
+    UpdateHandlerMask();
+}
+
+void Plugin::BindHandlers(lua_State *L, int table_index, std::size_t module)
+{
+    // Make relative index absolute, pseudo-indices are left as they are.
+    if (table_index < 0 && table_index > LUA_REGISTRYINDEX)
+        table_index = lua_gettop(L) + table_index + 1;
+
+    for (std::size_t i = 0; i < CALLBACK_COUNT; i++)
+        BindHandler(L, table_index, module, static_cast<Callback>(i));
+}
+
+void Plugin::BindAllHandlers()
+{
+    for (std::size_t i = 0; i < _modules.size(); i++)
+    {
+        if (_modules[i].table == LUA_NOREF)
+            continue;
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, _modules[i].table);
+        BindHandlers(L, -1, i);
+        lua_pop(L, 1);
+    }
+}
+
+void Plugin::UpdateHandlerMask()
+{
+    _handler_mask = 0;
+
+    for (const auto &module : _modules)
+        _handler_mask |= module.handler_mask;
+
+    // Handlers disabled by the watchdog stay disabled until the plugin is reloaded.
+    _handler_mask &= ~_disabled_mask;
+}
+
+void Plugin::HandleOverrun(Callback callback, std::uint32_t overruns)
+{
+    if (_watchdog_max_overruns == 0 || overruns < _watchdog_max_overruns)
+    {
+        PluginWarn("%s was aborted by the watchdog (%u overruns so far).\n", GetCallbackName(callback), overruns);
+        return;
+    }
+
+    PluginWarn("%s was aborted by the watchdog %u times, disabling it.\n", GetCallbackName(callback), overruns);
+
+    _disabled_mask |= CallbackBit(callback);
+    UpdateHandlerMask();
+}
+
+void Plugin::ConfigureWatchdog()
+{
+    using milliseconds = std::chrono::duration<double, std::milli>;
+
+    double default_budget = _config.GetNumber("watchdog_budget_ms", 0.0);
+
+    for (std::size_t i = 0; i < CALLBACK_COUNT; i++)
+    {
+        std::string key = "watchdog_budget_ms.";
+        key.append(CALLBACK_NAMES[i]);
+
+        auto budget = milliseconds(_config.GetNumber(key, default_budget));
+        _watchdog.SetBudget(static_cast<Callback>(i), std::chrono::duration_cast<Watchdog::Clock::duration>(budget));
+    }
+
+    _watchdog.ResetOverruns();
+    _watchdog_max_overruns = static_cast<std::uint32_t>(_config.GetInteger("watchdog_max_overruns", 3));
+    _disabled_mask = 0;
+}
+
+int Plugin::L_PluginNewIndex(lua_State *L)
+{
+    auto *plugin = L_ToUpvalue<Plugin>(L);
+    auto module = static_cast<std::size_t>(lua_tointeger(L, lua_upvalueindex(2)));
+
+    Callback callback;
+    bool is_callback = lua_type(L, 2) == LUA_TSTRING && FindCallback(lua_tostring(L, 2), callback);
+
+    lua_settop(L, 3);
+    lua_rawset(L, 1);
+
+    if (!is_callback)
+        return 0;
+
+    // Tables replaced by a reload keep their metatable, but no longer provide the handlers.
+    lua_rawgeti(L, LUA_REGISTRYINDEX, plugin->_modules[module].table);
+    bool is_current = lua_rawequal(L, -1, 1);
+    lua_pop(L, 1);
+
+    if (is_current)
+        plugin->BindHandler(L, 1, module, callback);
+
+    return 0;
+}
+
+int Plugin::L_PluginRebind(lua_State *L)
+{
+    auto *plugin = L_ToUpvalue<Plugin>(L);
+
+    auto module = static_cast<std::size_t>(lua_tointeger(L, lua_upvalueindex(3)));
+
+    plugin->BindHandlers(L, lua_upvalueindex(2), module);
+
+    return 0;
+}
+
+int Plugin::L_PluginWatchLoader(lua_State *L)
+{
+    auto *plugin = L_ToUpvalue<Plugin>(L);
+    const char *name = luaL_checkstring(L, 1);
+
+    std::string file_path;
+    if (L_SearchPackagePath(L, name, file_path) && plugin->_watcher.Watch(file_path))
+    {
+        auto &names = plugin->_watched_modules[FileWatcher::Normalize(file_path)];
+
+        if (std::find(names.begin(), names.end(), name) == names.end())
+            names.push_back(name);
+    }
+
+    // Only watching, the other loaders do the loading.
+    return 0;
+}
+
+int Plugin::L_PluginMemory(lua_State *L)
+{
+    auto *plugin = L_ToUpvalue<Plugin>(L);
+    auto &allocator = plugin->_allocator;
+
+    lua_createtable(L, 0, 6);
+
+    // Without our allocator, only the GC knows how much memory is in use.
+    if (!plugin->_allocator_in_use)
+    {
+        lua_pushnumber(L, lua_gc(L, LUA_GCCOUNT, 0) * 1024.0 + lua_gc(L, LUA_GCCOUNTB, 0));
+        lua_setfield(L, -2, "live");
+        return 1;
+    }
+
+    lua_pushnumber(L, static_cast<lua_Number>(allocator.GetLiveBytes()));
+    lua_setfield(L, -2, "live");
+
+    lua_pushnumber(L, static_cast<lua_Number>(allocator.GetPeakBytes()));
+    lua_setfield(L, -2, "peak");
+
+    lua_pushnumber(L, static_cast<lua_Number>(allocator.GetLimit()));
+    lua_setfield(L, -2, "limit");
+
+    lua_pushnumber(L, static_cast<lua_Number>(allocator.GetAllocations()));
+    lua_setfield(L, -2, "allocations");
+
+    lua_pushnumber(L, static_cast<lua_Number>(allocator.GetFrameAllocations()));
+    lua_setfield(L, -2, "frame_allocations");
+
+    lua_pushnumber(L, static_cast<lua_Number>(allocator.GetLimitHits()));
+    lua_setfield(L, -2, "limit_hits");
+
+    return 1;
+}
+
+int Plugin::L_PluginStats(lua_State *L)
+{
+    auto *plugin = L_ToUpvalue<Plugin>(L);
+    bool reset = lua_toboolean(L, 1);
+
+    lua_createtable(L, 0, 0);
+
+    for (std::size_t i = 0; i < CALLBACK_COUNT; i++)
+    {
+        const auto &histogram = plugin->_stats.Get(static_cast<Callback>(i));
+        if (histogram.GetCount() == 0)
+            continue;
+
+        lua_createtable(L, 0, 5);
+
+        lua_pushnumber(L, static_cast<lua_Number>(histogram.GetCount()));
+        lua_setfield(L, -2, "count");
+
+        // Durations are in microseconds.
+
+        lua_pushnumber(L, histogram.GetMean() / 1000.0);
+        lua_setfield(L, -2, "mean");
+
+        lua_pushnumber(L, histogram.GetPercentile(0.5) / 1000.0);
+        lua_setfield(L, -2, "p50");
+
+        lua_pushnumber(L, histogram.GetPercentile(0.99) / 1000.0);
+        lua_setfield(L, -2, "p99");
+
+        lua_pushnumber(L, histogram.GetMax() / 1000.0);
+        lua_setfield(L, -2, "max");
+
+        lua_setfield(L, -2, CALLBACK_NAMES[i]);
+    }
+
+    if (reset)
+        plugin->_stats.Reset();
+
+    return 1;
+}
+
+int Plugin::L_PrintPluginStats(lua_State *L)
+{
+    L_ToUpvalue<Plugin>(L)->PrintStats();
+    return 0;
+}
+
+int Plugin::L_RecorderStart(lua_State *L)
+{
+    auto *plugin = L_ToUpvalue<Plugin>(L);
+    const char *path = luaL_optstring(L, 1, "");
+
+    std::string error;
+    if (!plugin->StartTrace(path, error))
+    {
+        lua_pushnil(L);
+        lua_pushlstring(L, error.data(), error.size());
+        return 2;
+    }
+
+    const auto &trace_path = plugin->_trace.GetPath();
+    lua_pushlstring(L, trace_path.data(), trace_path.size());
+    return 1;
+}
+
+int Plugin::L_RecorderStop(lua_State *L)
+{
+    auto *plugin = L_ToUpvalue<Plugin>(L);
+
+    if (!plugin->_trace.IsOpen())
+    {
+        lua_pushnil(L);
+        lua_pushliteral(L, "not recording");
+        return 2;
+    }
+
+    std::string path = plugin->_trace.GetPath();
+    auto records = plugin->_trace.GetRecordCount();
+
+    if (!plugin->_trace.Close())
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Could not write \"%s\".", path.c_str());
+        return 2;
+    }
+
+    lua_pushlstring(L, path.data(), path.size());
+    lua_pushnumber(L, static_cast<lua_Number>(records));
+    return 2;
+}
+
+int Plugin::L_RecorderRecording(lua_State *L)
+{
+    lua_pushboolean(L, L_ToUpvalue<Plugin>(L)->_trace.IsOpen());
+    return 1;
+}
+
+void Plugin::PrintStats()
+{
+    if (!_stats_enabled)
+    {
+        PluginPrint("Callback stats are disabled.\n");
+        return;
+    }
+
+    PluginPrint("%-26s %10s %10s %10s %10s %10s\n", "Callback", "Calls", "Mean(us)", "p50(us)", "p99(us)", "Max(us)");
+
+    for (std::size_t i = 0; i < CALLBACK_COUNT; i++)
+    {
+        const auto &histogram = _stats.Get(static_cast<Callback>(i));
+        if (histogram.GetCount() == 0)
+            continue;
+
+        PluginPrint(
+            "%-26s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+            CALLBACK_NAMES[i],
+            static_cast<unsigned long long>(histogram.GetCount()),
+            histogram.GetMean() / 1000.0,
+            histogram.GetPercentile(0.5) / 1000.0,
+            histogram.GetPercentile(0.99) / 1000.0,
+            histogram.GetMax() / 1000.0
+        );
+    }
+}
+
+void Plugin::InstallPluginMetatable(int table_index, std::size_t module)
+{
+    // Assignments to fields that already exist bypass `__newindex`, those
+    // have to be picked up with an explicit `Plugin:Rebind()`.
+
+    if (table_index < 0 && table_index > LUA_REGISTRYINDEX)
+        table_index = lua_gettop(L) + table_index + 1;
+
+    if (lua_getmetatable(L, table_index))
+    {
+        lua_pop(L, 1);
+        PluginWarn("Plugin table of '%s' has a metatable, callbacks changed after load will be ignored.\n", _modules[module].name.c_str());
+        return;
+    }
+
+    lua_createtable(L, 0, 2);
+
+    lua_pushlightuserdata(L, this);
+    lua_pushinteger(L, static_cast<lua_Integer>(module));
+    lua_pushcclosure(L, &L_PluginNewIndex, 2);
+    lua_setfield(L, -2, "__newindex");
+
+    lua_createtable(L, 0, 1);
+    lua_pushlightuserdata(L, this);
+    lua_pushvalue(L, table_index);
+    lua_pushinteger(L, static_cast<lua_Integer>(module));
+    lua_pushcclosure(L, &L_PluginRebind, 3);
+    lua_setfield(L, -2, "Rebind");
+    lua_setfield(L, -2, "__index");
+
+    lua_setmetatable(L, table_index);
+}
+
+void Plugin::QueueEdictEvent(EdictEventType type, const edict_t *edict)
+{
+    if (_edict_batch.IsFull())
+        FlushEdictEvents();
+
+    _edict_batch.Add(type, edict);
+}
+
+void Plugin::FlushEdictEvents()
+{
+    if (_edict_batch.IsEmpty())
+        return;
+
+    const auto *events = _edict_batch.GetData();
+    auto count = _edict_batch.GetCount();
+
+    for (std::size_t i = 0; i < _modules.size(); i++)
+    {
+        // A failed call still counts as delivered, so events are never seen twice.
+        if ((_modules[i].handler_mask & ~_disabled_mask & CallbackBit(Callback::OnEdictBatch)) != 0)
+        {
+            TryCallLuaMethod(i, Callback::OnEdictBatch, 0, events, count);
+            continue;
+        }
+
+        // Modules without `OnEdictBatch` still get the individual callbacks.
+        for (std::size_t j = 0; j < count; j++)
+        {
+            const auto &event = events[j];
+
+            switch (event.type)
+            {
+            case EdictEventType::Allocated:
+                TryCallLuaMethod(i, Callback::OnEdictAllocated, 0, const_cast<edict_t *>(event.edict));
+                break;
+
+            case EdictEventType::Freed:
+                TryCallLuaMethod(i, Callback::OnEdictFreed, 0, event.edict);
+                break;
+
+            case EdictEventType::SettingsChanged:
+                TryCallLuaMethod(i, Callback::ClientSettingsChanged, 0, const_cast<edict_t *>(event.edict));
+                break;
+            }
+        }
+    }
+
+    if (_events.HasSubscribers(Callback::OnEdictBatch))
+        CallSubscribers(Callback::OnEdictBatch, 0, events, count);
+
+    // Same for subscribers of the individual callbacks.
+    constexpr std::uint32_t SINGLE_EVENT_MASK =
+        CallbackBit(Callback::OnEdictAllocated) | CallbackBit(Callback::OnEdictFreed) | CallbackBit(Callback::ClientSettingsChanged);
+
+    if ((_events.GetMask() & SINGLE_EVENT_MASK) != 0)
+    {
+        for (std::size_t j = 0; j < count; j++)
+        {
+            const auto &event = events[j];
+
+            switch (event.type)
+            {
+            case EdictEventType::Allocated:
+                CallSubscribers(Callback::OnEdictAllocated, 0, const_cast<edict_t *>(event.edict));
+                break;
+
+            case EdictEventType::Freed:
+                CallSubscribers(Callback::OnEdictFreed, 0, event.edict);
+                break;
+
+            case EdictEventType::SettingsChanged:
+                CallSubscribers(Callback::ClientSettingsChanged, 0, const_cast<edict_t *>(event.edict));
+                break;
+            }
+        }
+    }
+
+    _edict_batch.Clear();
+}
+
+void Plugin::TakeMemorySnapshot(const char *kind, const char *map_name)
+{
+    std::string error;
+    if (!_memory.TakeLevelSnapshot(L, kind, map_name, error))
+        PluginWarn("%s\n", error.c_str());
+}
+
+bool Plugin::StartTrace(std::string path, std::string &error)
+{
+    if (_trace.IsOpen())
+    {
+        error = "already recording to \"" + _trace.GetPath() + "\"";
+        return false;
+    }
+
+    if (path.empty())
+    {
+        char time[32] = "";
+        std::time_t now = std::time(nullptr);
+        if (const std::tm *local = std::localtime(&now))
+            std::strftime(time, sizeof(time), "%Y%m%d-%H%M%S", local);
+
+        path = _name + "-" + time + ".trace";
+    }
+
+    if (!std::filesystem::path(path).is_absolute())
+        path.insert(0, _path);
+
+    // Versions end in their number, Portal 2 uses the same one as version 3.
+    int interface_version = !_version.empty() ? _version.back() - '0' : 0;
+
+    if (!_trace.Open(path, interface_version, _trace_edict_size, error))
+        return false;
+
+    _trace.SetEdictList(_edict_list);
+    return true;
+}
+
+void Plugin::StopTrace()
+{
+    if (!_trace.IsOpen())
+        return;
+
+    std::string path = _trace.GetPath();
+    auto records = static_cast<unsigned long long>(_trace.GetRecordCount());
+
+    if (_trace.Close())
+        PluginPrint("Recorded %llu callbacks to \"%s\".\n", records, path.c_str());
+    else
+        PluginWarn("Could not write \"%s\".\n", path.c_str());
+}
+
+void Plugin::ReloadChangedModules()
+{
+    _changed_files.clear();
+    _watcher.Poll(_changed_files);
+
+    if (_changed_files.empty())
+        return;
+
+    for (const auto &file : _changed_files)
+    {
+        for (std::size_t i = 0; i < _modules.size(); i++)
+        {
+            if (file == _modules[i].path && ReloadEntryPoint(i))
+                PluginPrint("Reloaded \"%s\".\n", file.c_str());
+        }
+
+        auto modules = _watched_modules.find(file);
+        if (modules == _watched_modules.end())
+            continue;
+
+        for (const auto &name : modules->second)
+        {
+            if (ReloadModule(name, file))
+                PluginPrint("Reloaded module '%s'.\n", name.c_str());
+        }
+    }
+
+    // Callbacks disabled by the watchdog get another chance with the new code.
+    _watchdog.ResetOverruns();
+    _disabled_mask = 0;
+
+    BindAllHandlers();
+}
+
+bool Plugin::ReloadModule(const std::string &name, const std::string &path)
+{
+    bool reloaded = false;
+
+    // Shared modules live in the global `package.loaded`.
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "loaded");
+
+    lua_getfield(L, -1, name.c_str());
+    bool loaded = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+
+    if (loaded)
+        reloaded = ReloadModuleInto(lua_gettop(L), LUA_NOREF, name, path);
+
+    lua_pop(L, 2);
+
+    // Modules hosted with a manifest have their own.
+    for (const auto &module : _modules)
+    {
+        if (module.env == LUA_NOREF)
+            continue;
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, module.env);
+        lua_getfield(L, -1, "package");
+        lua_pushliteral(L, "loaded");
+        lua_rawget(L, -2);
+
+        lua_getfield(L, -1, name.c_str());
+        loaded = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+
+        if (loaded && ReloadModuleInto(lua_gettop(L), module.env, name, path))
+            reloaded = true;
+
+        lua_pop(L, 3);
+    }
+
+    return reloaded;
+}
+
+bool Plugin::ReloadModuleInto(int loaded_index, int env, const std::string &name, const std::string &path)
+{
+    int top = lua_gettop(L);
+
+    // Modules may replace their own `package.loaded` entry, so get the old one first.
+    lua_getfield(L, loaded_index, name.c_str());
+    int old_index = lua_gettop(L);
+
+    if (_bytecode_cache.LoadFile(L, path.c_str()) != LUA_OK)
+    {
+        PluginWarn("%s\n", lua_tostring(L, -1));
+        lua_settop(L, top);
+        return false;
+    }
+
+    if (env != LUA_NOREF)
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, env);
+        lua_setfenv(L, -2);
+    }
+
+    // Modules get their name as an argument, like with `require`.
+    lua_pushstring(L, name.c_str());
+
+    if (!L_TryCall(L, 1, 1, ERROR_HANDLER_INDEX))
+    {
+        lua_settop(L, top);
+        return false;
+    }
+
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        lua_pushboolean(L, 1);
+    }
+
+    int new_index = lua_gettop(L);
+
+    if (!CallReloadHook(old_index, new_index))
+    {
+        PluginWarn("Keeping the old version of module '%s'.\n", name.c_str());
+        lua_settop(L, top);
+        return false;
+    }
+
+    lua_pushvalue(L, new_index);
+    lua_setfield(L, loaded_index, name.c_str());
+
+    lua_settop(L, top);
+    return true;
+}
+
+bool Plugin::ReloadEntryPoint(std::size_t module)
+{
+    int top = lua_gettop(L);
+    const auto &entry = _modules[module];
+
+    if (entry.env != LUA_NOREF)
+        lua_rawgeti(L, LUA_REGISTRYINDEX, entry.env);
+
+    if (!RunEntryPoint(entry.name, entry.path, false, entry.env != LUA_NOREF ? top + 1 : 0))
+    {
+        lua_settop(L, top);
+        return false;
+    }
+
+    int new_index = lua_gettop(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, entry.table);
+
+    if (!CallReloadHook(new_index + 1, new_index))
+    {
+        PluginWarn("Keeping the old version of \"%s\".\n", entry.path.c_str());
+        lua_settop(L, top);
+        return false;
+    }
+
+    lua_pushvalue(L, new_index);
+    lua_rawseti(L, LUA_REGISTRYINDEX, entry.table);
+
+    InstallPluginMetatable(new_index, module);
+
+    lua_settop(L, top);
+    return true;
+}
+
+bool Plugin::CallReloadHook(int old_index, int new_index)
+{
+    if (!lua_istable(L, new_index))
+        return true;
+
+    lua_pushliteral(L, "__reload");
+    lua_rawget(L, new_index);
+
+    if (!lua_isfunction(L, -1))
+    {
+        lua_pop(L, 1);
+        return true;
+    }
+
+    lua_pushvalue(L, old_index);
+    lua_pushvalue(L, new_index);
+
+    return L_TryCall(L, 2, 0, ERROR_HANDLER_INDEX);
+}
+
+bool Plugin::RunEntryPoint(const std::string &name, const std::string &script_path, bool use_bundle, int env_index)
 {
-    if (L == nullptr)
+    int load_status = use_bundle
+        ? _bundle.Load(L, name)
+        : _bytecode_cache.LoadFile(L, script_path.c_str());
+
+    if (load_status != LUA_OK)
+    {
+        PluginWarn("%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
         return false;
+    }
 
-    lua_getfield(L, -1, method);
+    if (env_index != 0)
+    {
+        lua_pushvalue(L, env_index);
+        lua_setfenv(L, -2);
+    }
 
-    if (!lua_isfunction(L, -1))
+    if (!L_RunChunk(L, script_path.c_str(), 1))
+        return false;
+
+    if (!lua_istable(L, -1))
     {
+        PluginPrint("Lua entry point \"%s\" did not return a table.\n", script_path.c_str());
         lua_pop(L, 1);
-        lua_settop(L, lua_gettop(L) + retc);
+        return false;
+    }
+
+    return true;
+}
+
+bool Plugin::AddModule(const std::string &name, const std::string &script_path, bool use_bundle, long long priority)
+{
+    int top = lua_gettop(L);
+    int env_index = 0;
+
+    if (_use_manifest)
+    {
+        if (!L_PushModuleEnvironment(L, name.c_str()))
+        {
+            PluginWarn("%s\n", lua_tostring(L, -1));
+            lua_settop(L, top);
+            return false;
+        }
+
+        env_index = lua_gettop(L);
+    }
+
+    if (!RunEntryPoint(name, script_path, use_bundle, env_index))
+    {
+        lua_settop(L, top);
+        return false;
+    }
+
+    PluginModule module;
+    module.name = name;
+    module.path = use_bundle ? std::string() : FileWatcher::Normalize(script_path);
+    module.priority = priority;
+    module.env = LUA_NOREF;
+
+    for (int &handler : module.handlers)
+        handler = LUA_NOREF;
+
+    if (env_index != 0)
+    {
+        lua_pushvalue(L, env_index);
+        module.env = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    lua_pushvalue(L, -1);
+    module.table = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    _memory.AddModule(module.name, module.table, module.env);
+
+    _modules.push_back(std::move(module));
+    auto index = _modules.size() - 1;
+
+    InstallPluginMetatable(-1, index);
+    BindHandlers(L, -1, index);
+
+    lua_settop(L, top);
+
+    if (_hot_reload && !_modules[index].path.empty())
+        _watcher.Watch(_modules[index].path);
+
+    return true;
+}
+
+bool Plugin::CallLoad(std::size_t module, CreateInterfaceFn *interface_factory, CreateInterfaceFn *game_server_factory)
+{
+    if ((_modules[module].handler_mask & CallbackBit(Callback::Load)) == 0)
         return true;
+
+    int top = lua_gettop(L);
+
+    if (!TryCallLuaMethod(module, Callback::Load, LUA_MULTRET, interface_factory, game_server_factory))
+        return false;
+
+    // Treat no return value as success.
+    bool success = lua_gettop(L) == top || lua_toboolean(L, top + 1);
+
+    lua_settop(L, top);
+    return success;
+}
+
+void Plugin::ReleaseModule(std::size_t module)
+{
+    auto &entry = _modules[module];
+
+    // The entry stays, so indices held by plugin table metatables stay valid.
+    for (int &handler : entry.handlers)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, handler);
+        handler = LUA_NOREF;
+    }
+
+    _memory.RemoveModule(entry.name);
+
+    luaL_unref(L, LUA_REGISTRYINDEX, entry.table);
+    luaL_unref(L, LUA_REGISTRYINDEX, entry.env);
+
+    entry.table = LUA_NOREF;
+    entry.env = LUA_NOREF;
+    entry.path.clear();
+    entry.handler_mask = 0;
+
+    UpdateHandlerMask();
+}
+
+void Plugin::CloseLuaState()
+{
+    // Workers must not deliver results into a closed state.
+    _workers.Stop();
+    _files.Stop();
+
+    if (_profiler.IsRunning())
+    {
+        std::string file_path;
+        std::string error;
+
+        if (_profiler.Stop(file_path, error))
+            PluginPrint("Profile written to \"%s\".\n", file_path.c_str());
+        else
+            PluginWarn("%s\n", error.c_str());
     }
 
-    lua_pushvalue(L, -2);  // the `self` argument
-    L_Push(L, std::forward<Args>(args)...);
+    lua_close(L);
+    L = nullptr;
 
-    return L_TryCall(L, 1 + sizeof...(args), retc);
+    _bundle.Close();
+    _console.Clear();
+    _commands.Clear();
+    _connection_filter.Clear();
+    _edict_batch.Clear();
+    _watcher.Clear();
+    _watched_modules.clear();
+    _allocator.Reset();
+    _scheduler.Clear();
+    _timers.Clear();
+    _gc.Clear();
+    _memory.Clear();
+    _jit.Clear();
+    _profiler.Clear();
+
+    StopTrace();
+
+    // References died with the state.
+    _events.Clear();
+    _modules.clear();
+    _handler_mask = 0;
 }
 
 
@@ -89,100 +1102,320 @@ bool Plugin::Load(CreateInterfaceFn *interface_factory, CreateInterfaceFn *game_
     if (_name.empty())
         return false;
 
-    // Find Lua script or module matching the plugin's name.
+    // Find the manifest, Lua bundle, script or module matching the plugin's name.
 
-    std::string script_path = _path;
-    script_path.append(_name).append(".lua");
+    std::string manifest_path = _path;
+    manifest_path.append(_name).append(".manifest");
 
     std::error_code error;
-    if (!std::filesystem::is_regular_file(script_path, error))
-    {
-        // Remove `.lua` extension.
-        script_path.resize(script_path.length() - 4);
+    _use_manifest = std::filesystem::is_regular_file(manifest_path, error);
 
-        script_path.append("/init.lua");
-
-        if (!std::filesystem::is_regular_file(script_path, error))
+    std::vector<ManifestEntry> manifest;
+    if (_use_manifest)
+    {
+        std::string manifest_error;
+        if (!LoadManifest(manifest_path, manifest, manifest_error))
         {
-            PluginPrint(
-                "Lua entry point not found. Neither \"%s.lua\" nor \"%s/init.lua\" were found inside \"%s\".\n",
-                _name.c_str(), _name.c_str(), _path.c_str()
-            );
+            PluginWarn("%s\n", manifest_error.c_str());
+            return false;
+        }
 
+        if (manifest.empty())
+        {
+            PluginWarn("Manifest \"%s\" does not list any modules.\n", manifest_path.c_str());
             return false;
         }
     }
 
+    std::string script_path = _path;
+    script_path.append(_name).append(".luab");
+
+    // With a manifest, modules are loaded from the bundle if there is one.
+    bool use_bundle = std::filesystem::is_regular_file(script_path, error);
+
+    if (!use_bundle && !_use_manifest && !FindScript(_path, _name, script_path))
+    {
+        PluginPrint(
+            "Lua entry point not found. Neither \"%s.lua\" nor \"%s/init.lua\" were found inside \"%s\".\n",
+            _name.c_str(), _name.c_str(), _path.c_str()
+        );
+
+        return false;
+    }
+
+    std::string config_path = _path;
+    config_path.append(_name).append(".cfg");
+    _config.LoadFile(config_path);
+
     // Initialize Lua and run the script.
 
-    L = luaL_newstate();
+    _allocator.SetLimit(_config.GetSize("memory_limit", 0));
+
+    _stats_enabled = _config.GetBool("callback_stats", true);
+    _stats.Reset();
+
+    ConfigureWatchdog();
+
+    _scheduler_budget = std::chrono::microseconds(_config.GetInteger("scheduler_budget_us", 1000));
+
+    _gc.Configure(
+        std::chrono::microseconds(_config.GetInteger("gc_step_budget_us", 500)),
+        static_cast<int>(_config.GetInteger("gc_pause", 200)),
+        static_cast<int>(_config.GetInteger("gc_stepmul", 200)),
+        _config.GetBool("gc_level_collect", true),
+        _config.GetBool("gc_stop_between_frames", false)
+    );
+
+    _memory.Configure(
+        static_cast<std::size_t>(std::max(_config.GetInteger("memory_snapshots", 16), 0LL)),
+        _path,
+        _config.GetString("memory_report_file", "")
+    );
+
+    std::string jit_log_path = _config.GetString("jit_log_file", "");
+    if (!jit_log_path.empty() && !std::filesystem::path(jit_log_path).is_absolute())
+        jit_log_path.insert(0, _path);
+
+    _jit.Configure(
+        _config.GetBool("jit", true),
+        _config.GetString("jit_opt", ""),
+        static_cast<int>(_config.GetInteger("jit_diagnostics", 0)),
+        jit_log_path,
+        "[" + _name + "] "
+    );
+
+    _profiler.Configure(_path, _name);
+
+    _trace_edict_size = static_cast<std::size_t>(std::max(_config.GetInteger("record_edict_size", TRACE_DEFAULT_EDICT_SIZE), 1LL));
+
+    _edict_batch.Reserve(static_cast<std::size_t>(std::max(_config.GetInteger("edict_batch_size", 4096), 1LL)));
+
+    double print_rate = _config.GetNumber("print_rate", 20.0);
+    double print_burst = _config.GetNumber("print_burst", 100.0);
+    _console.SetRateLimit(print_rate, print_burst);
+    _workers.SetPrintRateLimit(print_rate, print_burst);
+
+    _connection_filter.SetRate(_config.GetNumber("connect_rate", 0.0), _config.GetNumber("connect_burst", 3.0));
+    _connection_filter.SetMessages(
+        _config.GetString("connect_ban_message", "You are banned from this server."),
+        _config.GetString("connect_rate_message", "Too many connection attempts, try again later.")
+    );
+
+    std::string bytecode_cache_directory;
+    if (_config.GetBool("bytecode_cache", true))
+    {
+        bytecode_cache_directory = _config.GetString("bytecode_cache_dir", "luacache");
+
+        if (!std::filesystem::path(bytecode_cache_directory).is_absolute())
+            bytecode_cache_directory.insert(0, _path);
+    }
+    _bytecode_cache.SetDirectory(bytecode_cache_directory);
+
+    L = lua_newstate(&PoolAllocator::Alloc, &_allocator);
+    _allocator_in_use = L != nullptr;
+
     if (L == nullptr)
     {
-        PluginWarn("Could not create Lua state.\n");
-        return false;
+        // 64-bit LuaJIT without GC64 only works with its own allocator.
+        L = luaL_newstate();
+        if (L == nullptr)
+        {
+            PluginWarn("Could not create Lua state.\n");
+            return false;
+        }
+
+        PluginWarn("Custom allocator is not supported by this LuaJIT build, memory limit is disabled.\n");
     }
 
     defer release_lua_state([&]() {
-        lua_close(L);
-        L = nullptr;
+        CloseLuaState();
     });
 
+    if (_config.GetBool("record", false))
+    {
+        std::string trace_error;
+        if (!StartTrace(_config.GetString("record_file", ""), trace_error))
+            PluginWarn("%s\n", trace_error.c_str());
+    }
+
+    Record(Callback::Load);
+
+#ifdef LUA_PLUGIN_COUNT_ALLOCATIONS
+    L_InstallAllocationCounter(L, _allocation_counter);
+#endif
+
+    // Reserve stack space for callback arguments once, so calls don't have to.
+    if (!lua_checkstack(L, CALL_STACK_RESERVE))
+    {
+        PluginWarn("Could not reserve Lua stack space.\n");
+        return false;
+    }
+
+    _watchdog.Attach(L, static_cast<int>(_config.GetInteger("watchdog_interval", 1000)));
+
+    // The error handler stays at a fixed stack slot for all calls.
+    lua_pushcfunction(L, &L_ErrorHandler);
+
     luaL_openlibs(L);
 
-    L_SetGlobalFunction(L, "print", &L_Print<Print>);
-    L_SetGlobalFunction(L, "warn", &L_Print<Warn>);
+    // Before any Lua code runs, so its traces are reported too.
+    std::string jit_error;
+    if (!_jit.Open(L, jit_error))
+        PluginWarn("Could not apply JIT settings: %s\n", jit_error.c_str());
+
+    _console.Open(L);
+    _gc.Open(L);
+    L_SetGlobalFunction(L, "plugin_memory", &L_PluginMemory, this);
+    L_SetGlobalFunction(L, "plugin_stats", &L_PluginStats, this);
+    L_SetGlobalFunction(L, "print_plugin_stats", &L_PrintPluginStats, this);
+
+    // Pointer arguments of callbacks are passed as these ctypes.
+    if (!L_DeclareCTypes(L))
+    {
+        PluginWarn("Could not declare FFI types for callback arguments.\n");
+        return false;
+    }
+
+    _scheduler.Open(L);
+    _timers.Open(L);
+
+    if (use_bundle)
+    {
+        std::string bundle_error;
+        if (!_bundle.Open(script_path, bundle_error))
+        {
+            PluginWarn("%s\n", bundle_error.c_str());
+            return false;
+        }
+    }
+
+    long long worker_threads = _config.GetInteger("worker_threads", 0);
+    if (worker_threads > 0)
+        _workers.Start(static_cast<std::size_t>(worker_threads), _path, &_bundle);
+
+    _workers.Open(L);
+    _files.Open(L);
+    _commands.Open(L);
+    _connection_filter.Open(L);
+    _events.Open(L);
+    _memory.Open(L);
+    _profiler.Open(L);
+
+    static const luaL_Reg recorder_functions[] = {
+        { "start", &L_RecorderStart },
+        { "stop", &L_RecorderStop },
+        { "recording", &L_RecorderRecording },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "recorder", recorder_functions, this);
 
     lua_pushstring(L, _version.c_str());
     lua_setglobal(L, "INTERFACEVERSION_ISERVERPLUGINCALLBACKS");
 
     L_SetPackagePath(L, _path.c_str());
+    _bytecode_cache.Open(L);
+    _bundle.Install(L);
 
-    if (!L_RunFile(L, script_path.c_str(), 1))
-        return false;
-
-    if (!lua_istable(L, 1))
+    _hot_reload = _config.GetBool("hot_reload", false);
+    if (_hot_reload && use_bundle)
     {
-        PluginPrint("Lua entry point \"%s\" did not return a table.\n", script_path.c_str());
-        return false;
+        PluginWarn("Hot reload does not work with bundles, disabling it.\n");
+        _hot_reload = false;
     }
 
-    if (!TryCallLuaMethod(L, "Load", LUA_MULTRET, interface_factory, game_server_factory))
-        return false;
+    if (_hot_reload)
+    {
+        // Goes first, so it sees every module that is loaded from a file.
+        L_InsertPackageLoader(L, &L_PluginWatchLoader, this);
+    }
 
-    // Treat no return value as success.
-    if (lua_gettop(L) == 1 || lua_toboolean(L, 2))
+    if (!_use_manifest)
     {
-        // Leave only the plugin table.
-        lua_settop(L, 1);
+        if (!AddModule(_name, script_path, use_bundle, 0))
+            return false;
+
+        if (!CallLoad(0, interface_factory, game_server_factory))
+            return false;
 
         release_lua_state.cancel();
         return true;
     }
 
-    return false;
+    // A broken module does not keep the others from loading.
+    std::size_t loaded_count = 0;
+
+    for (const auto &entry : manifest)
+    {
+        std::string module_path = script_path;
+
+        if (!use_bundle && !FindScript(_path, entry.module, module_path))
+        {
+            PluginWarn(
+                "Module '%s' not found. Neither \"%s.lua\" nor \"%s/init.lua\" were found inside \"%s\".\n",
+                entry.module.c_str(), entry.module.c_str(), entry.module.c_str(), _path.c_str()
+            );
+
+            continue;
+        }
+
+        if (!AddModule(entry.module, module_path, use_bundle, entry.priority))
+        {
+            PluginWarn("Skipping module '%s'.\n", entry.module.c_str());
+            continue;
+        }
+
+        if (!CallLoad(_modules.size() - 1, interface_factory, game_server_factory))
+        {
+            PluginWarn("Module '%s' failed to load, skipping it.\n", entry.module.c_str());
+            ReleaseModule(_modules.size() - 1);
+            continue;
+        }
+
+        loaded_count++;
+    }
+
+    if (loaded_count == 0)
+    {
+        PluginWarn("None of the modules in \"%s\" could be loaded.\n", manifest_path.c_str());
+        return false;
+    }
+
+    release_lua_state.cancel();
+    return true;
 }
 
 void Plugin::Unload()
 {
+    Record(Callback::Unload);
+
     // `Unload` is called even when `Load` fails.
     if (L == nullptr)
         return;
 
-    TryCallLuaMethod(L, "Unload", 0);
+    CallLuaMethods(Callback::Unload);
 
-    lua_close(L);
-    L = nullptr;
+    CloseLuaState();
 }
 
 const char *Plugin::GetPluginDescription()
 {
-    if (TryCallLuaMethod(L, "GetPluginDescription", 1))
+    Record(Callback::GetPluginDescription);
+
+    // The first module that has a description gets to set it.
+    for (std::size_t i = 0; i < _modules.size(); i++)
     {
+        if (!TryCallLuaMethod(i, Callback::GetPluginDescription, 1))
+            continue;
+
         const char *description = lua_tostring(L, -1);
         if (description != nullptr)
             _description = description;
 
         lua_pop(L, 1);
+
+        if (description != nullptr)
+            break;
     }
 
     return _description.c_str();
@@ -190,136 +1423,243 @@ const char *Plugin::GetPluginDescription()
 
 void Plugin::Pause()
 {
-    TryCallLuaMethod(L, "Pause", 0);
+    Record(Callback::Pause);
+    CallLuaMethods(Callback::Pause);
 }
 
 void Plugin::UnPause()
 {
-    TryCallLuaMethod(L, "UnPause", 0);
+    Record(Callback::UnPause);
+    CallLuaMethods(Callback::UnPause);
 }
 
 void Plugin::LevelInit(char const *map_name)
 {
-    TryCallLuaMethod(L, "LevelInit", 0);
+    Record(Callback::LevelInit, map_name);
+
+    FlushEdictEvents();
+
+    CallLuaMethods(Callback::LevelInit);
+
+    if (L != nullptr)
+    {
+        _gc.Collect(L, ERROR_HANDLER_INDEX);
+        TakeMemorySnapshot("LevelInit", map_name);
+    }
 }
 
 void Plugin::ServerActivate(edict_t *edict_list, int edict_count, int client_max)
 {
-    TryCallLuaMethod(L, "ServerActivate", 0, edict_list, edict_count, client_max);
+    _edict_list = edict_list;
+    _trace.SetEdictList(edict_list);
+    Record(Callback::ServerActivate, edict_count, client_max);
+
+    CallLuaMethods(Callback::ServerActivate, edict_list, edict_count, client_max);
 }
 
 void Plugin::GameFrame(bool simulating)
 {
-    TryCallLuaMethod(L, "GameFrame", 0, simulating);
+    Record(Callback::GameFrame, simulating);
+
+    _allocator.BeginFrame();
+
+    if (_hot_reload && L != nullptr)
+        ReloadChangedModules();
+
+    FlushEdictEvents();
+
+    CallLuaMethods(Callback::GameFrame, simulating);
+
+    if (L == nullptr)
+        return;
+
+    // Work done on behalf of Lua after the handlers belongs to the frame as well, and shares one
+    // budget. What is left once it runs out waits for the next frame.
+    const char *previous_callback = _profiler.SetCallback(GetCallbackName(Callback::GameFrame));
+    auto watch = _watchdog.Start(Callback::GameFrame);
+
+    _workers.Pump(L, ERROR_HANDLER_INDEX, _watchdog);
+    _files.Pump(L, ERROR_HANDLER_INDEX, _watchdog);
+
+    _scheduler.Run(L, _scheduler_budget, _watchdog);
+    _timers.Run(L, ERROR_HANDLER_INDEX, _watchdog);
+
+    auto overruns = _watchdog.Stop(watch);
+
+    _console.Flush(Console::Clock::now());
+
+    // Last, so garbage from this frame is already there.
+    _gc.Step(L, ERROR_HANDLER_INDEX);
+
+    _profiler.SetCallback(previous_callback);
+
+    if (overruns != 0)
+        HandleOverrun(Callback::GameFrame, overruns);
 }
 
 void Plugin::LevelShutdown()
 {
-    TryCallLuaMethod(L, "LevelShutdown", 0);
+    Record(Callback::LevelShutdown);
+
+    FlushEdictEvents();
+
+    CallLuaMethods(Callback::LevelShutdown);
+
+    if (L != nullptr)
+    {
+        _gc.Collect(L, ERROR_HANDLER_INDEX);
+        TakeMemorySnapshot("LevelShutdown", nullptr);
+    }
 }
 
 void Plugin::ClientActive(edict_t *entity)
 {
-    TryCallLuaMethod(L, "ClientActive", 0, entity);
+    Record(Callback::ClientActive, entity);
+    CallLuaMethods(Callback::ClientActive, entity);
 }
 
 void Plugin::ClientFullyConnect(edict_t *entity)
 {
-    TryCallLuaMethod(L, "ClientFullyConnect", 0, entity);
+    Record(Callback::ClientFullyConnect, entity);
+    CallLuaMethods(Callback::ClientFullyConnect, entity);
 }
 
 void Plugin::ClientDisconnect(edict_t *entity)
 {
-    TryCallLuaMethod(L, "ClientDisconnect", 0, entity);
+    Record(Callback::ClientDisconnect, entity);
+    CallLuaMethods(Callback::ClientDisconnect, entity);
 }
 
 void Plugin::ClientPutInServer(edict_t *entity, char const *player_name)
 {
-    TryCallLuaMethod(L, "ClientPutInServer", 0, entity, player_name);
+    Record(Callback::ClientPutInServer, entity, player_name);
+    CallLuaMethods(Callback::ClientPutInServer, entity, player_name);
 }
 
 void Plugin::SetCommandClient(int index)
 {
-    TryCallLuaMethod(L, "SetCommandClient", 0, index);
+    Record(Callback::SetCommandClient, index);
+    CallLuaMethods(Callback::SetCommandClient, index);
 }
 
 void Plugin::ClientSettingsChanged(edict_t *edict)
 {
-    TryCallLuaMethod(L, "ClientSettingsChanged", 0, edict);
-}
-
-template<typename F>
-PluginResult PopPluginResult(lua_State *L, F &&error_handler)
-{
-    auto result = lua_tointeger(L, -1);
-    lua_pop(L, 1);
+    Record(Callback::ClientSettingsChanged, edict);
 
-    if (IsValidPluginResult(result))
-        return static_cast<PluginResult>(result);
+    if (HasHandler(Callback::OnEdictBatch))
+    {
+        QueueEdictEvent(EdictEventType::SettingsChanged, edict);
+        return;
+    }
 
-    error_handler(result);
-    return PluginResult::CONTINUE;
+    CallLuaMethods(Callback::ClientSettingsChanged, edict);
 }
 
 PluginResult Plugin::ClientConnect(bool *allow_connect, edict_t *entity, const char *name, const char *address, char *reject, int max_reject_length)
 {
-    if (TryCallLuaMethod(L, "ClientConnect", 1, allow_connect, entity, name, address, reject, max_reject_length))
+    Record(Callback::ClientConnect, entity, name, address, max_reject_length);
+
+    if (_connection_filter.IsActive())
     {
-        return PopPluginResult(L, [&](int result) {
-            PluginWarn("Invalid Plugin::ClientConnect result: %i\n", result);
-        });
+        auto verdict = _connection_filter.Check(address, ConnectionFilter::Clock::now());
+        if (verdict == ConnectionFilter::Verdict::Banned || verdict == ConnectionFilter::Verdict::RateLimited)
+        {
+            const auto &message = _connection_filter.GetRejectMessage(verdict);
+
+            if (reject != nullptr && max_reject_length > 0)
+            {
+                auto length = std::min(message.size(), static_cast<std::size_t>(max_reject_length - 1));
+                message.copy(reject, length);
+                reject[length] = '\0';
+            }
+
+            *allow_connect = false;
+            return PluginResult::STOP;
+        }
     }
 
-    return PluginResult::CONTINUE;
+    return CallLuaMethodsForResult(Callback::ClientConnect, allow_connect, entity, name, address, reject, max_reject_length);
 }
 
 PluginResult Plugin::ClientCommand(edict_t *entity)
 {
-    if (TryCallLuaMethod(L, "ClientCommand", 1, entity))
-    {
-        return PopPluginResult(L, [&](int result) {
-            PluginWarn("Invalid Plugin::ClientCommand result: %i\n", result);
-        });
-    }
+    // Version 1 doesn't get the arguments.
+    Record(Callback::ClientCommand, entity, static_cast<const CCommand *>(nullptr));
 
-    return PluginResult::CONTINUE;
+    return CallLuaMethodsForResult(Callback::ClientCommand, entity);
 }
 
 PluginResult Plugin::ClientCommand(edict_t *entity, const CCommand &args)
 {
-    if (TryCallLuaMethod(L, "ClientCommand", 1, entity, &args))
+    Record(Callback::ClientCommand, entity, &args);
+
+    // Handlers registered for this command take precedence over `ClientCommand`.
+    bool routing = (_disabled_mask & CallbackBit(Callback::ClientCommand)) == 0;
+
+    if (routing && !_commands.IsEmpty() && args.ArgC() > 0)
     {
-        return PopPluginResult(L, [&](int result) {
-            PluginWarn("Invalid Plugin::ClientCommand result: %i\n", result);
-        });
+        int handler = _commands.Find(args.Arg(0));
+
+        if (handler != LUA_NOREF && lua_checkstack(L, 2 + args.ArgC()))
+        {
+            bool success = TryCallLua(Callback::ClientCommand, 1, [&]() {
+                lua_rawgeti(L, LUA_REGISTRYINDEX, handler);
+                L_Push(L, entity);
+
+                for (int i = 0; i < args.ArgC(); i++)
+                    lua_pushstring(L, args.Arg(i));
+
+                return 1 + args.ArgC();
+            });
+
+            if (!success)
+                return PluginResult::CONTINUE;
+
+            return PopPluginResult(L, [&](int result) {
+                PluginWarn("Invalid result of command handler \"%s\": %i\n", args.Arg(0), result);
+            });
+        }
     }
 
-    return PluginResult::CONTINUE;
+    return CallLuaMethodsForResult(Callback::ClientCommand, entity, &args);
 }
 
 PluginResult Plugin::NetworkIDValidated(const char *user_name, const char *network_id)
 {
-    if (TryCallLuaMethod(L, "NetworkIDValidated", 1, user_name, network_id))
-    {
-        return PopPluginResult(L, [&](int result) {
-            PluginWarn("Invalid Plugin::NetworkIDValidated result: %i\n", result);
-        });
-    }
+    Record(Callback::NetworkIDValidated, user_name, network_id);
 
-    return PluginResult::CONTINUE;
+    return CallLuaMethodsForResult(Callback::NetworkIDValidated, user_name, network_id);
 }
 
 void Plugin::OnQueryCvarValueFinished(int cookie, edict_t *player_entity, int status, const char *cvar_name, const char *cvar_value)
 {
-    TryCallLuaMethod(L, "OnQueryCvarValueFinished", 0, cookie, player_entity, status, cvar_name, cvar_value);
+    Record(Callback::OnQueryCvarValueFinished, cookie, player_entity, status, cvar_name, cvar_value);
+
+    CallLuaMethods(Callback::OnQueryCvarValueFinished, cookie, player_entity, status, cvar_name, cvar_value);
 }
 
 void Plugin::OnEdictAllocated(edict_t *edict)
 {
-    TryCallLuaMethod(L, "OnEdictAllocated", 0, edict);
+    Record(Callback::OnEdictAllocated, edict);
+
+    if (HasHandler(Callback::OnEdictBatch))
+    {
+        QueueEdictEvent(EdictEventType::Allocated, edict);
+        return;
+    }
+
+    CallLuaMethods(Callback::OnEdictAllocated, edict);
 }
 
 void Plugin::OnEdictFreed(const edict_t *edict)
 {
-    TryCallLuaMethod(L, "OnEdictFreed", 0, edict);
+    Record(Callback::OnEdictFreed, edict);
+
+    if (HasHandler(Callback::OnEdictBatch))
+    {
+        QueueEdictEvent(EdictEventType::Freed, edict);
+        return;
+    }
+
+    CallLuaMethods(Callback::OnEdictFreed, edict);
 }
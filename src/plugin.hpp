@@ -1,13 +1,42 @@
 #pragma once
 
+#include "allocator.hpp"
+#include "bundle.hpp"
+#include "bytecode.hpp"
+#include "callback.hpp"
+#include "commands.hpp"
+#include "config.hpp"
+#include "connectionfilter.hpp"
+#include "console.hpp"
+#include "edictbatch.hpp"
 #include "engine.hpp"
+#include "events.hpp"
+#include "fileio.hpp"
+#include "filewatcher.hpp"
+#include "gc.hpp"
 #include "interface.hpp"
+#include "jitdiagnostics.hpp"
+#include "memory.hpp"
+#include "profiler.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+#include "timers.hpp"
+#include "trace.hpp"
+#include "watchdog.hpp"
+#include "worker.hpp"
 
 // #include <lua.hpp>
 struct lua_State;
 
+#ifdef LUA_PLUGIN_COUNT_ALLOCATIONS
+#include "L.hpp"
+#endif
+
+#include <cstdint>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
 
 /**
@@ -16,13 +45,235 @@ struct lua_State;
 struct Plugin
 {
 private:
+    // Stack slot that stays fixed for the lifetime of the Lua state.
+    static constexpr int ERROR_HANDLER_INDEX = 1;
+
+    // Enough for any callback's function, `self`, arguments and results.
+    static constexpr int CALL_STACK_RESERVE = 16;
+
+    /**
+     * @brief Lua plugin table and its handlers. Plugins host a single one, unless they have a manifest.
+     */
+    struct PluginModule
+    {
+        std::string name;
+        // Normalized path of the entry point, empty when loaded from a bundle.
+        std::string path;
+        long long priority = 0;
+
+        // Registry references to the plugin table and the module's globals (`LUA_NOREF` for the
+        // shared globals).
+        int table;
+        int env;
+
+        // Registry references to Lua handlers, resolved from the plugin table.
+        int handlers[CALLBACK_COUNT];
+        // Bit set for each callback that has a handler in `handlers`.
+        std::uint32_t handler_mask = 0;
+    };
+
     lua_State *L = nullptr;
     std::string _version;
     std::string _path;
     std::string _name;
     std::string _description;
 
+    Config _config;
+    PoolAllocator _allocator;
+    bool _allocator_in_use = false;
+
+    CallbackStats _stats;
+    bool _stats_enabled = true;
+
+    Watchdog _watchdog;
+    std::uint32_t _watchdog_max_overruns = 0;
+    // Bit set for each callback disabled by the watchdog.
+    std::uint32_t _disabled_mask = 0;
+
+    Scheduler _scheduler;
+    Scheduler::Clock::duration _scheduler_budget{};
+
+    // Lua `timer` library, advanced once per frame.
+    Timers _timers;
+
+    // Collects garbage at the end of frames and between levels.
+    GcPolicy _gc;
+
+    // Per-module memory snapshots taken on level changes.
+    MemoryTracker _memory;
+
+    // JIT settings and trace event reporting.
+    JitDiagnostics _jit;
+
+    // Sampling profiler, tagged with the running callback.
+    Profiler _profiler;
+
+    // Callbacks recorded for replaying them outside of the game.
+    TraceWriter _trace;
+    std::size_t _trace_edict_size = TRACE_DEFAULT_EDICT_SIZE;
+
+    // Edict list of the current level, so traces started mid-level can compute edict indices.
+    const edict_t *_edict_list = nullptr;
+
+    WorkerPool _workers;
+
+    FileIO _files;
+
+    BytecodeCache _bytecode_cache;
+    ModuleBundle _bundle;
+
+    // Modules in call order.
+    std::vector<PluginModule> _modules;
+    bool _use_manifest = false;
+
+    bool _hot_reload = false;
+    FileWatcher _watcher;
+    // Names of loaded modules by normalized file path.
+    std::unordered_map<std::string, std::vector<std::string>> _watched_modules;
+    std::vector<std::string> _changed_files;
+
+    // Lua `print` and `warn`.
+    Console _console;
+
+    CommandRouter _commands;
+
+    // Consulted by `ClientConnect` before Lua.
+    ConnectionFilter _connection_filter;
+
+    // Edict events waiting for `OnEdictBatch`.
+    EdictBatch _edict_batch;
+
+    // Bit set for each callback that has a handler in any module.
+    std::uint32_t _handler_mask = 0;
+
+    // Subscribers called after the modules' handlers.
+    EventBus _events;
+
+#ifdef LUA_PLUGIN_COUNT_ALLOCATIONS
+    L_AllocationCounter _allocation_counter;
+#endif
+
+    bool HasHandler(Callback callback) const
+    {
+        return ((_handler_mask | _events.GetMask()) & ~_disabled_mask & CallbackBit(callback)) != 0;
+    }
+
+    void BindHandler(lua_State *L, int table_index, std::size_t module, Callback callback);
+
+    void BindHandlers(lua_State *L, int table_index, std::size_t module);
+
+    void BindAllHandlers();
+
+    void UpdateHandlerMask();
+
+    void InstallPluginMetatable(int table_index, std::size_t module);
+
+    /**
+     * @brief Loads and runs the entry point of module \p name, leaving its plugin table on the stack.
+     * @param env_index Stack index of the module's globals, 0 for the shared globals.
+     */
+    bool RunEntryPoint(const std::string &name, const std::string &script_path, bool use_bundle, int env_index);
+
+    bool AddModule(const std::string &name, const std::string &script_path, bool use_bundle, long long priority);
+
+    bool CallLoad(std::size_t module, CreateInterfaceFn *interface_factory, CreateInterfaceFn *game_server_factory);
+
+    void ReleaseModule(std::size_t module);
+
+    void ConfigureWatchdog();
+
+    void HandleOverrun(Callback callback, std::uint32_t overruns);
+
+    void CloseLuaState();
+
+    void QueueEdictEvent(EdictEventType type, const edict_t *edict);
+
+    void FlushEdictEvents();
+
+    void TakeMemorySnapshot(const char *kind, const char *map_name);
+
+    /**
+     * @param path Trace file, a new file next to the plugin binary if empty.
+     */
+    bool StartTrace(std::string path, std::string &error);
+
+    void StopTrace();
+
+    template<typename... Args>
+    void Record(Callback callback, const Args &...args)
+    {
+        if (_trace.IsOpen())
+            _trace.Write(callback, args...);
+    }
+
+    void ReloadChangedModules();
+
+    bool ReloadModule(const std::string &name, const std::string &path);
+
+    bool ReloadModuleInto(int loaded_index, int env, const std::string &name, const std::string &path);
+
+    bool ReloadEntryPoint(std::size_t module);
+
+    bool CallReloadHook(int old_index, int new_index);
+
+    /**
+     * @brief Calls the handler of \p module, if it has one.
+     */
+    template<typename... Args>
+    bool TryCallLuaMethod(std::size_t module, Callback callback, int retc, Args&&... args);
+
+    /**
+     * @brief Calls the handlers of all modules in order, then the subscribers.
+     */
+    template<typename... Args>
+    void CallLuaMethods(Callback callback, Args&&... args);
+
+    /**
+     * @brief Calls the subscribers of \p callback in order.
+     * @param retc 1 to collect results like \c CallLuaMethodsForResult, or 0.
+     */
+    template<typename... Args>
+    PluginResult CallSubscribers(Callback callback, int retc, Args&&... args);
+
+    /**
+     * @brief Calls the handlers of all modules in order, then the subscribers, until one returns
+     * \c PluginResult::STOP.
+     * @return The strongest result.
+     */
+    template<typename... Args>
+    PluginResult CallLuaMethodsForResult(Callback callback, Args&&... args);
+
+    /**
+     * @brief Calls a function pushed by \p push, accounted to \p callback.
+     * @param push Pushes the function and its arguments and returns the number of arguments.
+     */
+    template<typename PushFn>
+    bool TryCallLua(Callback callback, int retc, PushFn &&push);
+
+    static int L_PluginNewIndex(lua_State *L);
+
+    static int L_PluginRebind(lua_State *L);
+
+    static int L_PluginWatchLoader(lua_State *L);
+
+    static int L_PluginMemory(lua_State *L);
+
+    static int L_PluginStats(lua_State *L);
+
+    static int L_PrintPluginStats(lua_State *L);
+
+    static int L_RecorderStart(lua_State *L);
+
+    static int L_RecorderStop(lua_State *L);
+
+    static int L_RecorderRecording(lua_State *L);
+
 protected:
+    /**
+     * @brief Prints callback latency stats to the console.
+     */
+    void PrintStats();
+
     template<typename... Args>
     void PluginPrint(const char *format, Args&&... args)
     {
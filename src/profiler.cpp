@@ -0,0 +1,188 @@
+#include "profiler.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <vector>
+
+
+void Profiler::Configure(const std::string &directory, const std::string &name)
+{
+    _directory = directory;
+    _name = name;
+}
+
+void Profiler::Open(lua_State *L)
+{
+    _state = L;
+
+    static const luaL_Reg functions[] = {
+        { "start", &L_Start },
+        { "stop", &L_Stop },
+        { "running", &L_Running },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "profiler", functions, this);
+}
+
+void Profiler::Clear()
+{
+    _state = nullptr;
+    _running = false;
+    _callback = nullptr;
+    _stacks.clear();
+    _samples = 0;
+}
+
+bool Profiler::Start(int interval, int depth, std::string &error)
+{
+    if (_state == nullptr)
+    {
+        error = "no Lua state to profile";
+        return false;
+    }
+
+    if (_running)
+    {
+        error = "the profiler is already running";
+        return false;
+    }
+
+    _depth = std::max(depth, 1);
+    _stacks.clear();
+    _samples = 0;
+
+    // Function granularity. Stacks are dumped as function names without line numbers.
+    std::string mode = "fi" + std::to_string(std::max(interval, 1));
+    luaJIT_profile_start(_state, mode.c_str(), &Sample, this);
+
+    _running = true;
+    return true;
+}
+
+bool Profiler::Stop(std::string &file_path, std::string &error)
+{
+    if (!_running)
+    {
+        error = "the profiler is not running";
+        return false;
+    }
+
+    luaJIT_profile_stop(_state);
+    _running = false;
+
+    char time[32] = "";
+    std::time_t now = std::time(nullptr);
+    if (const std::tm *local = std::localtime(&now))
+        std::strftime(time, sizeof(time), "%Y%m%d-%H%M%S", local);
+
+    file_path = _directory + _name + "-" + time + ".folded";
+
+    // Sorted, so files of different runs can be compared.
+    std::vector<const std::pair<const std::string, std::uint64_t> *> stacks;
+    stacks.reserve(_stacks.size());
+
+    for (const auto &entry : _stacks)
+        stacks.push_back(&entry);
+
+    std::sort(stacks.begin(), stacks.end(), [](const auto *a, const auto *b) {
+        return a->first < b->first;
+    });
+
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    for (const auto *entry : stacks)
+    {
+        if (!file)
+            break;
+
+        file << entry->first << ' ' << entry->second << '\n';
+    }
+
+    _stacks.clear();
+
+    if (!file)
+    {
+        error = "Could not write \"" + file_path + "\".";
+        return false;
+    }
+
+    return true;
+}
+
+void Profiler::Sample(void *data, lua_State *L, int samples, int vmstate)
+{
+    auto *self = static_cast<Profiler *>(data);
+
+    std::size_t length;
+    // Negative depth puts the outermost frame first, like folded stacks want it.
+    const char *stack = luaJIT_profile_dumpstack(L, "FZ;", -self->_depth, &length);
+
+    auto &key = self->_key;
+    key.assign(self->_callback != nullptr ? self->_callback : "[none]");
+
+    if (length != 0)
+        key.append(";").append(stack, length);
+
+    if (vmstate == 'G')
+        key.append(";[GC]");
+    else if (vmstate == 'J')
+        key.append(";[JIT compiler]");
+
+    auto entry = self->_stacks.find(key);
+    if (entry != self->_stacks.end())
+        entry->second += static_cast<std::uint64_t>(samples);
+    else
+        self->_stacks.emplace(key, static_cast<std::uint64_t>(samples));
+
+    self->_samples += static_cast<std::uint64_t>(samples);
+}
+
+int Profiler::L_Start(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Profiler>(L);
+    int interval = static_cast<int>(luaL_optinteger(L, 1, DEFAULT_INTERVAL));
+    int depth = static_cast<int>(luaL_optinteger(L, 2, DEFAULT_DEPTH));
+
+    std::string error;
+    if (!self->Start(interval, depth, error))
+    {
+        lua_pushnil(L);
+        lua_pushlstring(L, error.data(), error.size());
+        return 2;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+int Profiler::L_Stop(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Profiler>(L);
+    auto samples = self->_samples;
+
+    std::string file_path;
+    std::string error;
+    if (!self->Stop(file_path, error))
+    {
+        lua_pushnil(L);
+        lua_pushlstring(L, error.data(), error.size());
+        return 2;
+    }
+
+    lua_pushlstring(L, file_path.data(), file_path.size());
+    lua_pushnumber(L, static_cast<lua_Number>(samples));
+    return 2;
+}
+
+int Profiler::L_Running(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Profiler>(L);
+
+    lua_pushboolean(L, self->_running);
+    return 1;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Sampling profiler on top of LuaJIT's profiler API, writing folded stacks.
+ *
+ * Samples are aggregated by stack as they come in, prefixed with the plugin callback that was
+ * running. Stopping writes one `frame;frame;frame count` line per stack, the input format of
+ * flame graph tools.
+ */
+struct Profiler
+{
+public:
+    static constexpr int DEFAULT_INTERVAL = 1;
+    static constexpr int DEFAULT_DEPTH = 64;
+
+private:
+    // Main state, set while the library is open.
+    lua_State *_state = nullptr;
+    bool _running = false;
+
+    int _depth = DEFAULT_DEPTH;
+    std::string _directory;
+    std::string _name;
+
+    // Name of the callback running right now, `nullptr` outside of callbacks.
+    const char *_callback = nullptr;
+
+    // Sample count by folded stack.
+    std::unordered_map<std::string, std::uint64_t> _stacks;
+    std::uint64_t _samples = 0;
+
+    // Reused for building stack keys.
+    std::string _key;
+
+    static void Sample(void *data, lua_State *L, int samples, int vmstate);
+
+    static int L_Start(lua_State *L);
+
+    static int L_Stop(lua_State *L);
+
+    static int L_Running(lua_State *L);
+
+public:
+    /**
+     * @param directory Directory the output is written to.
+     * @param name Plugin name, output files are named after it.
+     */
+    void Configure(const std::string &directory, const std::string &name);
+
+    /**
+     * @brief Registers the \c profiler library.
+     */
+    void Open(lua_State *L);
+
+    /**
+     * @brief Forgets the state and samples. Only valid after the profiler is stopped and the Lua state is closed.
+     */
+    void Clear();
+
+    bool IsRunning() const
+    {
+        return _running;
+    }
+
+    /**
+     * @brief Sets the callback samples are tagged with.
+     * @return The previous callback, to restore afterwards.
+     */
+    const char *SetCallback(const char *name)
+    {
+        const char *previous = _callback;
+        _callback = name;
+        return previous;
+    }
+
+    /**
+     * @param interval Milliseconds between samples.
+     * @param depth Maximum number of frames per stack.
+     * @return \c false with \p error set if the profiler is already running.
+     */
+    bool Start(int interval, int depth, std::string &error);
+
+    /**
+     * @brief Stops sampling and writes the samples to a new file next to the plugin binary.
+     * @return \c false with \p error set if the profiler isn't running or the file could not be written.
+     */
+    bool Stop(std::string &file_path, std::string &error);
+};
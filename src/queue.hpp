@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+
+/**
+ * @brief Bounded lock-free queue for one producer thread and one consumer thread.
+ * @tparam T Element type, must be default constructible and movable.
+ */
+template<typename T>
+struct SpscQueue
+{
+private:
+    std::unique_ptr<T[]> _items;
+    std::size_t _mask;
+
+    // Kept on separate cache lines so that producer and consumer don't fight over them.
+    alignas(64) std::atomic<std::size_t> _head{ 0 };
+    alignas(64) std::atomic<std::size_t> _tail{ 0 };
+
+public:
+    /**
+     * @param capacity Rounded up to a power of two.
+     */
+    explicit SpscQueue(std::size_t capacity)
+    {
+        std::size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+
+        _items = std::make_unique<T[]>(size);
+        _mask = size - 1;
+    }
+
+    /**
+     * @return \c false if the queue is full, \p item is left untouched in that case.
+     */
+    bool Push(T &item)
+    {
+        auto tail = _tail.load(std::memory_order_relaxed);
+
+        if (tail - _head.load(std::memory_order_acquire) > _mask)
+            return false;
+
+        _items[tail & _mask] = std::move(item);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @return \c false if the queue is empty.
+     */
+    bool Pop(T &item)
+    {
+        auto head = _head.load(std::memory_order_relaxed);
+
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(_items[head & _mask]);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool IsEmpty() const
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+};
+
+
+/**
+ * @brief Bounded lock-free queue for any number of producer threads and one consumer thread.
+ *
+ * Each slot carries a sequence number that tells whether it is ready to be written or read.
+ *
+ * @tparam T Element type, must be default constructible and movable.
+ */
+template<typename T>
+struct MpscQueue
+{
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    std::size_t _mask;
+
+    alignas(64) std::atomic<std::size_t> _tail{ 0 };
+    alignas(64) std::size_t _head = 0;
+
+public:
+    /**
+     * @param capacity Rounded up to a power of two.
+     */
+    explicit MpscQueue(std::size_t capacity)
+    {
+        std::size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+
+        _slots = std::make_unique<Slot[]>(size);
+        _mask = size - 1;
+
+        for (std::size_t i = 0; i < size; i++)
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return \c false if the queue is full, \p item is left untouched in that case.
+     */
+    bool Push(T &item)
+    {
+        auto tail = _tail.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            Slot &slot = _slots[tail & _mask];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(tail);
+
+            if (difference == 0)
+            {
+                // Slot is free, try to claim it.
+                if (_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+                {
+                    slot.item = std::move(item);
+                    slot.sequence.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                // Slot still holds an item from the previous lap.
+                return false;
+            }
+            else
+            {
+                // Another producer claimed it.
+                tail = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Must only be called from the consumer thread.
+     * @return \c false if the queue is empty.
+     */
+    bool Pop(T &item)
+    {
+        Slot &slot = _slots[_head & _mask];
+
+        if (slot.sequence.load(std::memory_order_acquire) != _head + 1)
+            return false;
+
+        item = std::move(slot.item);
+        slot.sequence.store(_head + _mask + 1, std::memory_order_release);
+        _head++;
+        return true;
+    }
+};
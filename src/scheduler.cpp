@@ -0,0 +1,262 @@
+#include "scheduler.hpp"
+
+#include "engine.hpp"
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+
+
+// Yielded as the first value to tell the scheduler how long to wait. Plain
+// `coroutine.yield` calls without these wait for the next tick.
+static const char WAIT_TICKS = 0;
+static const char WAIT_TIME = 0;
+
+
+static double ToSeconds(Scheduler::Clock::time_point time)
+{
+    return std::chrono::duration<double>(time.time_since_epoch()).count();
+}
+
+static Scheduler::Clock::time_point FromSeconds(double seconds)
+{
+    auto duration = std::chrono::duration<double>(seconds);
+    return Scheduler::Clock::time_point(std::chrono::duration_cast<Scheduler::Clock::duration>(duration));
+}
+
+
+void Scheduler::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "spawn", &L_Spawn },
+        { "wait", &L_Wait },
+        { "sleep", &L_Sleep },
+        { "wait_until", &L_WaitUntil },
+        { "clock", &L_Clock },
+        { "cancel", &L_Cancel },
+        { "running", &L_Running },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "task", functions, this);
+}
+
+void Scheduler::Clear()
+{
+    // References died with the state.
+    _tasks.clear();
+    _next = 0;
+    _running = 0;
+}
+
+Scheduler::Task *Scheduler::FindTask(std::uint32_t id)
+{
+    for (auto &task : _tasks)
+    {
+        if (task.id == id)
+            return &task;
+    }
+
+    return nullptr;
+}
+
+bool Scheduler::Resume(lua_State *L, std::size_t index)
+{
+    lua_State *thread = _tasks[index].thread;
+
+    _running = _tasks[index].id;
+    int status;
+    {
+        L_LimitScope limit(L);
+        status = lua_resume(thread, _tasks[index].argc);
+    }
+    _running = 0;
+
+    // Tasks spawned during resume may have reallocated the vector.
+    Task &task = _tasks[index];
+
+    if (status == LUA_YIELD)
+    {
+        int count = lua_gettop(thread);
+
+        task.wake_tick = _tick + 1;
+        task.wake_time = {};
+
+        if (count >= 2 && lua_touserdata(thread, 1) == &WAIT_TICKS)
+        {
+            task.wake_tick = _tick + std::max<lua_Integer>(lua_tointeger(thread, 2), 1);
+        }
+        else if (count >= 2 && lua_touserdata(thread, 1) == &WAIT_TIME)
+        {
+            task.wake_time = FromSeconds(lua_tonumber(thread, 2));
+        }
+
+        // Nothing is passed back into the coroutine.
+        lua_settop(thread, 0);
+        task.argc = 0;
+
+        return true;
+    }
+
+    if (status != LUA_OK)
+    {
+        L_StringifyStack(thread, 1);
+        luaL_traceback(L, thread, lua_tostring(thread, -1), 0);
+        Warn("%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    // Finished or failed.
+    return false;
+}
+
+void Scheduler::Run(lua_State *L, Clock::duration budget, const Watchdog &watchdog)
+{
+    _tick++;
+
+    if (_tasks.empty())
+        return;
+
+    auto start = Clock::now();
+    auto now = start;
+
+    // Only tasks that existed before this tick run during it.
+    std::size_t count = _tasks.size();
+
+    for (std::size_t i = 0; i < count && now - start < budget && !watchdog.IsTripped(); i++)
+    {
+        if (_next >= count)
+            _next = 0;
+
+        std::size_t index = _next++;
+
+        if (_tasks[index].cancelled)
+            continue;
+
+        if (_tasks[index].wake_tick > _tick || _tasks[index].wake_time > now)
+            continue;
+
+        if (!Resume(L, index))
+            _tasks[index].cancelled = true;
+
+        now = Clock::now();
+    }
+
+    // Remove finished tasks while keeping the round-robin order.
+    std::size_t removed_before_next = 0;
+    for (std::size_t i = 0; i < _next && i < _tasks.size(); i++)
+    {
+        if (_tasks[i].cancelled)
+            removed_before_next++;
+    }
+
+    auto end = std::remove_if(_tasks.begin(), _tasks.end(), [&](const Task &task) {
+        if (task.cancelled)
+            luaL_unref(L, LUA_REGISTRYINDEX, task.thread_ref);
+
+        return task.cancelled;
+    });
+
+    _tasks.erase(end, _tasks.end());
+    _next -= removed_before_next;
+}
+
+int Scheduler::L_Spawn(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Scheduler>(L);
+
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    int argc = lua_gettop(L) - 1;
+
+    lua_State *thread = lua_newthread(L);
+    int thread_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    // Move the function and its arguments to the new thread.
+    lua_xmove(L, thread, argc + 1);
+
+    Task task{};
+    task.id = self->_next_id++;
+    task.thread_ref = thread_ref;
+    task.thread = thread;
+    task.argc = argc;
+    task.wake_tick = 0;
+    task.cancelled = false;
+
+    self->_tasks.push_back(task);
+
+    lua_pushinteger(L, task.id);
+    return 1;
+}
+
+int Scheduler::L_Wait(lua_State *L)
+{
+    lua_Integer ticks = luaL_optinteger(L, 1, 1);
+
+    if (lua_pushthread(L))
+        return luaL_error(L, "attempt to wait outside of a task");
+
+    lua_settop(L, 0);
+    lua_pushlightuserdata(L, const_cast<char *>(&WAIT_TICKS));
+    lua_pushinteger(L, ticks);
+    return lua_yield(L, 2);
+}
+
+int Scheduler::L_Sleep(lua_State *L)
+{
+    double seconds = luaL_checknumber(L, 1);
+
+    if (lua_pushthread(L))
+        return luaL_error(L, "attempt to sleep outside of a task");
+
+    lua_settop(L, 0);
+    lua_pushlightuserdata(L, const_cast<char *>(&WAIT_TIME));
+    lua_pushnumber(L, ToSeconds(Clock::now()) + seconds);
+    return lua_yield(L, 2);
+}
+
+int Scheduler::L_WaitUntil(lua_State *L)
+{
+    double time = luaL_checknumber(L, 1);
+
+    if (lua_pushthread(L))
+        return luaL_error(L, "attempt to wait outside of a task");
+
+    lua_settop(L, 0);
+    lua_pushlightuserdata(L, const_cast<char *>(&WAIT_TIME));
+    lua_pushnumber(L, time);
+    return lua_yield(L, 2);
+}
+
+int Scheduler::L_Clock(lua_State *L)
+{
+    lua_pushnumber(L, ToSeconds(Clock::now()));
+    return 1;
+}
+
+int Scheduler::L_Cancel(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Scheduler>(L);
+    auto id = static_cast<std::uint32_t>(luaL_checkinteger(L, 1));
+
+    Task *task = self->FindTask(id);
+    bool found = task != nullptr && !task->cancelled;
+
+    // A running task is removed once it yields.
+    if (found)
+        task->cancelled = true;
+
+    lua_pushboolean(L, found);
+    return 1;
+}
+
+int Scheduler::L_Running(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Scheduler>(L);
+
+    if (self->_running == 0)
+        return 0;
+
+    lua_pushinteger(L, self->_running);
+    return 1;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "watchdog.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Runs Lua coroutines spawned with \c task.spawn a little at a time on each game frame.
+ */
+struct Scheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    struct Task
+    {
+        std::uint32_t id;
+        int thread_ref;
+        lua_State *thread;
+        // Number of values on the thread's stack to pass to the next resume.
+        int argc;
+        std::uint64_t wake_tick;
+        Clock::time_point wake_time;
+        bool cancelled;
+    };
+
+    std::vector<Task> _tasks;
+    std::size_t _next = 0;
+    std::uint32_t _next_id = 1;
+    std::uint64_t _tick = 0;
+
+    // ID of the task currently being resumed, 0 if none.
+    std::uint32_t _running = 0;
+
+    /**
+     * @return \c false if the task finished or failed.
+     */
+    bool Resume(lua_State *L, std::size_t index);
+
+    Task *FindTask(std::uint32_t id);
+
+    static int L_Spawn(lua_State *L);
+
+    static int L_Wait(lua_State *L);
+
+    static int L_Sleep(lua_State *L);
+
+    static int L_WaitUntil(lua_State *L);
+
+    static int L_Clock(lua_State *L);
+
+    static int L_Cancel(lua_State *L);
+
+    static int L_Running(lua_State *L);
+
+public:
+    /**
+     * @brief Registers the \c task library.
+     */
+    void Open(lua_State *L);
+
+    /**
+     * @brief Forgets all tasks. Call when closing the Lua state.
+     */
+    void Clear();
+
+    /**
+     * @brief Advances to the next tick and resumes ready tasks round-robin until \p budget runs out.
+     *
+     * Also stops once \p watchdog has aborted a task.
+     */
+    void Run(lua_State *L, Clock::duration budget, const Watchdog &watchdog);
+
+    std::size_t GetTaskCount() const
+    {
+        return _tasks.size();
+    }
+};
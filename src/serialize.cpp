@@ -0,0 +1,208 @@
+#include "serialize.hpp"
+
+#include <lua.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+
+// Tags that precede each serialized value.
+enum Tag : char
+{
+    TAG_NIL = 'n',
+    TAG_FALSE = 'f',
+    TAG_TRUE = 't',
+    TAG_NUMBER = 'd',
+    TAG_STRING = 's',
+    TAG_TABLE = 'T',
+    TAG_TABLE_END = 'E',
+};
+
+static constexpr int MAX_DEPTH = 64;
+
+
+template<typename T>
+static void Append(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static bool SerializeValue(lua_State *L, int index, int depth, std::string &out, std::string &error)
+{
+    switch (lua_type(L, index))
+    {
+    case LUA_TNIL:
+        out.push_back(TAG_NIL);
+        return true;
+
+    case LUA_TBOOLEAN:
+        out.push_back(lua_toboolean(L, index) ? TAG_TRUE : TAG_FALSE);
+        return true;
+
+    case LUA_TNUMBER:
+        out.push_back(TAG_NUMBER);
+        Append(out, lua_tonumber(L, index));
+        return true;
+
+    case LUA_TSTRING:
+    {
+        size_t length;
+        const char *string = lua_tolstring(L, index, &length);
+
+        out.push_back(TAG_STRING);
+        Append(out, static_cast<std::uint32_t>(length));
+        out.append(string, length);
+        return true;
+    }
+
+    case LUA_TTABLE:
+    {
+        if (depth >= MAX_DEPTH)
+        {
+            error = "table nesting is too deep (or cyclic)";
+            return false;
+        }
+
+        if (!lua_checkstack(L, 2))
+        {
+            error = "stack overflow";
+            return false;
+        }
+
+        out.push_back(TAG_TABLE);
+
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0)
+        {
+            int top = lua_gettop(L);
+
+            if (!SerializeValue(L, top - 1, depth + 1, out, error)
+                || !SerializeValue(L, top, depth + 1, out, error))
+            {
+                lua_pop(L, 2);
+                return false;
+            }
+
+            lua_pop(L, 1);
+        }
+
+        out.push_back(TAG_TABLE_END);
+        return true;
+    }
+
+    default:
+        error = "cannot send a ";
+        error.append(luaL_typename(L, index));
+        error.append(" value");
+        return false;
+    }
+}
+
+bool L_Serialize(lua_State *L, int first, int count, std::string &out, std::string &error)
+{
+    if (first < 0)
+        first = lua_gettop(L) + first + 1;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!SerializeValue(L, first + i, 0, out, error))
+            return false;
+    }
+
+    return true;
+}
+
+
+struct Reader
+{
+    std::string_view data;
+    std::size_t position = 0;
+
+    bool AtEnd() const
+    {
+        return position >= data.size();
+    }
+
+    char Peek() const
+    {
+        return data[position];
+    }
+
+    char Next()
+    {
+        return data[position++];
+    }
+
+    template<typename T>
+    T Read()
+    {
+        T value;
+        std::memcpy(&value, data.data() + position, sizeof(value));
+        position += sizeof(value);
+        return value;
+    }
+};
+
+static void DeserializeValue(lua_State *L, Reader &reader)
+{
+    switch (reader.Next())
+    {
+    case TAG_FALSE:
+        lua_pushboolean(L, 0);
+        break;
+
+    case TAG_TRUE:
+        lua_pushboolean(L, 1);
+        break;
+
+    case TAG_NUMBER:
+        lua_pushnumber(L, reader.Read<lua_Number>());
+        break;
+
+    case TAG_STRING:
+    {
+        auto length = reader.Read<std::uint32_t>();
+        lua_pushlstring(L, reader.data.data() + reader.position, length);
+        reader.position += length;
+        break;
+    }
+
+    case TAG_TABLE:
+        lua_checkstack(L, 3);
+        lua_newtable(L);
+
+        while (reader.Peek() != TAG_TABLE_END)
+        {
+            DeserializeValue(L, reader);
+            DeserializeValue(L, reader);
+
+            // Serialized tables never have nil keys, but be safe.
+            if (lua_isnil(L, -2))
+                lua_pop(L, 2);
+            else
+                lua_rawset(L, -3);
+        }
+
+        reader.Next();
+        break;
+
+    default:
+        lua_pushnil(L);
+        break;
+    }
+}
+
+int L_Deserialize(lua_State *L, std::string_view data)
+{
+    Reader reader{ data };
+    int count = 0;
+
+    while (!reader.AtEnd())
+    {
+        lua_checkstack(L, 1);
+        DeserializeValue(L, reader);
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Appends values from the stack to \p out in a form that can be pushed into another state.
+ *
+ * Supports nil, booleans, numbers, strings and tables of those. Does not raise Lua errors, so it
+ * is safe to call outside of a protected call.
+ *
+ * @param first Index of the first value.
+ * @param count Number of values.
+ * @param error Set to the reason of failure.
+ * @return \c false if a value could not be serialized.
+ */
+bool L_Serialize(lua_State *L, int first, int count, std::string &out, std::string &error);
+
+/**
+ * @brief Pushes values serialized by \c L_Serialize.
+ * @return Number of pushed values.
+ */
+int L_Deserialize(lua_State *L, std::string_view data);
@@ -0,0 +1,85 @@
+#include "stats.hpp"
+
+#include <algorithm>
+
+
+static int HighestBit(std::uint64_t value)
+{
+    int bit = 0;
+
+    for (int shift : { 32, 16, 8, 4, 2, 1 })
+    {
+        if (value >= std::uint64_t{ 1 } << shift)
+        {
+            value >>= shift;
+            bit += shift;
+        }
+    }
+
+    return bit;
+}
+
+
+int LatencyHistogram::BucketIndex(std::uint64_t value)
+{
+    value = std::min(value, (std::uint64_t{ 1 } << MAX_BITS) - 1);
+
+    // Small values get a bucket each.
+    if (value < SUB_BUCKET_COUNT)
+        return static_cast<int>(value);
+
+    int shift = HighestBit(value) - SUB_BUCKET_BITS;
+    int sub_bucket = static_cast<int>(value >> shift) - SUB_BUCKET_COUNT;
+
+    return (shift + 1) * SUB_BUCKET_COUNT + sub_bucket;
+}
+
+std::uint64_t LatencyHistogram::BucketUpperBound(int index)
+{
+    if (index < SUB_BUCKET_COUNT)
+        return static_cast<std::uint64_t>(index);
+
+    int shift = index / SUB_BUCKET_COUNT - 1;
+    std::uint64_t sub_bucket = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(std::uint64_t value)
+{
+    _buckets[BucketIndex(value)]++;
+    _count++;
+    _total += value;
+    _max = std::max(_max, value);
+}
+
+void LatencyHistogram::Reset()
+{
+    *this = {};
+}
+
+std::uint64_t LatencyHistogram::GetPercentile(double quantile) const
+{
+    if (_count == 0)
+        return 0;
+
+    auto target = static_cast<std::uint64_t>(quantile * _count);
+    target = std::clamp<std::uint64_t>(target, 1, _count);
+
+    std::uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += _buckets[i];
+        if (seen >= target)
+            return std::min(BucketUpperBound(i), _max);
+    }
+
+    return _max;
+}
+
+
+void CallbackStats::Reset()
+{
+    for (auto &histogram : _histograms)
+        histogram.Reset();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "callback.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @brief Histogram of durations in nanoseconds with fixed, log-linear buckets.
+ *
+ * Each power of two is split into \c SUB_BUCKET_COUNT linear buckets, so recorded values are
+ * accurate to about 6%. Recording never allocates.
+ */
+struct LatencyHistogram
+{
+public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+
+    // Durations are clamped to 2^MAX_BITS - 1 nanoseconds (over 18 minutes).
+    static constexpr int MAX_BITS = 40;
+    static constexpr int BUCKET_COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+private:
+    std::uint32_t _buckets[BUCKET_COUNT] = {};
+    std::uint64_t _count = 0;
+    std::uint64_t _total = 0;
+    std::uint64_t _max = 0;
+
+    static int BucketIndex(std::uint64_t value);
+
+    static std::uint64_t BucketUpperBound(int index);
+
+public:
+    void Record(std::uint64_t value);
+
+    void Reset();
+
+    std::uint64_t GetCount() const
+    {
+        return _count;
+    }
+
+    std::uint64_t GetMax() const
+    {
+        return _max;
+    }
+
+    double GetMean() const
+    {
+        return _count != 0 ? static_cast<double>(_total) / _count : 0.0;
+    }
+
+    /**
+     * @brief Gets the value below which \p quantile of recorded values fall.
+     * @param quantile Number between 0 and 1.
+     */
+    std::uint64_t GetPercentile(double quantile) const;
+};
+
+
+/**
+ * @brief Latency histograms for all plugin callbacks.
+ */
+struct CallbackStats
+{
+private:
+    LatencyHistogram _histograms[CALLBACK_COUNT];
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void Record(Callback callback, Clock::duration duration)
+    {
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        _histograms[CallbackIndex(callback)].Record(static_cast<std::uint64_t>(nanoseconds));
+    }
+
+    const LatencyHistogram &Get(Callback callback) const
+    {
+        return _histograms[CallbackIndex(callback)];
+    }
+
+    void Reset();
+};
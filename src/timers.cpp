@@ -0,0 +1,400 @@
+#include "timers.hpp"
+
+#include "L.hpp"
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+
+//============================== Timing Wheel =================================#
+
+TimerWheel::TimerWheel()
+{
+    Reset(0);
+}
+
+void TimerWheel::Reserve(std::size_t count)
+{
+    if (count > _nodes.size())
+        _nodes.resize(count, Node{ 0, NONE, NONE, NONE });
+}
+
+void TimerWheel::Reset(std::uint64_t now)
+{
+    _nodes.clear();
+    std::fill(std::begin(_heads), std::end(_heads), NONE);
+    std::fill(std::begin(_tails), std::end(_tails), NONE);
+    _now = now;
+    _count = 0;
+}
+
+void TimerWheel::Link(std::uint32_t node, std::uint32_t slot)
+{
+    auto &entry = _nodes[node];
+
+    // Appended, so nodes expiring on the same step keep their order.
+    entry.slot = slot;
+    entry.next = NONE;
+    entry.prev = _tails[slot];
+
+    if (entry.prev != NONE)
+        _nodes[entry.prev].next = node;
+    else
+        _heads[slot] = node;
+
+    _tails[slot] = node;
+    _count++;
+}
+
+void TimerWheel::Schedule(std::uint32_t node, std::uint64_t expires)
+{
+    Unschedule(node);
+
+    _nodes[node].expires = expires;
+
+    std::uint64_t target = std::max(expires, _now + 1);
+    std::uint64_t delta = target - _now;
+
+    // Too far away, placed again when the last level comes up.
+    if (delta >= RANGE)
+    {
+        target = _now + RANGE - 1;
+        delta = RANGE - 1;
+    }
+
+    if (delta < ROOT_SIZE)
+    {
+        Link(node, static_cast<std::uint32_t>(target & (ROOT_SIZE - 1)));
+        return;
+    }
+
+    int level = 1;
+    while (level < LEVELS - 1 && delta >= (std::uint64_t{ 1 } << (GetShift(level) + LEVEL_BITS)))
+        level++;
+
+    auto index = (target >> GetShift(level)) & (LEVEL_SIZE - 1);
+    Link(node, static_cast<std::uint32_t>(ROOT_SIZE + (level - 1) * LEVEL_SIZE + index));
+}
+
+void TimerWheel::Unschedule(std::uint32_t node)
+{
+    if (!IsScheduled(node))
+        return;
+
+    auto &entry = _nodes[node];
+
+    if (entry.prev != NONE)
+        _nodes[entry.prev].next = entry.next;
+    else
+        _heads[entry.slot] = entry.next;
+
+    if (entry.next != NONE)
+        _nodes[entry.next].prev = entry.prev;
+    else
+        _tails[entry.slot] = entry.prev;
+
+    entry.slot = NONE;
+    _count--;
+}
+
+void TimerWheel::Cascade(int level, std::uint64_t index)
+{
+    auto slot = static_cast<std::uint32_t>(ROOT_SIZE + (level - 1) * LEVEL_SIZE + index);
+
+    std::uint32_t node = _heads[slot];
+    _heads[slot] = NONE;
+    _tails[slot] = NONE;
+
+    while (node != NONE)
+    {
+        std::uint32_t next = _nodes[node].next;
+
+        _nodes[node].slot = NONE;
+        _count--;
+
+        // Due now, the root slot for this step is emptied right after.
+        if (_nodes[node].expires <= _now)
+            Link(node, static_cast<std::uint32_t>(_now & (ROOT_SIZE - 1)));
+        else
+            Schedule(node, _nodes[node].expires);
+
+        node = next;
+    }
+}
+
+void TimerWheel::Advance(std::uint64_t now, std::vector<std::uint32_t> &expired)
+{
+    while (_now < now)
+    {
+        // Nothing to step through.
+        if (_count == 0)
+        {
+            _now = now;
+            return;
+        }
+
+        _now++;
+
+        // Move nodes down from each level whose slot comes up, highest level first.
+        if ((_now & (ROOT_SIZE - 1)) == 0)
+        {
+            int level = 1;
+            while (level < LEVELS - 1 && ((_now >> GetShift(level)) & (LEVEL_SIZE - 1)) == 0)
+                level++;
+
+            for (; level >= 1; level--)
+                Cascade(level, (_now >> GetShift(level)) & (LEVEL_SIZE - 1));
+        }
+
+        auto slot = static_cast<std::uint32_t>(_now & (ROOT_SIZE - 1));
+
+        std::uint32_t node = _heads[slot];
+        _heads[slot] = NONE;
+        _tails[slot] = NONE;
+
+        while (node != NONE)
+        {
+            std::uint32_t next = _nodes[node].next;
+
+            _nodes[node].slot = NONE;
+            _count--;
+
+            expired.push_back(node);
+            node = next;
+        }
+    }
+}
+
+
+//============================== Timers =======================================#
+
+Timers::Timers()
+    : _start{ Clock::now() }
+{
+}
+
+std::uint64_t Timers::GetRealtimeNow() const
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - _start);
+    return static_cast<std::uint64_t>(elapsed.count());
+}
+
+std::uint32_t Timers::Allocate()
+{
+    std::uint32_t index;
+
+    if (!_free.empty())
+    {
+        index = _free.back();
+        _free.pop_back();
+    }
+    else
+    {
+        if (_timers.size() >= INDEX_LIMIT)
+            return TimerWheel::NONE;
+
+        index = static_cast<std::uint32_t>(_timers.size());
+        _timers.push_back({ LUA_NOREF, 0, 1, false });
+
+        _ticks.Reserve(_timers.size());
+        _realtime.Reserve(_timers.size());
+    }
+
+    _count++;
+    return index;
+}
+
+void Timers::Free(lua_State *L, std::uint32_t index)
+{
+    auto &timer = _timers[index];
+
+    (timer.realtime ? _realtime : _ticks).Unschedule(index);
+
+    luaL_unref(L, LUA_REGISTRYINDEX, timer.function);
+    timer.function = LUA_NOREF;
+
+    // Generations wrap before handles stop being exact.
+    timer.generation = timer.generation < (std::uint32_t{ 1 } << 28) ? timer.generation + 1 : 1;
+
+    _free.push_back(index);
+    _count--;
+}
+
+bool Timers::Cancel(lua_State *L, double handle)
+{
+    if (!(handle >= 0.0) || handle != std::floor(handle))
+        return false;
+
+    auto value = static_cast<std::uint64_t>(handle);
+    auto index = static_cast<std::uint32_t>(value % INDEX_LIMIT);
+    auto generation = static_cast<std::uint32_t>(value / INDEX_LIMIT);
+
+    if (index >= _timers.size() || _timers[index].function == LUA_NOREF || _timers[index].generation != generation)
+        return false;
+
+    Free(L, index);
+    return true;
+}
+
+void Timers::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "after", &L_After },
+        { "every", &L_Every },
+        { "after_seconds", &L_AfterSeconds },
+        { "every_seconds", &L_EverySeconds },
+        { "cancel", &L_Cancel },
+        { "count", &L_Count },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "timer", functions, this);
+}
+
+void Timers::Clear()
+{
+    // References died with the state.
+    _timers.clear();
+    _free.clear();
+    _count = 0;
+
+    _ticks.Reset(0);
+    _realtime.Reset(0);
+    _start = Clock::now();
+}
+
+void Timers::Run(lua_State *L, int error_handler_index, const Watchdog &watchdog)
+{
+    _expired_nodes.clear();
+
+    _ticks.Advance(_ticks.GetNow() + 1, _expired_nodes);
+    _realtime.Advance(GetRealtimeNow(), _expired_nodes);
+
+    if (_expired_nodes.empty())
+        return;
+
+    // Callbacks may cancel timers that expired in the same pass.
+    _expired.clear();
+    for (auto index : _expired_nodes)
+        _expired.push_back({ index, _timers[index].generation });
+
+    for (const auto &expired : _expired)
+    {
+        // Callbacks may create timers, which can move the pool.
+        auto &timer = _timers[expired.index];
+
+        if (timer.function == LUA_NOREF || timer.generation != expired.generation)
+            continue;
+
+        // Out of time, the rest expires again on the next step.
+        if (watchdog.IsTripped())
+        {
+            auto &wheel = timer.realtime ? _realtime : _ticks;
+            wheel.Schedule(expired.index, wheel.GetExpires(expired.index));
+            continue;
+        }
+
+        double handle = static_cast<double>(timer.generation) * INDEX_LIMIT + expired.index;
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, timer.function);
+
+        if (timer.interval != 0)
+        {
+            // Repeats keep their cadence, but skip whole intervals that passed during a hitch
+            // instead of firing once for each of them.
+            auto &wheel = timer.realtime ? _realtime : _ticks;
+            auto expires = wheel.GetExpires(expired.index);
+            auto now = wheel.GetNow();
+            auto missed = now > expires ? (now - expires) / timer.interval : 0;
+            wheel.Schedule(expired.index, expires + (missed + 1) * timer.interval);
+        }
+        else
+        {
+            // The function stays alive on the stack.
+            Free(L, expired.index);
+        }
+
+        lua_pushnumber(L, handle);
+
+        L_TryCall(L, 1, 0, error_handler_index);
+    }
+}
+
+int Timers::Create(lua_State *L, bool realtime, bool repeat)
+{
+    auto *self = L_ToUpvalue<Timers>(L);
+
+    std::uint64_t delay;
+    if (realtime)
+    {
+        double seconds = luaL_checknumber(L, 1);
+        delay = seconds > 0.0 ? static_cast<std::uint64_t>(std::ceil(seconds * 1000.0)) : 0;
+    }
+    else
+    {
+        lua_Integer ticks = luaL_checkinteger(L, 1);
+        delay = ticks > 0 ? static_cast<std::uint64_t>(ticks) : 0;
+    }
+
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    // Nothing fires more than once per tick.
+    delay = std::max<std::uint64_t>(delay, 1);
+
+    std::uint32_t index = self->Allocate();
+    if (index == TimerWheel::NONE)
+        return luaL_error(L, "too many timers");
+
+    auto &timer = self->_timers[index];
+
+    lua_pushvalue(L, 2);
+    timer.function = luaL_ref(L, LUA_REGISTRYINDEX);
+    timer.interval = repeat ? delay : 0;
+    timer.realtime = realtime;
+
+    if (realtime)
+        self->_realtime.Schedule(index, self->GetRealtimeNow() + delay);
+    else
+        self->_ticks.Schedule(index, self->_ticks.GetNow() + delay);
+
+    lua_pushnumber(L, static_cast<double>(timer.generation) * INDEX_LIMIT + index);
+    return 1;
+}
+
+int Timers::L_After(lua_State *L)
+{
+    return Create(L, false, false);
+}
+
+int Timers::L_Every(lua_State *L)
+{
+    return Create(L, false, true);
+}
+
+int Timers::L_AfterSeconds(lua_State *L)
+{
+    return Create(L, true, false);
+}
+
+int Timers::L_EverySeconds(lua_State *L)
+{
+    return Create(L, true, true);
+}
+
+int Timers::L_Cancel(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Timers>(L);
+
+    lua_pushboolean(L, self->Cancel(L, luaL_checknumber(L, 1)));
+    return 1;
+}
+
+int Timers::L_Count(lua_State *L)
+{
+    auto *self = L_ToUpvalue<Timers>(L);
+
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_count));
+    return 1;
+}
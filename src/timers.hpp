@@ -0,0 +1,200 @@
+#pragma once
+
+#include "watchdog.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// #include <lua.hpp>
+struct lua_State;
+
+
+/**
+ * @brief Hierarchical timing wheel of nodes identified by index.
+ *
+ * The first level has a slot for each of the next 256 steps, each further level has 64 slots
+ * covering 64 times the range of the level below. Scheduling and unscheduling are O(1), nodes
+ * move down one level at a time as their slot comes up. Nodes further away than the wheel covers
+ * wait in the last level and are placed again when it comes up.
+ */
+struct TimerWheel
+{
+public:
+    static constexpr std::uint32_t NONE = 0xffffffff;
+
+private:
+    static constexpr int ROOT_BITS = 8;
+    static constexpr int LEVEL_BITS = 6;
+    static constexpr int LEVELS = 4;
+
+    static constexpr std::uint64_t ROOT_SIZE = std::uint64_t{ 1 } << ROOT_BITS;
+    static constexpr std::uint64_t LEVEL_SIZE = std::uint64_t{ 1 } << LEVEL_BITS;
+    static constexpr std::size_t SLOT_COUNT = ROOT_SIZE + (LEVELS - 1) * LEVEL_SIZE;
+
+    // Steps covered by the whole wheel.
+    static constexpr std::uint64_t RANGE = std::uint64_t{ 1 } << (ROOT_BITS + (LEVELS - 1) * LEVEL_BITS);
+
+    struct Node
+    {
+        std::uint64_t expires;
+        std::uint32_t prev;
+        std::uint32_t next;
+        // Slot the node is linked into, `NONE` if it isn't scheduled.
+        std::uint32_t slot;
+    };
+
+    std::vector<Node> _nodes;
+    std::uint32_t _heads[SLOT_COUNT];
+    std::uint32_t _tails[SLOT_COUNT];
+    std::uint64_t _now = 0;
+    std::size_t _count = 0;
+
+    static int GetShift(int level)
+    {
+        return ROOT_BITS + (level - 1) * LEVEL_BITS;
+    }
+
+    void Link(std::uint32_t node, std::uint32_t slot);
+
+    void Cascade(int level, std::uint64_t index);
+
+public:
+    TimerWheel();
+
+    /**
+     * @brief Makes room for nodes with indices below \p count.
+     */
+    void Reserve(std::size_t count);
+
+    /**
+     * @brief Forgets all nodes and restarts at step \p now.
+     */
+    void Reset(std::uint64_t now);
+
+    std::uint64_t GetNow() const
+    {
+        return _now;
+    }
+
+    bool IsScheduled(std::uint32_t node) const
+    {
+        return node < _nodes.size() && _nodes[node].slot != NONE;
+    }
+
+    /**
+     * @brief Step \p node was last scheduled for, which stays valid after it expired.
+     */
+    std::uint64_t GetExpires(std::uint32_t node) const
+    {
+        return _nodes[node].expires;
+    }
+
+    /**
+     * @brief Schedules \p node to expire at step \p expires, or the next step if that has passed.
+     */
+    void Schedule(std::uint32_t node, std::uint64_t expires);
+
+    void Unschedule(std::uint32_t node);
+
+    /**
+     * @brief Steps up to \p now, appending nodes that expire on the way to \p expired in expiry order.
+     */
+    void Advance(std::uint64_t now, std::vector<std::uint32_t> &expired);
+};
+
+
+/**
+ * @brief Lua timers that run a function after a delay or repeatedly, in game ticks or seconds.
+ *
+ * Timers live in a pool that is reused, so creating, firing and cancelling them creates no
+ * garbage beyond the function itself.
+ */
+struct Timers
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    // Handles are `generation * INDEX_LIMIT + index`, so they stay exact as Lua numbers.
+    static constexpr std::uint32_t INDEX_LIMIT = std::uint32_t{ 1 } << 24;
+
+    struct Timer
+    {
+        // Registry reference to the function, `LUA_NOREF` for free entries.
+        int function;
+        // Steps between repeats, 0 for one-shot timers.
+        std::uint64_t interval;
+        // Changes when the entry is freed, so stale handles don't match.
+        std::uint32_t generation;
+        // Whether the timer counts milliseconds instead of ticks.
+        bool realtime;
+    };
+
+    struct Expired
+    {
+        std::uint32_t index;
+        std::uint32_t generation;
+    };
+
+    std::vector<Timer> _timers;
+    std::vector<std::uint32_t> _free;
+    std::size_t _count = 0;
+
+    TimerWheel _ticks;
+    // Steps are milliseconds since `_start`.
+    TimerWheel _realtime;
+    Clock::time_point _start;
+
+    // Reused by each run.
+    std::vector<std::uint32_t> _expired_nodes;
+    std::vector<Expired> _expired;
+
+    std::uint64_t GetRealtimeNow() const;
+
+    std::uint32_t Allocate();
+
+    void Free(lua_State *L, std::uint32_t index);
+
+    bool Cancel(lua_State *L, double handle);
+
+    static int Create(lua_State *L, bool realtime, bool repeat);
+
+    static int L_After(lua_State *L);
+
+    static int L_Every(lua_State *L);
+
+    static int L_AfterSeconds(lua_State *L);
+
+    static int L_EverySeconds(lua_State *L);
+
+    static int L_Cancel(lua_State *L);
+
+    static int L_Count(lua_State *L);
+
+public:
+    Timers();
+
+    /**
+     * @brief Registers the \c timer library.
+     */
+    void Open(lua_State *L);
+
+    /**
+     * @brief Forgets all timers. Call when closing the Lua state.
+     */
+    void Clear();
+
+    /**
+     * @brief Advances by one tick and calls the functions of all timers that expired, in one pass.
+     *
+     * Once \p watchdog has aborted a function, the remaining ones are left for the next tick.
+     */
+    void Run(lua_State *L, int error_handler_index, const Watchdog &watchdog);
+
+    std::size_t GetTimerCount() const
+    {
+        return _count;
+    }
+};
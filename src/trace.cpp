@@ -0,0 +1,355 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+
+TraceWriter::~TraceWriter()
+{
+    Close();
+}
+
+bool TraceWriter::Open(const std::string &path, int interface_version, std::size_t edict_size, std::string &error)
+{
+    Close();
+
+    _file.open(path, std::ios::binary | std::ios::trunc);
+    if (!_file)
+    {
+        _file.close();
+        error = "Could not create \"" + path + "\".";
+        return false;
+    }
+
+    _path = path;
+    _records = 0;
+    _edict_size = edict_size > 0 ? edict_size : 1;
+    _last_time = Clock::now();
+    _buffer.clear();
+    _buffer.reserve(FLUSH_SIZE + 1024);
+
+    TraceHeader header{};
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.interface_version = static_cast<std::uint32_t>(interface_version);
+    header.edict_size = static_cast<std::uint32_t>(_edict_size);
+
+    _file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    return true;
+}
+
+bool TraceWriter::Close()
+{
+    if (!_file.is_open())
+        return true;
+
+    // The edict list never showed up, so pending indices are relative to the lowest edict instead.
+    if (!_pending_edicts.empty() && _edict_list == nullptr)
+    {
+        const edict_t *lowest = std::min_element(_pending_edicts.begin(), _pending_edicts.end(), [](const auto &a, const auto &b) {
+            return a.second < b.second;
+        })->second;
+
+        _edict_list = reinterpret_cast<const char *>(lowest);
+        ResolvePendingEdicts();
+    }
+
+    Flush();
+
+    bool success = static_cast<bool>(_file);
+    _file.close();
+    _file.clear();
+
+    _buffer.clear();
+    _pending_edicts.clear();
+    _edict_list = nullptr;
+
+    return success;
+}
+
+void TraceWriter::SetEdictList(const edict_t *edict_list)
+{
+    _edict_list = reinterpret_cast<const char *>(edict_list);
+
+    if (_edict_list != nullptr)
+        ResolvePendingEdicts();
+}
+
+void TraceWriter::Flush()
+{
+    if (!_file.is_open())
+        return;
+
+    std::size_t end = _pending_edicts.empty() ? _buffer.size() : _pending_edicts.front().first;
+    if (end == 0)
+        return;
+
+    _file.write(_buffer.data(), static_cast<std::streamsize>(end));
+    _buffer.erase(0, end);
+
+    for (auto &pending : _pending_edicts)
+        pending.first -= end;
+}
+
+void TraceWriter::PutUnsigned(std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        PutByte(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    PutByte(static_cast<std::uint8_t>(value));
+}
+
+void TraceWriter::PutString(const char *value)
+{
+    std::size_t length = value != nullptr ? std::strlen(value) : 0;
+
+    PutUnsigned(length);
+    _buffer.append(value != nullptr ? value : "", length);
+}
+
+void TraceWriter::PutIndex(std::size_t offset, std::uint32_t index)
+{
+    for (int i = 0; i < 4; i++)
+        _buffer[offset + i] = static_cast<char>((index >> (8 * i)) & 0xFF);
+}
+
+std::uint32_t TraceWriter::GetEdictIndex(const edict_t *edict) const
+{
+    const char *address = reinterpret_cast<const char *>(edict);
+
+    if (address < _edict_list)
+        return TRACE_NO_EDICT;
+
+    auto index = static_cast<std::size_t>(address - _edict_list) / _edict_size;
+    if (index >= TRACE_NO_EDICT)
+        return TRACE_NO_EDICT;
+
+    return static_cast<std::uint32_t>(index);
+}
+
+void TraceWriter::Put(const edict_t *edict)
+{
+    std::size_t offset = _buffer.size();
+    _buffer.append(4, '\0');
+
+    if (edict == nullptr)
+        PutIndex(offset, TRACE_NO_EDICT);
+    else if (_edict_list == nullptr)
+        _pending_edicts.emplace_back(offset, edict);
+    else
+        PutIndex(offset, GetEdictIndex(edict));
+}
+
+void TraceWriter::Put(const CCommand *command)
+{
+    if (command == nullptr)
+    {
+        PutByte(0);
+        return;
+    }
+
+    PutByte(1);
+
+    int argc = std::clamp(command->m_nArgc, 0, CCommand::COMMAND_MAX_ARGC);
+    auto args_length = std::find(command->m_pArgSBuffer, command->m_pArgSBuffer + CCommand::COMMAND_MAX_LENGTH, '\0') - command->m_pArgSBuffer;
+
+    PutUnsigned(static_cast<std::uint64_t>(std::max(command->m_nArgv0Size, 0)));
+    PutUnsigned(static_cast<std::uint64_t>(args_length));
+    _buffer.append(command->m_pArgSBuffer, static_cast<std::size_t>(args_length));
+
+    PutUnsigned(static_cast<std::uint64_t>(argc));
+    for (int i = 0; i < argc; i++)
+        PutString(command->m_ppArgv[i]);
+}
+
+void TraceWriter::ResolvePendingEdicts()
+{
+    for (const auto &[offset, edict] : _pending_edicts)
+        PutIndex(offset, GetEdictIndex(edict));
+
+    _pending_edicts.clear();
+}
+
+
+bool TraceReader::Open(const std::string &path, std::string &error)
+{
+    std::ifstream file(path, std::ios::binary);
+    _data.assign(std::istreambuf_iterator<char>(file), {});
+
+    if (!file.good() && !file.eof())
+    {
+        error = "Could not read \"" + path + "\".";
+        return false;
+    }
+
+    if (_data.size() < sizeof(TraceHeader))
+    {
+        error = "\"" + path + "\" is not a trace.";
+        return false;
+    }
+
+    std::memcpy(&_header, _data.data(), sizeof(_header));
+
+    if (std::memcmp(_header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+    {
+        error = "\"" + path + "\" is not a trace.";
+        return false;
+    }
+
+    if (_header.version != TRACE_VERSION)
+    {
+        error = "\"" + path + "\" has unsupported version " + std::to_string(_header.version) + ".";
+        return false;
+    }
+
+    _offset = sizeof(TraceHeader);
+    _time = 0;
+    return true;
+}
+
+bool TraceReader::GetUnsigned(std::uint64_t &value)
+{
+    value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (_offset >= _data.size())
+            return false;
+
+        auto byte = static_cast<std::uint8_t>(_data[_offset++]);
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool TraceReader::GetSigned(std::int64_t &value)
+{
+    std::uint64_t encoded;
+    if (!GetUnsigned(encoded))
+        return false;
+
+    value = static_cast<std::int64_t>(encoded >> 1) ^ -static_cast<std::int64_t>(encoded & 1);
+    return true;
+}
+
+bool TraceReader::GetString(std::string &value)
+{
+    std::uint64_t length;
+    if (!GetUnsigned(length) || length > _data.size() - _offset)
+        return false;
+
+    value.assign(_data, _offset, static_cast<std::size_t>(length));
+    _offset += static_cast<std::size_t>(length);
+    return true;
+}
+
+bool TraceReader::Next(TraceRecord &record, std::string &error)
+{
+    if (IsAtEnd())
+        return false;
+
+    std::size_t start = _offset;
+
+    auto fail = [&](const char *what) {
+        error = std::string(what) + " at offset " + std::to_string(start) + ".";
+        _offset = _data.size();
+        return false;
+    };
+
+    auto index = static_cast<std::uint8_t>(_data[_offset++]);
+    if (index >= CALLBACK_COUNT || TRACE_LAYOUTS[index] == nullptr)
+        return fail("Unknown callback");
+
+    std::uint64_t elapsed;
+    if (!GetUnsigned(elapsed))
+        return fail("Truncated record");
+
+    _time += elapsed;
+
+    record.callback = static_cast<Callback>(index);
+    record.time = _time;
+    record.edict = TRACE_NO_EDICT;
+    record.has_command = false;
+    record.argv0_size = 0;
+    record.args.clear();
+    record.argv.clear();
+
+    std::size_t integer_count = 0;
+    std::size_t string_count = 0;
+
+    for (const char *field = TRACE_LAYOUTS[index]; *field != '\0'; field++)
+    {
+        bool success = true;
+
+        switch (*field)
+        {
+        case 'i':
+            success = GetSigned(record.integers[integer_count++]);
+            break;
+
+        case 's':
+            success = GetString(record.strings[string_count++]);
+            break;
+
+        case 'e':
+            success = _data.size() - _offset >= 4;
+            if (success)
+            {
+                record.edict = 0;
+                for (int i = 0; i < 4; i++)
+                    record.edict |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(_data[_offset++])) << (8 * i);
+            }
+            break;
+
+        case 'c':
+        {
+            success = _offset < _data.size();
+            if (!success)
+                break;
+
+            record.has_command = _data[_offset++] != 0;
+            if (!record.has_command)
+                break;
+
+            std::uint64_t argv0_size;
+            std::uint64_t argc;
+
+            success = GetUnsigned(argv0_size)
+                && argv0_size < CCommand::COMMAND_MAX_LENGTH
+                && GetString(record.args)
+                && record.args.size() < CCommand::COMMAND_MAX_LENGTH
+                && GetUnsigned(argc)
+                && argc <= CCommand::COMMAND_MAX_ARGC;
+
+            if (!success)
+                break;
+
+            record.argv0_size = static_cast<int>(argv0_size);
+            record.argv.resize(static_cast<std::size_t>(argc));
+
+            for (auto &arg : record.argv)
+            {
+                if (!GetString(arg))
+                {
+                    success = false;
+                    break;
+                }
+            }
+            break;
+        }
+        }
+
+        if (!success)
+            return fail("Truncated record");
+    }
+
+    return true;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "callback.hpp"
+#include "ccommand.hpp"
+#include "interface.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// A trace file starts with a header, followed by one record per callback. A record starts with the
+// callback index as a byte and the nanoseconds since the previous record, followed by the
+// arguments in the order given by `TRACE_LAYOUTS`. Integers are LEB128 varints, signed ones
+// zigzag-encoded. Strings are a varint length followed by the bytes. Edicts are 32-bit
+// little-endian indices into the edict list. Commands are a byte that is 0 when the arguments are
+// not known, or else the `ArgS()` offset, the argument string and the varint count of arguments
+// followed by each argument.
+
+constexpr char TRACE_MAGIC[4] = { 'L', 'U', 'A', 'T' };
+constexpr std::uint32_t TRACE_VERSION = 1;
+
+// Edict index of null pointers and of edicts outside of the edict list.
+constexpr std::uint32_t TRACE_NO_EDICT = 0xFFFFFFFF;
+
+// Size of `edict_t` in source-sdk-2013.
+constexpr std::size_t TRACE_DEFAULT_EDICT_SIZE = sizeof(void *) == 8 ? 32 : 20;
+
+struct TraceHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    // Last digit of the `IServerPluginCallbacks` version the plugin was loaded as.
+    std::uint32_t interface_version;
+    // Size of `edict_t` that indices were computed with.
+    std::uint32_t edict_size;
+};
+
+/**
+ * @brief Arguments of each callback: \c i integer, \c s string, \c e edict, \c c command. Null for
+ * callbacks the engine doesn't call.
+ */
+inline constexpr const char *TRACE_LAYOUTS[CALLBACK_COUNT] = {
+    "",         // Load
+    "",         // Unload
+    "",         // Pause
+    "",         // UnPause
+    "",         // GetPluginDescription
+    "s",        // LevelInit
+    "ii",       // ServerActivate
+    "i",        // GameFrame
+    "",         // LevelShutdown
+    "e",        // ClientActive
+    "e",        // ClientFullyConnect
+    "e",        // ClientDisconnect
+    "es",       // ClientPutInServer
+    "i",        // SetCommandClient
+    "e",        // ClientSettingsChanged
+    "essi",     // ClientConnect
+    "ec",       // ClientCommand
+    "ss",       // NetworkIDValidated
+    "ieiss",    // OnQueryCvarValueFinished
+    "e",        // OnEdictAllocated
+    "e",        // OnEdictFreed
+    nullptr,    // OnEdictBatch
+};
+
+
+/**
+ * @brief Writes plugin callbacks to a trace file.
+ *
+ * Records are buffered and written once enough of them have piled up. Edict indices are relative
+ * to the edict list passed to \c ServerActivate. Records referring to edicts before the edict list
+ * is known are held back until it is.
+ */
+struct TraceWriter
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::size_t FLUSH_SIZE = 64 * 1024;
+
+private:
+    std::ofstream _file;
+    std::string _path;
+    std::string _buffer;
+    std::uint64_t _records = 0;
+
+    Clock::time_point _last_time;
+
+    const char *_edict_list = nullptr;
+    std::size_t _edict_size = TRACE_DEFAULT_EDICT_SIZE;
+
+    // Buffer offsets of edict indices waiting for the edict list, with their edicts.
+    std::vector<std::pair<std::size_t, const edict_t *>> _pending_edicts;
+
+    void PutByte(std::uint8_t value)
+    {
+        _buffer.push_back(static_cast<char>(value));
+    }
+
+    void PutUnsigned(std::uint64_t value);
+
+    void PutSigned(std::int64_t value)
+    {
+        // Zigzag, so small negative numbers stay small.
+        PutUnsigned((static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+    }
+
+    void PutString(const char *value);
+
+    void PutIndex(std::size_t offset, std::uint32_t index);
+
+    std::uint32_t GetEdictIndex(const edict_t *edict) const;
+
+    void Put(bool value)
+    {
+        PutSigned(value);
+    }
+
+    void Put(int value)
+    {
+        PutSigned(value);
+    }
+
+    void Put(const char *value)
+    {
+        PutString(value);
+    }
+
+    void Put(const edict_t *edict);
+
+    void Put(const CCommand *command);
+
+    void ResolvePendingEdicts();
+
+public:
+    TraceWriter() = default;
+
+    TraceWriter(const TraceWriter &) = delete;
+
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    ~TraceWriter();
+
+    /**
+     * @param interface_version Last digit of the \c IServerPluginCallbacks version.
+     * @param edict_size Size of \c edict_t in the game, for turning edict pointers into indices.
+     * @return \c false with \p error set if the file could not be created.
+     */
+    bool Open(const std::string &path, int interface_version, std::size_t edict_size, std::string &error);
+
+    /**
+     * @brief Writes outstanding records and closes the file.
+     * @return \c false if writing failed at some point.
+     */
+    bool Close();
+
+    bool IsOpen() const
+    {
+        return _file.is_open();
+    }
+
+    const std::string &GetPath() const
+    {
+        return _path;
+    }
+
+    std::uint64_t GetRecordCount() const
+    {
+        return _records;
+    }
+
+    /**
+     * @brief Sets the edict list that edict indices are computed from.
+     */
+    void SetEdictList(const edict_t *edict_list);
+
+    /**
+     * @brief Appends a record for \p callback. Arguments must match \c TRACE_LAYOUTS.
+     */
+    template<typename... Args>
+    void Write(Callback callback, const Args &...args)
+    {
+        auto now = Clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _last_time).count();
+        _last_time = now;
+
+        PutByte(static_cast<std::uint8_t>(CallbackIndex(callback)));
+        PutUnsigned(static_cast<std::uint64_t>(elapsed > 0 ? elapsed : 0));
+        (Put(args), ...);
+
+        _records++;
+
+        if (_buffer.size() >= FLUSH_SIZE)
+            Flush();
+    }
+
+    /**
+     * @brief Writes buffered records, up to the first one waiting for the edict list.
+     */
+    void Flush();
+};
+
+
+/**
+ * @brief Callback read from a trace, arguments are stored in layout order by type.
+ */
+struct TraceRecord
+{
+    Callback callback;
+    // Nanoseconds since recording started.
+    std::uint64_t time;
+
+    std::int64_t integers[3];
+    // `TRACE_NO_EDICT` when the callback got a null pointer.
+    std::uint32_t edict;
+    std::string strings[2];
+
+    // False for commands recorded without arguments.
+    bool has_command;
+    int argv0_size;
+    std::string args;
+    std::vector<std::string> argv;
+};
+
+
+/**
+ * @brief Reads records from a trace file written by \c TraceWriter.
+ */
+struct TraceReader
+{
+private:
+    std::string _data;
+    std::size_t _offset = 0;
+    TraceHeader _header{};
+    std::uint64_t _time = 0;
+
+    bool GetUnsigned(std::uint64_t &value);
+
+    bool GetSigned(std::int64_t &value);
+
+    bool GetString(std::string &value);
+
+public:
+    /**
+     * @return \c false with \p error set if the file is not a trace or could not be read.
+     */
+    bool Open(const std::string &path, std::string &error);
+
+    const TraceHeader &GetHeader() const
+    {
+        return _header;
+    }
+
+    bool IsAtEnd() const
+    {
+        return _offset >= _data.size();
+    }
+
+    /**
+     * @brief Reads the next record into \p record.
+     * @return \c false at the end of the trace, with \p error set if the record is malformed.
+     */
+    bool Next(TraceRecord &record, std::string &error);
+};
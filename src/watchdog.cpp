@@ -0,0 +1,55 @@
+#include "watchdog.hpp"
+
+#include <lua.hpp>
+
+
+// Address of this variable is the registry key of the watchdog instance.
+static const char WATCHDOG_KEY = 0;
+
+
+void Watchdog::Hook(lua_State *L, lua_Debug *ar)
+{
+    lua_pushlightuserdata(L, const_cast<char *>(&WATCHDOG_KEY));
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    auto *watchdog = static_cast<Watchdog *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+
+    if (watchdog == nullptr || Clock::now() < watchdog->_deadline)
+        return;
+
+    watchdog->_tripped = true;
+
+    auto budget = std::chrono::duration<double, std::milli>(watchdog->_budgets[CallbackIndex(watchdog->_callback)]);
+
+    // Keeps firing if the error gets caught by Lua code, since the deadline stays in the past.
+    luaL_error(L, "%s exceeded its time budget of %.1f ms", GetCallbackName(watchdog->_callback), budget.count());
+}
+
+bool Watchdog::IsEnabled() const
+{
+    for (auto budget : _budgets)
+    {
+        if (budget != Clock::duration::zero())
+            return true;
+    }
+
+    return false;
+}
+
+void Watchdog::Attach(lua_State *L, int instruction_interval)
+{
+    if (!IsEnabled())
+        return;
+
+    lua_pushlightuserdata(L, const_cast<char *>(&WATCHDOG_KEY));
+    lua_pushlightuserdata(L, this);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+
+    lua_sethook(L, &Hook, LUA_MASKCOUNT, instruction_interval);
+}
+
+void Watchdog::ResetOverruns()
+{
+    for (auto &overruns : _overruns)
+        overruns = 0;
+}
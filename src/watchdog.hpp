@@ -0,0 +1,113 @@
+#pragma once
+
+#include "callback.hpp"
+
+#include <chrono>
+#include <cstdint>
+
+// #include <lua.hpp>
+struct lua_State;
+struct lua_Debug;
+
+
+/**
+ * @brief Aborts Lua callbacks that run longer than their time budget.
+ *
+ * Uses a count hook to check a deadline every few hundred VM instructions, see the README for
+ * what that can't catch.
+ */
+struct Watchdog
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief State of the callback that was running when another one started.
+     */
+    struct Watch
+    {
+        Clock::time_point deadline;
+        Callback callback;
+        bool tripped;
+    };
+
+private:
+    Clock::duration _budgets[CALLBACK_COUNT] = {};
+    Clock::time_point _deadline = Clock::time_point::max();
+
+    Callback _callback = Callback::COUNT;
+    bool _tripped = false;
+
+    std::uint32_t _overruns[CALLBACK_COUNT] = {};
+
+    static void Hook(lua_State *L, lua_Debug *ar);
+
+public:
+    /**
+     * @brief Sets the time budget of \p callback, zero disables the watchdog for it.
+     */
+    void SetBudget(Callback callback, Clock::duration budget)
+    {
+        _budgets[CallbackIndex(callback)] = budget;
+    }
+
+    bool IsEnabled() const;
+
+    /**
+     * @brief Installs the hook into \p L. Does nothing if no callback has a budget.
+     * @param instruction_interval Number of VM instructions between deadline checks.
+     */
+    void Attach(lua_State *L, int instruction_interval);
+
+    /**
+     * @brief Starts the clock for \p callback. The callback that is already running, if any, is not
+     * watched until the returned state is passed to Stop(), but its clock keeps going.
+     */
+    Watch Start(Callback callback)
+    {
+        Watch outer = { _deadline, _callback, _tripped };
+
+        auto budget = _budgets[CallbackIndex(callback)];
+
+        _callback = callback;
+        _deadline = budget == Clock::duration::zero() ? Clock::time_point::max() : Clock::now() + budget;
+        _tripped = false;
+
+        return outer;
+    }
+
+    /**
+     * @brief Stops the clock, records an overrun if the callback was aborted and resumes watching
+     * the \p outer one.
+     * @return Number of overruns recorded for the callback so far if aborted, 0 otherwise.
+     */
+    std::uint32_t Stop(const Watch &outer)
+    {
+        auto callback = _callback;
+        bool tripped = _tripped;
+
+        _deadline = outer.deadline;
+        _callback = outer.callback;
+        _tripped = outer.tripped;
+
+        if (!tripped)
+            return 0;
+
+        return ++_overruns[CallbackIndex(callback)];
+    }
+
+    /**
+     * @brief Whether the running callback has been aborted.
+     */
+    bool IsTripped() const
+    {
+        return _tripped;
+    }
+
+    std::uint32_t GetOverruns(Callback callback) const
+    {
+        return _overruns[CallbackIndex(callback)];
+    }
+
+    void ResetOverruns();
+};
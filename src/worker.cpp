@@ -0,0 +1,315 @@
+#include "worker.hpp"
+
+#include "console.hpp"
+#include "engine.hpp"
+#include "L.hpp"
+#include "serialize.hpp"
+
+#include <lua.hpp>
+
+#include <chrono>
+
+
+// Address of this variable is the registry key of the pool in worker states.
+static const char WORKER_POOL_KEY = 0;
+
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+void WorkerPool::SetPrintRateLimit(double rate, double burst)
+{
+    _print_rate = rate;
+    _print_burst = burst;
+}
+
+void WorkerPool::Start(std::size_t count, const std::string &package_directory, const ModuleBundle *bundle)
+{
+    Stop();
+
+    _package_directory = package_directory;
+    _bundle = bundle;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        auto worker = std::make_unique<Worker>();
+        worker->thread = std::thread(&WorkerPool::Run, this, std::ref(*worker));
+        _workers.push_back(std::move(worker));
+    }
+}
+
+void WorkerPool::Stop()
+{
+    _stopping = true;
+
+    for (auto &worker : _workers)
+    {
+        {
+            std::lock_guard lock(worker->mutex);
+        }
+        worker->wakeup.notify_one();
+    }
+
+    for (auto &worker : _workers)
+        worker->thread.join();
+
+    _workers.clear();
+
+    std::unique_ptr<Result> result;
+    while (_results.Pop(result))
+        ;
+
+    // References died with the state.
+    _callbacks.clear();
+
+    _stopping = false;
+}
+
+void WorkerPool::Run(Worker &worker)
+{
+    lua_State *L = luaL_newstate();
+    if (L == nullptr)
+    {
+        Warn("Could not create Lua state for worker thread.\n");
+        return;
+    }
+
+    luaL_openlibs(L);
+
+    // Suppressed lines are reported with the next line from the same call site.
+    Console console;
+    console.SetRateLimit(_print_rate, _print_burst);
+    console.Open(L);
+
+    L_SetPackagePath(L, _package_directory.c_str());
+
+    if (_bundle != nullptr)
+        _bundle->Install(L);
+
+    lua_pushlightuserdata(L, const_cast<char *>(&WORKER_POOL_KEY));
+    lua_pushlightuserdata(L, this);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+
+    lua_sethook(L, &StopHook, LUA_MASKCOUNT, STOP_CHECK_INTERVAL);
+
+    while (!_stopping)
+    {
+        std::unique_ptr<Job> job;
+
+        if (!worker.jobs.Pop(job))
+        {
+            std::unique_lock lock(worker.mutex);
+            worker.wakeup.wait(lock, [&]() { return _stopping || !worker.jobs.IsEmpty(); });
+            continue;
+        }
+
+        auto result = Execute(L, *job);
+
+        // Wait for the main thread to make room.
+        while (!_results.Push(result) && !_stopping)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    lua_close(L);
+}
+
+std::unique_ptr<WorkerPool::Result> WorkerPool::Execute(lua_State *L, const Job &job)
+{
+    auto result = std::make_unique<Result>();
+    result->id = job.id;
+    result->success = false;
+
+    int base = lua_gettop(L);
+    lua_pushcfunction(L, &L_ErrorHandler);
+
+    // Modules return their job handler.
+    lua_getglobal(L, "require");
+    lua_pushlstring(L, job.module.data(), job.module.size());
+
+    if (lua_pcall(L, 1, 1, base + 1) != LUA_OK)
+    {
+        result->payload = lua_tostring(L, -1);
+        lua_settop(L, base);
+        return result;
+    }
+
+    if (!lua_isfunction(L, -1))
+    {
+        result->payload = "module '" + job.module + "' did not return a function";
+        lua_settop(L, base);
+        return result;
+    }
+
+    int argc = L_Deserialize(L, job.payload);
+
+    if (lua_pcall(L, argc, LUA_MULTRET, base + 1) != LUA_OK)
+    {
+        result->payload = lua_tostring(L, -1);
+        lua_settop(L, base);
+        return result;
+    }
+
+    std::string error;
+    int retc = lua_gettop(L) - (base + 1);
+
+    if (L_Serialize(L, base + 2, retc, result->payload, error))
+    {
+        result->success = true;
+    }
+    else
+    {
+        result->payload = std::move(error);
+    }
+
+    lua_settop(L, base);
+    return result;
+}
+
+void WorkerPool::StopHook(lua_State *L, lua_Debug *ar)
+{
+    lua_pushlightuserdata(L, const_cast<char *>(&WORKER_POOL_KEY));
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    auto *self = static_cast<WorkerPool *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+
+    // Keeps firing if the error gets caught by the job, since the pool stays stopping.
+    if (self != nullptr && self->_stopping)
+        luaL_error(L, "job aborted, the worker pool is stopping");
+}
+
+void WorkerPool::Open(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "submit", &L_Submit },
+        { "count", &L_Count },
+        { "pending", &L_Pending },
+        { nullptr, nullptr },
+    };
+
+    L_SetGlobalLibrary(L, "worker", functions, this);
+}
+
+void WorkerPool::Pump(lua_State *L, int error_handler_index, const Watchdog &watchdog)
+{
+    std::unique_ptr<Result> result;
+
+    while (!watchdog.IsTripped() && _results.Pop(result))
+    {
+        auto callback = _callbacks.find(result->id);
+        if (callback == _callbacks.end())
+            continue;
+
+        int callback_ref = callback->second;
+        _callbacks.erase(callback);
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, callback_ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, callback_ref);
+
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+
+            // Nobody else is going to report it.
+            if (!result->success)
+                Warn("%s\n", result->payload.c_str());
+
+            continue;
+        }
+
+        lua_pushboolean(L, result->success);
+
+        int argc = 1;
+        if (result->success)
+        {
+            argc += L_Deserialize(L, result->payload);
+        }
+        else
+        {
+            lua_pushlstring(L, result->payload.data(), result->payload.size());
+            argc++;
+        }
+
+        L_TryCall(L, argc, 0, error_handler_index);
+    }
+}
+
+int WorkerPool::L_Submit(lua_State *L)
+{
+    auto *self = L_ToUpvalue<WorkerPool>(L);
+
+    size_t module_length;
+    const char *module = luaL_checklstring(L, 1, &module_length);
+
+    if (!lua_isnoneornil(L, 2))
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    if (self->_workers.empty())
+        return luaL_error(L, "no worker threads (see the `worker_threads` setting)");
+
+    // Errors are raised after the job is gone, LuaJIT doesn't run destructors on all platforms.
+    const char *error = nullptr;
+    bool queued = false;
+    std::uint32_t id = 0;
+
+    {
+        auto job = std::make_unique<Job>();
+        job->module.assign(module, module_length);
+
+        std::string message;
+        if (L_Serialize(L, 3, lua_gettop(L) - 2, job->payload, message))
+        {
+            // Try each worker once, starting with the next one in turn.
+            for (std::size_t i = 0; i < self->_workers.size() && !queued; i++)
+            {
+                auto &worker = *self->_workers[self->_next_worker];
+                self->_next_worker = (self->_next_worker + 1) % self->_workers.size();
+
+                job->id = self->_next_id;
+
+                if (!worker.jobs.Push(job))
+                    continue;
+
+                {
+                    std::lock_guard lock(worker.mutex);
+                }
+                worker.wakeup.notify_one();
+
+                id = self->_next_id++;
+                queued = true;
+            }
+        }
+        else
+        {
+            lua_pushlstring(L, message.data(), message.size());
+            error = lua_tostring(L, -1);
+        }
+    }
+
+    if (error != nullptr)
+        return luaL_argerror(L, 3, error);
+
+    if (!queued)
+        return luaL_error(L, "all worker queues are full");
+
+    lua_pushvalue(L, 2);
+    self->_callbacks[id] = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+int WorkerPool::L_Count(lua_State *L)
+{
+    auto *self = L_ToUpvalue<WorkerPool>(L);
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_workers.size()));
+    return 1;
+}
+
+int WorkerPool::L_Pending(lua_State *L)
+{
+    auto *self = L_ToUpvalue<WorkerPool>(L);
+    lua_pushinteger(L, static_cast<lua_Integer>(self->_callbacks.size()));
+    return 1;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "bundle.hpp"
+#include "queue.hpp"
+#include "watchdog.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// #include <lua.hpp>
+struct lua_State;
+struct lua_Debug;
+
+
+/**
+ * @brief Threads with their own Lua states that run jobs submitted from the main state.
+ *
+ * Jobs and results are serialized with \c L_Serialize and passed through lock-free queues. The
+ * main thread only blocks to wake up an idle worker.
+ */
+struct WorkerPool
+{
+private:
+    static constexpr std::size_t JOB_QUEUE_CAPACITY = 1024;
+    static constexpr std::size_t RESULT_QUEUE_CAPACITY = 4096;
+
+    // Number of VM instructions between checks whether running jobs have to be aborted.
+    static constexpr int STOP_CHECK_INTERVAL = 1000;
+
+    struct Job
+    {
+        std::uint32_t id;
+        std::string module;
+        std::string payload;
+    };
+
+    struct Result
+    {
+        std::uint32_t id;
+        bool success;
+        // Serialized return values on success, error message otherwise.
+        std::string payload;
+    };
+
+    struct Worker
+    {
+        std::thread thread;
+        SpscQueue<std::unique_ptr<Job>> jobs{ JOB_QUEUE_CAPACITY };
+        std::mutex mutex;
+        std::condition_variable wakeup;
+    };
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    MpscQueue<std::unique_ptr<Result>> _results{ RESULT_QUEUE_CAPACITY };
+    std::atomic<bool> _stopping{ false };
+
+    std::string _package_directory;
+    const ModuleBundle *_bundle = nullptr;
+
+    double _print_rate = 0.0;
+    double _print_burst = 0.0;
+
+    std::size_t _next_worker = 0;
+    std::uint32_t _next_id = 1;
+
+    // Registry references to result callbacks of pending jobs.
+    std::unordered_map<std::uint32_t, int> _callbacks;
+
+    void Run(Worker &worker);
+
+    std::unique_ptr<Result> Execute(lua_State *L, const Job &job);
+
+    static void StopHook(lua_State *L, lua_Debug *ar);
+
+    static int L_Submit(lua_State *L);
+
+    static int L_Count(lua_State *L);
+
+    static int L_Pending(lua_State *L);
+
+public:
+    WorkerPool() = default;
+
+    WorkerPool(const WorkerPool &) = delete;
+
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    ~WorkerPool();
+
+    /**
+     * @brief Sets the rate limit of \c print and \c warn in workers started afterwards (see \c Console).
+     */
+    void SetPrintRateLimit(double rate, double burst);
+
+    /**
+     * @brief Starts \p count worker threads.
+     * @param package_directory Directory searched for modules, like in the main state.
+     * @param bundle Bundle searched for modules before the directory, must outlive the workers.
+     */
+    void Start(std::size_t count, const std::string &package_directory, const ModuleBundle *bundle = nullptr);
+
+    /**
+     * @brief Stops and joins all worker threads, dropping unfinished jobs.
+     *
+     * Running jobs are aborted from a count hook, so this blocks until they get back to the
+     * interpreter (see the watchdog notes in the README).
+     */
+    void Stop();
+
+    /**
+     * @brief Registers the \c worker library.
+     */
+    void Open(lua_State *L);
+
+    /**
+     * @brief Calls result callbacks of finished jobs.
+     *
+     * Once \p watchdog has aborted a callback, the remaining ones are left for the next call.
+     */
+    void Pump(lua_State *L, int error_handler_index, const Watchdog &watchdog);
+};
@@ -0,0 +1,376 @@
+// Runs the plugin outside of the game, calling its callbacks with a synthetic workload and
+// reporting how long each callback took.
+//
+// Usage: lua_plugin_host [options] <plugin binary>
+//
+// Options:
+//   --interface <1-3>   IServerPluginCallbacks version, newest supported by default
+//   --tier0 <path>      stub tier0 library, libtier0.so next to the host by default
+//   --map <name>        map passed to LevelInit
+//   --ticks <n>         number of GameFrame calls
+//   --tickrate <n>      GameFrame calls per second, 0 to run as fast as possible
+//   --clients <n>       clients connected at the start
+//   --reconnect <n>     frames between one client disconnecting and connecting again, 0 to never
+//   --edicts <n>        edicts allocated and freed per frame
+//   --live-edicts <n>   edicts alive before the oldest ones are freed
+//   --commands <n>      client commands per frame
+//   --command <text>    client command, split on spaces
+//   --quiet             drop messages printed by the plugin
+
+#include "pluginhost.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+
+struct Options
+{
+    long long interface_version = 0;
+    std::string tier0_path;
+    std::string plugin_path;
+    std::string map_name = "host_map";
+    long long ticks = 6600;
+    long long tickrate = 66;
+    long long clients = 16;
+    long long reconnect = 66;
+    long long edicts = 4;
+    long long live_edicts = 512;
+    long long commands = 8;
+    std::string command = "say hello";
+    bool quiet = false;
+};
+
+
+static bool ParseInteger(const char *text, long long min, long long max, long long &value)
+{
+    char *end = nullptr;
+    long long parsed = std::strtoll(text, &end, 10);
+
+    if (end == text || *end != '\0' || parsed < min || parsed > max)
+        return false;
+
+    value = parsed;
+    return true;
+}
+
+static bool ParseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+
+        if (std::strcmp(arg, "--quiet") == 0)
+        {
+            options.quiet = true;
+            continue;
+        }
+
+        if (std::strncmp(arg, "--", 2) != 0)
+        {
+            if (!options.plugin_path.empty())
+            {
+                std::fprintf(stderr, "unexpected argument \"%s\"\n", arg);
+                return false;
+            }
+
+            options.plugin_path = arg;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "%s: missing value\n", arg);
+            return false;
+        }
+
+        const char *value = argv[++i];
+
+        struct IntegerOption
+        {
+            const char *name;
+            long long min;
+            long long max;
+            long long *value;
+        };
+
+        const int max_edicts = PluginHost::EDICT_COUNT - 1;
+
+        IntegerOption integers[] = {
+            { "--interface", 1, 3, &options.interface_version },
+            { "--ticks", 0, 1LL << 40, &options.ticks },
+            { "--tickrate", 0, 100000, &options.tickrate },
+            { "--clients", 0, 255, &options.clients },
+            { "--reconnect", 0, 1 << 30, &options.reconnect },
+            { "--edicts", 0, max_edicts, &options.edicts },
+            { "--live-edicts", 0, max_edicts, &options.live_edicts },
+            { "--commands", 0, 1 << 20, &options.commands },
+        };
+
+        auto *integer = std::find_if(std::begin(integers), std::end(integers), [&](const IntegerOption &option) {
+            return std::strcmp(option.name, arg) == 0;
+        });
+
+        if (integer != std::end(integers))
+        {
+            if (!ParseInteger(value, integer->min, integer->max, *integer->value))
+            {
+                std::fprintf(stderr, "%s: expected an integer from %lld to %lld\n", arg, integer->min, integer->max);
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--tier0") == 0)
+            options.tier0_path = value;
+        else if (std::strcmp(arg, "--map") == 0)
+            options.map_name = value;
+        else if (std::strcmp(arg, "--command") == 0)
+            options.command = value;
+        else
+        {
+            std::fprintf(stderr, "unknown option \"%s\"\n", arg);
+            return false;
+        }
+    }
+
+    if (options.plugin_path.empty())
+    {
+        std::fprintf(stderr, "usage: %s [options] <plugin binary>\n", argc > 0 ? argv[0] : "lua_plugin_host");
+        return false;
+    }
+
+    if (options.tier0_path.empty())
+        options.tier0_path = PluginHost::GetDefaultTier0Path();
+
+    // Relative paths would be searched for in the library path instead.
+    options.plugin_path = fs::absolute(options.plugin_path).string();
+    options.tier0_path = fs::absolute(options.tier0_path).string();
+
+    return true;
+}
+
+
+/**
+ * @brief Clients and non-player edicts of the synthetic server.
+ */
+struct Server
+{
+    PluginHost &host;
+    const Options &options;
+
+    CCommand command;
+
+    // Player edicts are 1 to `clients`, like in the game.
+    std::vector<bool> connected;
+    int next_reconnect = 1;
+    int next_command = 1;
+    int next_user_id = 1;
+
+    std::deque<int> live_edicts;
+    std::vector<int> free_edicts;
+
+    Server(PluginHost &host, const Options &options)
+        : host(host),
+          options(options),
+          connected(static_cast<std::size_t>(options.clients) + 1, false)
+    {
+        for (int i = PluginHost::EDICT_COUNT - 1; i > options.clients; i--)
+            free_edicts.push_back(i);
+    }
+
+    bool MakeCommand()
+    {
+        std::vector<std::string> argv;
+        std::istringstream stream(options.command);
+
+        for (std::string arg; stream >> arg;)
+            argv.push_back(arg);
+
+        return PluginHost::MakeCommand(argv, command);
+    }
+
+    void Connect(int index)
+    {
+        std::string name = "player" + std::to_string(index);
+        std::string network_id = "[U:1:" + std::to_string(next_user_id++) + "]";
+        std::string reject;
+
+        if (!host.ClientConnect(index, name.c_str(), "127.0.0.1:27005", reject))
+        {
+            std::fprintf(stderr, "%s was rejected: %s\n", name.c_str(), reject.c_str());
+            return;
+        }
+
+        host.ClientPutInServer(index, name.c_str());
+        host.NetworkIDValidated(name.c_str(), network_id.c_str());
+        host.ClientActive(index);
+
+        connected[index] = true;
+    }
+
+    void Disconnect(int index)
+    {
+        if (!connected[index])
+            return;
+
+        host.ClientDisconnect(index);
+        connected[index] = false;
+    }
+
+    void Reconnect()
+    {
+        int index = next_reconnect;
+        next_reconnect = next_reconnect % static_cast<int>(options.clients) + 1;
+
+        Disconnect(index);
+        Connect(index);
+    }
+
+    void RunCommands()
+    {
+        if (options.clients == 0)
+            return;
+
+        for (long long i = 0; i < options.commands; i++)
+        {
+            int index = next_command;
+            next_command = next_command % static_cast<int>(options.clients) + 1;
+
+            if (!connected[index])
+                continue;
+
+            // The engine passes the player slot, which is the edict index minus one.
+            host.SetCommandClient(index - 1);
+            host.ClientCommand(index, command);
+        }
+    }
+
+    void ChurnEdicts()
+    {
+        for (long long i = 0; i < options.edicts; i++)
+        {
+            if (static_cast<long long>(live_edicts.size()) >= options.live_edicts && !live_edicts.empty())
+            {
+                int index = live_edicts.front();
+                live_edicts.pop_front();
+
+                host.OnEdictFreed(index);
+                free_edicts.push_back(index);
+            }
+
+            if (free_edicts.empty())
+                continue;
+
+            int index = free_edicts.back();
+            free_edicts.pop_back();
+
+            host.OnEdictAllocated(index);
+            live_edicts.push_back(index);
+        }
+    }
+
+    void FreeEdicts()
+    {
+        while (!live_edicts.empty())
+        {
+            host.OnEdictFreed(live_edicts.front());
+            live_edicts.pop_front();
+        }
+    }
+};
+
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+        return 1;
+
+    PluginHost host;
+    std::string error;
+
+    if (!host.Open(options.tier0_path, options.plugin_path, static_cast<int>(options.interface_version), error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    host.SetQuiet(options.quiet);
+
+    Server server(host, options);
+    if (!server.MakeCommand())
+    {
+        std::fprintf(stderr, "--command: too long\n");
+        return 1;
+    }
+
+    std::fprintf(stderr, "Hosting %s through ISERVERPLUGINCALLBACKS00%d\n", options.plugin_path.c_str(), host.GetVersion());
+
+    if (!host.Load())
+    {
+        // The engine unloads plugins that fail to load.
+        host.Unload();
+        std::fprintf(stderr, "The plugin failed to load.\n");
+        return 1;
+    }
+
+    using Clock = CallbackStats::Clock;
+
+    auto start = Clock::now();
+
+    host.LevelInit(options.map_name.c_str());
+    host.ServerActivate(PluginHost::EDICT_COUNT, static_cast<int>(std::max(options.clients, 1LL)));
+
+    for (int i = 1; i <= options.clients; i++)
+        server.Connect(i);
+
+    LatencyHistogram ticks;
+    auto period = options.tickrate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.tickrate)) : Clock::duration::zero();
+    auto next_tick = Clock::now();
+
+    for (long long tick = 1; tick <= options.ticks; tick++)
+    {
+        auto tick_start = Clock::now();
+
+        host.GameFrame(true);
+        server.RunCommands();
+        server.ChurnEdicts();
+
+        if (options.reconnect > 0 && options.clients > 0 && tick % options.reconnect == 0)
+            server.Reconnect();
+
+        auto tick_end = Clock::now();
+        ticks.Record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(tick_end - tick_start).count()));
+
+        if (options.tickrate > 0)
+        {
+            next_tick += period;
+
+            // Catch up instead of sleeping when the plugin is too slow, like the engine does.
+            if (next_tick > tick_end)
+                std::this_thread::sleep_until(next_tick);
+        }
+    }
+
+    for (int i = 1; i <= options.clients; i++)
+        server.Disconnect(i);
+
+    server.FreeEdicts();
+    host.LevelShutdown();
+
+    auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    host.Unload();
+
+    host.PrintReport(seconds, &ticks);
+    return 0;
+}
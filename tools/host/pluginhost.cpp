@@ -0,0 +1,410 @@
+#include "pluginhost.hpp"
+
+#include <dlfcn.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+
+static const char *GetLoaderError()
+{
+    const char *error = dlerror();
+    return error != nullptr ? error : "unknown error";
+}
+
+static void *FindNoInterface(const char *, int *return_code)
+{
+    if (return_code != nullptr)
+        *return_code = 0;
+
+    return nullptr;
+}
+
+static CreateInterfaceFn *interface_factory = &FindNoInterface;
+
+
+std::string PluginHost::GetDefaultTier0Path()
+{
+    std::error_code error;
+    auto executable = std::filesystem::read_symlink("/proc/self/exe", error);
+
+    return error ? "libtier0.so" : (executable.parent_path() / "libtier0.so").string();
+}
+
+PluginHost::PluginHost()
+    : _edicts(EDICT_COUNT * EDICT_SIZE)
+{
+}
+
+PluginHost::~PluginHost()
+{
+    if (_library != nullptr)
+        dlclose(_library);
+
+    if (_tier0 != nullptr)
+        dlclose(_tier0);
+}
+
+bool PluginHost::Open(const std::string &tier0_path, const std::string &plugin_path, int version, std::string &error)
+{
+    // Global, so the plugin finds it by name like it finds the engine's.
+    _tier0 = dlopen(tier0_path.c_str(), RTLD_NOW | RTLD_GLOBAL);
+    if (_tier0 == nullptr)
+    {
+        error = std::string("Could not load tier0: ") + GetLoaderError();
+        return false;
+    }
+
+    _library = dlopen(plugin_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (_library == nullptr)
+    {
+        error = std::string("Could not load the plugin: ") + GetLoaderError();
+        return false;
+    }
+
+    auto *create_interface = reinterpret_cast<CreateInterfaceFn *>(dlsym(_library, "CreateInterface"));
+    if (create_interface == nullptr)
+    {
+        error = "The plugin does not export CreateInterface.";
+        return false;
+    }
+
+    // The engine asks for the newest version it supports first.
+    static const std::string_view VERSIONS[] = {
+        IServerPluginCallbacks_v1::INTERFACE_VERSION,
+        IServerPluginCallbacks_v2::INTERFACE_VERSION,
+        IServerPluginCallbacks_v3::INTERFACE_VERSION,
+    };
+
+    int newest = version != 0 ? version : 3;
+    int oldest = version != 0 ? version : 1;
+
+    for (int i = newest; i >= oldest && _plugin == nullptr; i--)
+    {
+        if (i < 1 || i > 3)
+            break;
+
+        std::string name(VERSIONS[i - 1]);
+        int return_code = 0;
+
+        void *instance = create_interface(name.c_str(), &return_code);
+        if (instance != nullptr && return_code != 0)
+        {
+            _plugin = static_cast<IServerPluginCallbacks_Common *>(instance);
+            _version = i;
+        }
+    }
+
+    if (_plugin == nullptr)
+    {
+        error = "The plugin does not provide a supported IServerPluginCallbacks version.";
+        return false;
+    }
+
+    return true;
+}
+
+void PluginHost::SetQuiet(bool quiet)
+{
+    if (auto *set_quiet = reinterpret_cast<void (*)(bool)>(dlsym(_tier0, "HostSetQuiet")))
+        set_quiet(quiet);
+}
+
+edict_t *PluginHost::GetEdict(int index)
+{
+    if (index < 0 || index >= EDICT_COUNT)
+        return nullptr;
+
+    return reinterpret_cast<edict_t *>(&_edicts[static_cast<std::size_t>(index) * EDICT_SIZE]);
+}
+
+bool PluginHost::MakeCommand(const std::vector<std::string> &argv, CCommand &command)
+{
+    std::string args;
+    for (const auto &arg : argv)
+    {
+        if (!args.empty())
+            args.push_back(' ');
+
+        args.append(arg);
+    }
+
+    // `ArgS()` is everything after the first argument and the space following it.
+    int argv0_size = argv.size() > 1 ? static_cast<int>(argv[0].size() + 1) : 0;
+
+    return MakeCommand(args, argv0_size, argv, command);
+}
+
+bool PluginHost::MakeCommand(const std::string &args, int argv0_size, const std::vector<std::string> &argv, CCommand &command)
+{
+    command.m_nArgc = 0;
+    command.m_nArgv0Size = 0;
+    command.m_pArgSBuffer[0] = '\0';
+    command.m_pArgvBuffer[0] = '\0';
+
+    if (argv.size() > static_cast<std::size_t>(CCommand::COMMAND_MAX_ARGC)
+        || args.size() >= CCommand::COMMAND_MAX_LENGTH
+        || argv0_size < 0
+        || static_cast<std::size_t>(argv0_size) > args.size())
+    {
+        return false;
+    }
+
+    std::size_t argv_length = 0;
+    for (const auto &arg : argv)
+    {
+        if (argv_length + arg.size() + 1 > CCommand::COMMAND_MAX_LENGTH)
+            return false;
+
+        argv_length += arg.size() + 1;
+    }
+
+    std::memcpy(command.m_pArgSBuffer, args.c_str(), args.size() + 1);
+    command.m_nArgv0Size = argv0_size;
+
+    argv_length = 0;
+    for (std::size_t i = 0; i < argv.size(); i++)
+    {
+        std::memcpy(command.m_pArgvBuffer + argv_length, argv[i].c_str(), argv[i].size() + 1);
+        command.m_ppArgv[i] = command.m_pArgvBuffer + argv_length;
+        argv_length += argv[i].size() + 1;
+    }
+
+    command.m_nArgc = static_cast<int>(argv.size());
+    return true;
+}
+
+static double ToMicroseconds(double nanoseconds)
+{
+    return nanoseconds / 1000.0;
+}
+
+void PluginHost::PrintReport(double seconds, const LatencyHistogram *ticks) const
+{
+    std::printf("\n%-26s %10s %12s %10s %10s %10s %10s\n", "callback", "calls", "calls/s", "mean us", "p50 us", "p99 us", "max us");
+
+    auto print_row = [&](const char *name, const LatencyHistogram &histogram) {
+        std::printf(
+            "%-26s %10llu %12.1f %10.2f %10.2f %10.2f %10.2f\n",
+            name,
+            static_cast<unsigned long long>(histogram.GetCount()),
+            seconds > 0.0 ? histogram.GetCount() / seconds : 0.0,
+            ToMicroseconds(histogram.GetMean()),
+            ToMicroseconds(static_cast<double>(histogram.GetPercentile(0.5))),
+            ToMicroseconds(static_cast<double>(histogram.GetPercentile(0.99))),
+            ToMicroseconds(static_cast<double>(histogram.GetMax()))
+        );
+    };
+
+    for (std::size_t i = 0; i < CALLBACK_COUNT; i++)
+    {
+        const auto &histogram = _stats.Get(static_cast<Callback>(i));
+
+        if (histogram.GetCount() != 0)
+            print_row(CALLBACK_NAMES[i], histogram);
+    }
+
+    if (ticks == nullptr)
+        return;
+
+    // Everything the plugin did during one server frame.
+    print_row("[tick]", *ticks);
+
+    std::printf(
+        "\n%llu ticks in %.3f s, %.1f ticks/s\n",
+        static_cast<unsigned long long>(ticks->GetCount()),
+        seconds,
+        seconds > 0.0 ? ticks->GetCount() / seconds : 0.0
+    );
+}
+
+bool PluginHost::Load()
+{
+    return Time(Callback::Load, [&] {
+        return _plugin->Load(interface_factory, interface_factory);
+    });
+}
+
+void PluginHost::Unload()
+{
+    Time(Callback::Unload, [&] {
+        _plugin->Unload();
+    });
+}
+
+const char *PluginHost::GetPluginDescription()
+{
+    return Time(Callback::GetPluginDescription, [&] {
+        return _plugin->GetPluginDescription();
+    });
+}
+
+void PluginHost::Pause()
+{
+    Time(Callback::Pause, [&] {
+        _plugin->Pause();
+    });
+}
+
+void PluginHost::UnPause()
+{
+    Time(Callback::UnPause, [&] {
+        _plugin->UnPause();
+    });
+}
+
+void PluginHost::LevelInit(const char *map_name)
+{
+    Time(Callback::LevelInit, [&] {
+        _plugin->LevelInit(map_name);
+    });
+}
+
+void PluginHost::ServerActivate(int edict_count, int client_max)
+{
+    Time(Callback::ServerActivate, [&] {
+        _plugin->ServerActivate(GetEdict(0), edict_count, client_max);
+    });
+}
+
+void PluginHost::GameFrame(bool simulating)
+{
+    Time(Callback::GameFrame, [&] {
+        _plugin->GameFrame(simulating);
+    });
+}
+
+void PluginHost::LevelShutdown()
+{
+    Time(Callback::LevelShutdown, [&] {
+        _plugin->LevelShutdown();
+    });
+}
+
+void PluginHost::ClientActive(int index)
+{
+    edict_t *edict = GetEdict(index);
+
+    Time(Callback::ClientActive, [&] {
+        _plugin->ClientActive(edict);
+    });
+}
+
+void PluginHost::ClientDisconnect(int index)
+{
+    edict_t *edict = GetEdict(index);
+
+    Time(Callback::ClientDisconnect, [&] {
+        _plugin->ClientDisconnect(edict);
+    });
+}
+
+void PluginHost::ClientPutInServer(int index, const char *player_name)
+{
+    edict_t *edict = GetEdict(index);
+
+    Time(Callback::ClientPutInServer, [&] {
+        _plugin->ClientPutInServer(edict, player_name);
+    });
+}
+
+void PluginHost::SetCommandClient(int index)
+{
+    Time(Callback::SetCommandClient, [&] {
+        _plugin->SetCommandClient(index);
+    });
+}
+
+void PluginHost::ClientSettingsChanged(int index)
+{
+    edict_t *edict = GetEdict(index);
+
+    Time(Callback::ClientSettingsChanged, [&] {
+        _plugin->ClientSettingsChanged(edict);
+    });
+}
+
+bool PluginHost::ClientConnect(int index, const char *name, const char *address, std::string &reject)
+{
+    edict_t *edict = GetEdict(index);
+    bool allow_connect = true;
+    char reject_buffer[256] = "";
+
+    Time(Callback::ClientConnect, [&] {
+        _plugin->ClientConnect(&allow_connect, edict, name, address, reject_buffer, sizeof(reject_buffer));
+    });
+
+    reject_buffer[sizeof(reject_buffer) - 1] = '\0';
+    reject = reject_buffer;
+
+    return allow_connect;
+}
+
+PluginResult PluginHost::ClientCommand(int index, const CCommand &args)
+{
+    edict_t *edict = GetEdict(index);
+
+    // Version 1 reads the arguments from the engine, which doesn't exist here.
+    if (_version == 1)
+    {
+        return Time(Callback::ClientCommand, [&] {
+            return AsV1()->ClientCommand(edict);
+        });
+    }
+
+    return Time(Callback::ClientCommand, [&] {
+        return AsV2()->ClientCommand(edict, args);
+    });
+}
+
+PluginResult PluginHost::NetworkIDValidated(const char *user_name, const char *network_id)
+{
+    if (_version == 1)
+    {
+        return Time(Callback::NetworkIDValidated, [&] {
+            return AsV1()->NetworkIDValidated(user_name, network_id);
+        });
+    }
+
+    return Time(Callback::NetworkIDValidated, [&] {
+        return AsV2()->NetworkIDValidated(user_name, network_id);
+    });
+}
+
+void PluginHost::OnQueryCvarValueFinished(int cookie, int index, int status, const char *cvar_name, const char *cvar_value)
+{
+    if (_version < 2)
+        return;
+
+    edict_t *edict = GetEdict(index);
+
+    Time(Callback::OnQueryCvarValueFinished, [&] {
+        AsV2()->OnQueryCvarValueFinished(cookie, edict, status, cvar_name, cvar_value);
+    });
+}
+
+void PluginHost::OnEdictAllocated(int index)
+{
+    if (_version < 3)
+        return;
+
+    edict_t *edict = GetEdict(index);
+
+    Time(Callback::OnEdictAllocated, [&] {
+        AsV3()->OnEdictAllocated(edict);
+    });
+}
+
+void PluginHost::OnEdictFreed(int index)
+{
+    if (_version < 3)
+        return;
+
+    edict_t *edict = GetEdict(index);
+
+    Time(Callback::OnEdictFreed, [&] {
+        AsV3()->OnEdictFreed(edict);
+    });
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "callback.hpp"
+#include "ccommand.hpp"
+#include "interface.hpp"
+#include "stats.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Loads the plugin binary like the engine does and calls its callbacks, timing each call.
+ *
+ * Edicts are opaque to the plugin, so they are slots in a zeroed array and are passed around by
+ * index. Interfaces requested by the plugin are never found.
+ */
+struct PluginHost
+{
+public:
+    static constexpr int EDICT_COUNT = 2048;
+
+    // Size of `edict_t` in source-sdk-2013, so pointers look like they would in the game.
+    static constexpr std::size_t EDICT_SIZE = sizeof(void *) == 8 ? 32 : 20;
+
+private:
+    void *_tier0 = nullptr;
+    void *_library = nullptr;
+
+    int _version = 0;
+    IServerPluginCallbacks_Common *_plugin = nullptr;
+
+    std::vector<unsigned char> _edicts;
+
+    CallbackStats _stats;
+
+    IServerPluginCallbacks_v1 *AsV1() const
+    {
+        return static_cast<IServerPluginCallbacks_v1 *>(_plugin);
+    }
+
+    IServerPluginCallbacks_v2 *AsV2() const
+    {
+        return static_cast<IServerPluginCallbacks_v2 *>(_plugin);
+    }
+
+    IServerPluginCallbacks_v3 *AsV3() const
+    {
+        return static_cast<IServerPluginCallbacks_v3 *>(_plugin);
+    }
+
+    template<typename Fn>
+    auto Time(Callback callback, Fn &&fn)
+    {
+        struct Record
+        {
+            CallbackStats &stats;
+            Callback callback;
+            CallbackStats::Clock::time_point start = CallbackStats::Clock::now();
+
+            ~Record()
+            {
+                stats.Record(callback, CallbackStats::Clock::now() - start);
+            }
+        } record{ _stats, callback };
+
+        return fn();
+    }
+
+public:
+    PluginHost();
+
+    PluginHost(const PluginHost &) = delete;
+
+    PluginHost &operator=(const PluginHost &) = delete;
+
+    ~PluginHost();
+
+    /**
+     * @brief Gets the path of \c libtier0.so next to the running executable.
+     */
+    static std::string GetDefaultTier0Path();
+
+    /**
+     * @brief Loads the stub tier0 library and the plugin, and gets the plugin interface.
+     * @param version \c IServerPluginCallbacks version, 0 to try them from newest to oldest like the engine.
+     * @return \c false with \p error set on failure.
+     */
+    bool Open(const std::string &tier0_path, const std::string &plugin_path, int version, std::string &error);
+
+    /**
+     * @brief Drops messages the plugin prints, warnings still go to \c stderr.
+     */
+    void SetQuiet(bool quiet);
+
+    int GetVersion() const
+    {
+        return _version;
+    }
+
+    /**
+     * @return \c nullptr for indices outside of the edict list.
+     */
+    edict_t *GetEdict(int index);
+
+    const CallbackStats &GetStats() const
+    {
+        return _stats;
+    }
+
+    /**
+     * @brief Fills \p command like the engine tokenizes \p argv.
+     * @return \c false if the arguments don't fit.
+     */
+    static bool MakeCommand(const std::vector<std::string> &argv, CCommand &command);
+
+    /**
+     * @brief Fills \p command with an argument string as the engine received it and its tokens.
+     * @param argv0_size Offset of \c ArgS() in \p args.
+     */
+    static bool MakeCommand(const std::string &args, int argv0_size, const std::vector<std::string> &argv, CCommand &command);
+
+    /**
+     * @brief Prints call counts, throughput and latencies of the callbacks that were called.
+     * @param seconds Time the calls were spread over.
+     * @param ticks Durations of whole server frames, if they were measured.
+     */
+    void PrintReport(double seconds, const LatencyHistogram *ticks) const;
+
+    bool Load();
+
+    void Unload();
+
+    const char *GetPluginDescription();
+
+    void Pause();
+
+    void UnPause();
+
+    void LevelInit(const char *map_name);
+
+    void ServerActivate(int edict_count, int client_max);
+
+    void GameFrame(bool simulating);
+
+    void LevelShutdown();
+
+    void ClientActive(int index);
+
+    void ClientDisconnect(int index);
+
+    void ClientPutInServer(int index, const char *player_name);
+
+    void SetCommandClient(int index);
+
+    void ClientSettingsChanged(int index);
+
+    /**
+     * @return Whether the client was allowed to connect, \p reject holds the reason otherwise.
+     */
+    bool ClientConnect(int index, const char *name, const char *address, std::string &reject);
+
+    PluginResult ClientCommand(int index, const CCommand &args);
+
+    PluginResult NetworkIDValidated(const char *user_name, const char *network_id);
+
+    void OnQueryCvarValueFinished(int cookie, int index, int status, const char *cvar_name, const char *cvar_value);
+
+    void OnEdictAllocated(int index);
+
+    void OnEdictFreed(int index);
+};
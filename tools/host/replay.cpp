@@ -0,0 +1,367 @@
+// Replays a trace of callbacks recorded by the plugin, outside of the game, and reports how long
+// each callback took.
+//
+// Usage: lua_plugin_replay [options] <plugin binary> <trace>
+//
+// Options:
+//   --interface <1-3>   IServerPluginCallbacks version, the recorded one by default
+//   --tier0 <path>      stub tier0 library, libtier0.so next to the replay tool by default
+//   --speed <factor>    playback speed relative to the recording, 0 to run as fast as possible
+//   --quiet             drop messages printed by the plugin
+
+#include "pluginhost.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+
+struct Options
+{
+    int interface_version = 0;
+    std::string tier0_path;
+    std::string plugin_path;
+    std::string trace_path;
+    double speed = 1.0;
+    bool quiet = false;
+};
+
+
+static bool ParseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+
+        if (std::strcmp(arg, "--quiet") == 0)
+        {
+            options.quiet = true;
+            continue;
+        }
+
+        if (std::strncmp(arg, "--", 2) != 0)
+        {
+            if (options.plugin_path.empty())
+                options.plugin_path = arg;
+            else if (options.trace_path.empty())
+                options.trace_path = arg;
+            else
+            {
+                std::fprintf(stderr, "unexpected argument \"%s\"\n", arg);
+                return false;
+            }
+
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::fprintf(stderr, "%s: missing value\n", arg);
+            return false;
+        }
+
+        const char *value = argv[++i];
+        char *end = nullptr;
+
+        if (std::strcmp(arg, "--interface") == 0)
+        {
+            long version = std::strtol(value, &end, 10);
+            if (end == value || *end != '\0' || version < 1 || version > 3)
+            {
+                std::fprintf(stderr, "%s: expected 1, 2 or 3\n", arg);
+                return false;
+            }
+
+            options.interface_version = static_cast<int>(version);
+        }
+        else if (std::strcmp(arg, "--speed") == 0)
+        {
+            options.speed = std::strtod(value, &end);
+            if (end == value || *end != '\0' || !(options.speed >= 0.0))
+            {
+                std::fprintf(stderr, "%s: expected a number of at least 0\n", arg);
+                return false;
+            }
+        }
+        else if (std::strcmp(arg, "--tier0") == 0)
+            options.tier0_path = value;
+        else
+        {
+            std::fprintf(stderr, "unknown option \"%s\"\n", arg);
+            return false;
+        }
+    }
+
+    if (options.trace_path.empty())
+    {
+        std::fprintf(stderr, "usage: %s [options] <plugin binary> <trace>\n", argc > 0 ? argv[0] : "lua_plugin_replay");
+        return false;
+    }
+
+    if (options.tier0_path.empty())
+        options.tier0_path = PluginHost::GetDefaultTier0Path();
+
+    // Relative paths would be searched for in the library path instead.
+    options.plugin_path = fs::absolute(options.plugin_path).string();
+    options.tier0_path = fs::absolute(options.tier0_path).string();
+
+    return true;
+}
+
+static int GetEdictIndex(const TraceRecord &record)
+{
+    if (record.edict == TRACE_NO_EDICT)
+        return -1;
+
+    return static_cast<int>(std::min<std::uint32_t>(record.edict, INT_MAX));
+}
+
+
+/**
+ * @brief Calls the callback of \p record.
+ * @return \c false if the host can't make the call.
+ */
+static bool Dispatch(PluginHost &host, const TraceRecord &record, CCommand &command)
+{
+    int edict = GetEdictIndex(record);
+
+    switch (record.callback)
+    {
+    case Callback::Load:
+        // Loaded before the first record.
+        return true;
+
+    case Callback::Unload:
+        host.Unload();
+        return true;
+
+    case Callback::Pause:
+        host.Pause();
+        return true;
+
+    case Callback::UnPause:
+        host.UnPause();
+        return true;
+
+    case Callback::GetPluginDescription:
+        host.GetPluginDescription();
+        return true;
+
+    case Callback::LevelInit:
+        host.LevelInit(record.strings[0].c_str());
+        return true;
+
+    case Callback::ServerActivate:
+        host.ServerActivate(static_cast<int>(record.integers[0]), static_cast<int>(record.integers[1]));
+        return true;
+
+    case Callback::GameFrame:
+        host.GameFrame(record.integers[0] != 0);
+        return true;
+
+    case Callback::LevelShutdown:
+        host.LevelShutdown();
+        return true;
+
+    case Callback::ClientActive:
+        host.ClientActive(edict);
+        return true;
+
+    case Callback::ClientDisconnect:
+        host.ClientDisconnect(edict);
+        return true;
+
+    case Callback::ClientPutInServer:
+        host.ClientPutInServer(edict, record.strings[0].c_str());
+        return true;
+
+    case Callback::SetCommandClient:
+        host.SetCommandClient(static_cast<int>(record.integers[0]));
+        return true;
+
+    case Callback::ClientSettingsChanged:
+        host.ClientSettingsChanged(edict);
+        return true;
+
+    case Callback::ClientConnect:
+    {
+        std::string reject;
+        host.ClientConnect(edict, record.strings[0].c_str(), record.strings[1].c_str(), reject);
+        return true;
+    }
+
+    case Callback::ClientCommand:
+        // Commands recorded by version 1 don't have arguments, they are passed as empty ones.
+        if (record.has_command)
+        {
+            if (!PluginHost::MakeCommand(record.args, record.argv0_size, record.argv, command))
+                return false;
+        }
+        else
+            PluginHost::MakeCommand({}, command);
+
+        host.ClientCommand(edict, command);
+        return true;
+
+    case Callback::NetworkIDValidated:
+        host.NetworkIDValidated(record.strings[0].c_str(), record.strings[1].c_str());
+        return true;
+
+    case Callback::OnQueryCvarValueFinished:
+        host.OnQueryCvarValueFinished(
+            static_cast<int>(record.integers[0]),
+            edict,
+            static_cast<int>(record.integers[1]),
+            record.strings[0].c_str(),
+            record.strings[1].c_str()
+        );
+        return true;
+
+    case Callback::OnEdictAllocated:
+        host.OnEdictAllocated(edict);
+        return true;
+
+    case Callback::OnEdictFreed:
+        host.OnEdictFreed(edict);
+        return true;
+
+    default:
+        // Portal 2's `ClientFullyConnect` has no counterpart in the other interfaces.
+        return false;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+        return 1;
+
+    TraceReader reader;
+    std::string error;
+
+    if (!reader.Open(options.trace_path, error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    int version = options.interface_version;
+    if (version == 0)
+    {
+        auto recorded = reader.GetHeader().interface_version;
+        version = recorded >= 1 && recorded <= 3 ? static_cast<int>(recorded) : 0;
+    }
+
+    PluginHost host;
+    if (!host.Open(options.tier0_path, options.plugin_path, version, error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    host.SetQuiet(options.quiet);
+
+    std::fprintf(
+        stderr,
+        "Replaying %s into %s through ISERVERPLUGINCALLBACKS00%d\n",
+        options.trace_path.c_str(), options.plugin_path.c_str(), host.GetVersion()
+    );
+
+    // Traces started after the plugin was loaded don't have a `Load` record.
+    if (!host.Load())
+    {
+        // The engine unloads plugins that fail to load.
+        host.Unload();
+        std::fprintf(stderr, "The plugin failed to load.\n");
+        return 1;
+    }
+
+    using Clock = CallbackStats::Clock;
+
+    TraceRecord record;
+    CCommand command;
+    std::uint64_t records = 0;
+    std::uint64_t skipped = 0;
+    std::uint64_t last_time = 0;
+    bool unloaded = false;
+
+    // Time spent in callbacks from one `GameFrame` to the next.
+    LatencyHistogram ticks;
+    Clock::duration frame_time{};
+    bool in_frame = false;
+    Clock::duration max_lag{};
+
+    auto start = Clock::now();
+
+    while (reader.Next(record, error))
+    {
+        if (options.speed > 0.0)
+        {
+            auto target = start + std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(record.time) / options.speed);
+            auto now = Clock::now();
+
+            if (target > now)
+                std::this_thread::sleep_until(target);
+            else
+                max_lag = std::max(max_lag, now - target);
+        }
+
+        if (record.callback == Callback::GameFrame)
+        {
+            if (in_frame)
+                ticks.Record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time).count()));
+
+            frame_time = {};
+            in_frame = true;
+        }
+
+        auto call_start = Clock::now();
+        bool dispatched = Dispatch(host, record, command);
+        frame_time += Clock::now() - call_start;
+
+        if (!dispatched)
+            skipped++;
+
+        records++;
+        last_time = record.time;
+        unloaded = record.callback == Callback::Unload;
+    }
+
+    if (in_frame)
+        ticks.Record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time).count()));
+
+    auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (!unloaded)
+        host.Unload();
+
+    if (!error.empty())
+        std::fprintf(stderr, "%s\n", error.c_str());
+
+    host.PrintReport(seconds, &ticks);
+
+    std::printf(
+        "%llu records spanning %.3f s, %llu skipped",
+        static_cast<unsigned long long>(records),
+        last_time / 1e9,
+        static_cast<unsigned long long>(skipped)
+    );
+
+    if (options.speed > 0.0)
+        std::printf(", at most %.3f ms behind", std::chrono::duration<double, std::milli>(max_lag).count());
+
+    std::printf("\n");
+
+    return error.empty() ? 0 : 1;
+}
@@ -0,0 +1,38 @@
+// Stand-in for the engine's tier0 library, so the plugin finds `Msg` and `Warning` outside of the
+// game. Loaded by the host before the plugin.
+
+#include <cstdarg>
+#include <cstdio>
+
+#define EXPORT extern "C" __attribute__((visibility("default")))
+
+
+static bool quiet = false;
+
+
+EXPORT void Msg(const char *format, ...)
+{
+    if (quiet)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(stdout, format, args);
+    va_end(args);
+}
+
+EXPORT void Warning(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    std::vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+/**
+ * @brief Drops everything printed with `Msg`, so console output doesn't skew measurements.
+ */
+EXPORT void HostSetQuiet(bool value)
+{
+    quiet = value;
+}
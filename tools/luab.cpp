@@ -0,0 +1,201 @@
+// Compiles a directory of Lua modules into a bundle that the plugin can load instead of the files.
+//
+// Usage: luab <output.luab> <source directory>
+
+#include "bundle.hpp"
+
+#include <lua.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+
+static int Writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), sz);
+    return 0;
+}
+
+/**
+ * @brief Turns `foo/bar.lua` into `foo.bar` and `foo/init.lua` into `foo`.
+ */
+static std::string GetModuleName(const fs::path &relative_path)
+{
+    fs::path module_path = relative_path;
+    module_path.replace_extension();
+
+    if (module_path.filename() == "init" && module_path.has_parent_path())
+        module_path = module_path.parent_path();
+
+    std::string name;
+    for (const auto &part : module_path)
+    {
+        if (!name.empty())
+            name.push_back('.');
+
+        name.append(part.string());
+    }
+
+    return name;
+}
+
+static bool Compile(lua_State *L, const fs::path &path, const std::string &chunk_name, std::string &chunk)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string source(std::istreambuf_iterator<char>(file), {});
+
+    if (!file.good() && !file.eof())
+    {
+        std::fprintf(stderr, "%s: could not read file\n", path.string().c_str());
+        return false;
+    }
+
+    if (luaL_loadbuffer(L, source.data(), source.size(), chunk_name.c_str()) != LUA_OK)
+    {
+        std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+
+    lua_dump(L, &Writer, &chunk);
+    lua_pop(L, 1);
+
+    return true;
+}
+
+template<typename T>
+static void Append(std::string &out, const T &value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::fprintf(stderr, "Usage: %s <output.luab> <source directory>\n", argv[0]);
+        return 1;
+    }
+
+    fs::path output_path = argv[1];
+    fs::path source_directory = argv[2];
+
+    // Sorted by name, as required by the bundle index.
+    std::map<std::string, fs::path> modules;
+
+    std::error_code error;
+    for (fs::recursive_directory_iterator it(source_directory, error), end; !error && it != end; it.increment(error))
+    {
+        if (!it->is_regular_file() || it->path().extension() != ".lua")
+            continue;
+
+        auto relative_path = fs::relative(it->path(), source_directory);
+        auto name = GetModuleName(relative_path);
+
+        // `foo.lua` comes before `foo/init.lua` on `package.path`.
+        auto existing = modules.find(name);
+        if (existing != modules.end() && existing->second.filename() != "init.lua")
+            continue;
+
+        modules[name] = relative_path;
+    }
+
+    if (error)
+    {
+        std::fprintf(stderr, "%s: %s\n", source_directory.string().c_str(), error.message().c_str());
+        return 1;
+    }
+
+    lua_State *L = luaL_newstate();
+    if (L == nullptr)
+    {
+        std::fprintf(stderr, "Could not create Lua state.\n");
+        return 1;
+    }
+
+    std::string names;
+    std::string chunks;
+    std::vector<BundleEntry> entries;
+
+    for (const auto &[name, relative_path] : modules)
+    {
+        // Error messages and tracebacks point to the source file.
+        std::string chunk_name = "@" + relative_path.generic_string();
+
+        std::string chunk;
+        if (!Compile(L, source_directory / relative_path, chunk_name, chunk))
+        {
+            lua_close(L);
+            return 1;
+        }
+
+        BundleEntry entry;
+        entry.name_offset = static_cast<std::uint32_t>(names.size());
+        entry.name_length = static_cast<std::uint32_t>(name.size());
+        entry.chunk_offset = static_cast<std::uint32_t>(chunks.size());
+        entry.chunk_length = static_cast<std::uint32_t>(chunk.size());
+        entries.push_back(entry);
+
+        names.append(name);
+        chunks.append(chunk);
+
+        std::printf("%s <- %s\n", name.c_str(), relative_path.generic_string().c_str());
+    }
+
+    lua_close(L);
+
+    // Turn offsets into the name and chunk blobs into file offsets.
+    auto names_offset = sizeof(BundleHeader) + entries.size() * sizeof(BundleEntry);
+    auto chunks_offset = names_offset + names.size();
+
+    for (auto &entry : entries)
+    {
+        entry.name_offset += static_cast<std::uint32_t>(names_offset);
+        entry.chunk_offset += static_cast<std::uint32_t>(chunks_offset);
+    }
+
+    BundleHeader header;
+    std::memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_VERSION;
+    header.entry_count = static_cast<std::uint32_t>(entries.size());
+    header.reserved = 0;
+
+    std::string bundle;
+    Append(bundle, header);
+    for (const auto &entry : entries)
+        Append(bundle, entry);
+    bundle.append(names);
+    bundle.append(chunks);
+
+    // Write next to the output and rename, so a running server never sees a partial bundle.
+    fs::path temporary_path = output_path;
+    temporary_path += ".tmp";
+
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        if (!file.write(bundle.data(), bundle.size()) || !file.flush())
+        {
+            std::fprintf(stderr, "%s: could not write file\n", temporary_path.string().c_str());
+            return 1;
+        }
+    }
+
+    fs::rename(temporary_path, output_path, error);
+    if (error)
+    {
+        std::fprintf(stderr, "%s: %s\n", output_path.string().c_str(), error.message().c_str());
+        return 1;
+    }
+
+    std::printf("Wrote %zu modules to %s\n", entries.size(), output_path.string().c_str());
+    return 0;
+}